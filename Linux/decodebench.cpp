@@ -0,0 +1,243 @@
+/*
+ * decodebench.cpp
+ *
+ * Accuracy benchmark for the Local's CW decoder. Text is turned into key edges with
+ * the firmware's own Timing and Morse patterns, each mark and space is then moved
+ * by a random timing error, and the edges are fed to the Decoder from the Local
+ * sketch. The decoded text is compared with the sent text and the character error
+ * rate is reported against speed and timing jitter.
+ *
+ * Jitter is the standard deviation of a normal timing error in percent of a dit,
+ * every mark and space gets its own error the way a hand sent fist wanders. Lengths
+ * are never taken below a tenth of a dit. The decoder is seeded with the sending speed
+ * unless -o gives a seed speed error in percent, to check it locks on to a sender
+ * that is not at the configured speed.
+ *
+ * All randomness comes from a seeded generator so every run is reproducible.
+ *
+ * Build, from this directory:
+ *    g++ -O2 -I sim -I ../Local -o decodebench decodebench.cpp
+ *
+ * Usage:
+ *    decodebench run [-w wpm] [-j jitter %] [-o seed offset %] [-r repeats] [-s seed] [text]
+ *    decodebench sweep [-o seed offset %] [-r repeats] [-s seed] [text]
+ *
+ * Each run prints one CSV line:
+ *    wpm, jitter %, seed offset %, characters sent, character errors, CER %, average
+ *    confidence, decoder wpm, average nS per edge
+ * The text is sent repeats times, words separated by word spaces.
+ *
+ * Gordon Anderson
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "Decoder.h"
+
+// The decoder never reads the clock or pins, time is passed in with each edge
+uint32_t micros(void) { return 0; }
+void pinMode(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) { return 0; }
+void digitalWrite(uint8_t, uint8_t) {}
+
+// Seeded generator so runs repeat exactly
+
+static uint32_t rng;
+
+static uint32_t Random(void)
+{
+  rng = rng * 1664525 + 1013904223;
+  return rng >> 8;
+}
+
+// Normal with mean 0 and standard deviation 1, Box-Muller
+static double Normal(void)
+{
+  double u = (Random() + 1.0) / 16777217.0;
+  double v = Random() / 16777216.0;
+  return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+typedef struct
+{
+  int       Wpm;
+  int       JitterPct;
+  int       OffsetPct;
+  int       Repeats;
+  uint32_t  Seed;
+} RunParams;
+
+static RunParams params;
+
+static uint64_t Nanos(void)
+{
+  timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Character errors, edit distance between the sent and decoded text
+static int Distance(const std::string &a, const std::string &b)
+{
+  std::vector<int> row(b.size() + 1);
+
+  for(size_t j = 0; j <= b.size(); j++) row[j] = j;
+  for(size_t i = 1; i <= a.size(); i++)
+  {
+    int diag = row[0];
+    row[0] = i;
+    for(size_t j = 1; j <= b.size(); j++)
+    {
+      int up = row[j];
+      row[j] = std::min(std::min(row[j] + 1, row[j-1] + 1), diag + (a[i-1] != b[j-1]));
+      diag = up;
+    }
+  }
+  return row[b.size()];
+}
+
+// Edge times for the text, alternating key down and key up from the first down
+static std::vector<uint32_t> Edges(const std::string &text, const Timing &t)
+{
+  std::vector<uint32_t> edges;
+  uint32_t              at = 0;
+  double                sigma = t.Dit * params.JitterPct / 100.0;
+  double                floor = t.Dit / 10.0;
+
+  auto wander = [&](uint32_t len) -> uint32_t
+  {
+    double v = len;
+    if(sigma > 0) v += sigma * Normal();
+    return (v < floor) ? floor : v;
+  };
+  for(size_t i = 0; i < text.size(); i++)
+  {
+    if(text[i] == ' ')
+    {
+      // Stretch the character space already added to a word space
+      if(!edges.empty()) at += t.Word - t.Character;
+      continue;
+    }
+    for(int p = 0; patterns[p].Char != 0; p++)
+    {
+      if(patterns[p].Char != text[i]) continue;
+      for(int j = 0; patterns[p].Code[j] != 0; j++)
+      {
+        edges.push_back(at);
+        at += wander((patterns[p].Code[j] == '.') ? t.Dit : t.Dah);
+        edges.push_back(at);
+        at += wander((patterns[p].Code[j+1] == 0) ? t.Character : t.Element);
+      }
+      break;
+    }
+  }
+  return edges;
+}
+
+static void Run(const char *text)
+{
+  std::string sent, decoded;
+  Timing      timing;
+  Decoder     decoder;
+  Decoded     d;
+  unsigned    confSum = 0, confCount = 0;
+  uint64_t    ns = 0;
+
+  rng = params.Seed;
+  for(int r = 0; r < params.Repeats; r++)
+  {
+    if(r > 0) sent += ' ';
+    for(int i = 0; text[i] != 0; i++) sent += toupper(text[i]);
+  }
+  timing.set(params.Wpm);
+  std::vector<uint32_t> edges = Edges(sent, timing);
+  decoder.begin((uint64_t)timing.Dit * (100 + params.OffsetPct) / 100);
+
+  for(size_t i = 0; i < edges.size(); i++)
+  {
+    uint64_t start = Nanos();
+    decoder.edge(!(i & 1), edges[i]);
+    ns += Nanos() - start;
+    while(decoder.get(d))
+    {
+      decoded += d.Char;
+      if(d.Char != ' ')
+      {
+        confSum += d.Confidence;
+        confCount++;
+      }
+    }
+  }
+  if(!edges.empty()) decoder.poll(edges.back() + 10 * timing.Word);
+  while(decoder.get(d))
+  {
+    decoded += d.Char;
+    if(d.Char != ' ')
+    {
+      confSum += d.Confidence;
+      confCount++;
+    }
+  }
+  while(!decoded.empty() && (decoded.back() == ' ')) decoded.pop_back();
+
+  int errors = Distance(sent, decoded);
+  printf("%d,%d,%d,%d,%d,%.2f,%.1f,%d,%.0f\n", params.Wpm, params.JitterPct, params.OffsetPct, (int)sent.size(), errors,
+         sent.empty() ? 0.0 : 100.0 * errors / sent.size(), confCount ? (double)confSum / confCount : 0.0,
+         decoder.wpm(), edges.empty() ? 0.0 : (double)ns / edges.size());
+}
+
+int main(int argc, char *argv[])
+{
+  const char *text = "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG 0123456789";
+  bool sweep = false;
+
+  params = {25, 10, 0, 5, 1};
+  if((argc < 2) || ((strcmp(argv[1], "run") != 0) && (strcmp(argv[1], "sweep") != 0)))
+  {
+    fprintf(stderr, "Usage:\n  decodebench run [-w wpm] [-j jitter %%] [-o seed offset %%] [-r repeats] [-s seed] [text]\n  decodebench sweep [-o seed offset %%] [-r repeats] [-s seed] [text]\n");
+    return 1;
+  }
+  sweep = (strcmp(argv[1], "sweep") == 0);
+  for(int i = 2; i < argc; i++)
+  {
+    if((argv[i][0] == '-') && (i + 1 < argc))
+    {
+      const char *v = argv[++i];
+      switch (argv[i-1][1])
+      {
+        case 'w': params.Wpm = atoi(v); break;
+        case 'j': params.JitterPct = atoi(v); break;
+        case 'o': params.OffsetPct = atoi(v); break;
+        case 'r': params.Repeats = atoi(v); break;
+        case 's': params.Seed = strtoul(v, NULL, 0); break;
+      }
+    }
+    else text = argv[i];
+  }
+  if(params.Wpm < minWPM) params.Wpm = minWPM;
+  if(params.Wpm > maxWPM) params.Wpm = maxWPM;
+  if(params.JitterPct < 0) params.JitterPct = 0;
+  if(params.JitterPct > 100) params.JitterPct = 100;
+  if(params.OffsetPct < -50) params.OffsetPct = -50;
+  if(params.Repeats < 1) params.Repeats = 1;
+  printf("wpm,jitter %%,seed offset %%,sent,errors,CER %%,confidence,decoder wpm,nS per edge\n");
+  if(!sweep)
+  {
+    Run(text);
+    return 0;
+  }
+  const int jitters[] = {0, 10, 20, 30, 40, 50, 60};
+  for(int w = minWPM; w <= maxWPM; w += 5) for(int j : jitters)
+  {
+    params.Wpm = w;
+    params.JitterPct = j;
+    Run(text);
+  }
+  return 0;
+}
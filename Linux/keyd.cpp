@@ -0,0 +1,1129 @@
+/*
+ * keyd.cpp
+ *
+ * Linux Local controller for the KG7YU remote keyer system. Serves many Remotes at
+ * once, each Remote is a session with its own receive window, key down lease and
+ * Morse element player, the same classes the Local firmware runs.
+ *
+ * One receiver thread owns the UDP and TCP sockets through epoll. UDP messages are
+ * read in batches with recvmmsg, passed through the session's receive window and
+ * acknowledged in one sendmmsg per batch, then handed to the worker that owns the
+ * session through a single producer single consumer ring, no locks. Each worker
+ * plays the key events of its sessions and writes the key edges to the output sink.
+ *
+ * UDP messages follow ProcessUDP in Local.ino: D, U, ., -, E, R, W, A, p and the
+ * T, t link test. S, M and Q, CW text and memory messages, are not served here.
+ * The events of one recvmmsg batch are paired like RxBatch.h with the REPLAY policy,
+ * a complete key down and up of a session with the Remote's event times is queued
+ * with the mark and space the Remote keyed, and a key down followed by another key
+ * down is dropped. Events are not reordered, a late one is stale as before.
+ * Sessions are keyed by the Remote's UDP source address. SESSION,id,seq on the TCP
+ * port applies to the sessions from the same IP address, or to the next one to
+ * appear from it.
+ *
+ * Output sinks:
+ *    null               Counts key edges only, for load testing
+ *    file:<path>        Timeline, one line per key edge: nS since start, session, 1 or 0
+ *    gpio:<chip>[:base] GPIO character device, session n drives line base + n
+ *
+ * TCP commands, replies follow the firmware, ACK is 0x06 and NAK is 0x15?:
+ *    GVER               Version
+ *    GSESSIONS          Active sessions then one line per session: slot, address, id,
+ *                       packets, accepted, duplicates, stale, gaps, key edges, leases expired
+ *    GSTATS             Packets, batches, acks, ring full drops, unsupported, rejected,
+ *                       sessions, then receive to ack and receive to key uS as
+ *                       p50, p99, worst. Percentiles are log2 bin upper edges.
+ *    GHIST              The receive to ack and receive to key histograms, bin n counts
+ *                       2^n to 2^(n+1)-1 uS
+ *    RSTATS             Resets the statistics
+ *    SESSION,id,seq     Sent by the Remote on connect
+ *    GLINKTEST,slot     Link test samples, missed, min error, max error, sd in mS
+ *    GALLOC             Live bytes, peak, allocations, frees, violations, then one line
+ *                       per call site: address, count, bytes. Allocation tracking builds
+ *
+ * Build, from this directory:
+ *    g++ -O2 -pthread -I sim -I ../Local -o keyd keyd.cpp
+ *
+ * With allocation tracking, see AllocTrack.h. The receive path, Apply and the Morse
+ * players are guarded, -a 1 aborts on the first allocation in them:
+ *    g++ -O2 -pthread -DALLOC_TRACKING -I sim -I ../Local -o keyd keyd.cpp ../Local/AllocTrack.cpp
+ *
+ * Usage:
+ *    keyd [-u udp port] [-t tcp port] [-w workers] [-p tick uS] [-i idle s] [-o sink] [-a 0|1]
+ *
+ * Gordon Anderson
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/gpio.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include "Morse.h"
+#include "SeqWindow.h"
+#include "Lease.h"
+#include "AllocTrack.h"
+
+#define MaxSessions   1024
+#define RingSize      4096          // Events per worker ring, power of 2
+#define BatchSize     64            // Datagrams per recvmmsg
+#define ReplayMax     500000        // Longest replay of a session's batch, the Local default, uS
+#define ReplayPairs   (MaxElements / 2)   // Pairs queued per session per batch
+#define HistBins      20
+
+static const char *Version = "KeyD Version 1.0, October 19, 2026";
+
+static volatile bool running = true;
+
+static void Stop(int)
+{
+  running = false;
+}
+
+static uint64_t Nanos(clockid_t clock = CLOCK_MONOTONIC)
+{
+  timespec ts;
+
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Log2 histogram of latencies in uS, updated by one thread and read by another
+struct Histogram
+{
+  std::atomic<unsigned long> bins[HistBins];
+  std::atomic<uint32_t>      worst;
+  void reset(void)
+  {
+    for(int i = 0; i < HistBins; i++) bins[i].store(0, std::memory_order_relaxed);
+    worst.store(0, std::memory_order_relaxed);
+  }
+  void add(uint32_t us)
+  {
+    int bin = (us == 0) ? 0 : 31 - __builtin_clz(us);
+    if(bin >= HistBins) bin = HistBins - 1;
+    bins[bin].fetch_add(1, std::memory_order_relaxed);
+    if(us > worst.load(std::memory_order_relaxed)) worst.store(us, std::memory_order_relaxed);
+  }
+  // Upper edge of the bin holding the given fraction of the samples
+  uint32_t percentile(double p)
+  {
+    unsigned long total = 0, sum = 0;
+    for(int i = 0; i < HistBins; i++) total += bins[i].load(std::memory_order_relaxed);
+    if(total == 0) return 0;
+    for(int i = 0; i < HistBins; i++)
+    {
+      sum += bins[i].load(std::memory_order_relaxed);
+      if(sum >= p * total) return (2UL << i) - 1;
+    }
+    return worst.load(std::memory_order_relaxed);
+  }
+};
+
+// Key event handed from the receiver to a worker
+typedef struct
+{
+  uint64_t  RxNs;                   // Kernel receive time, CLOCK_REALTIME
+  uint16_t  Session;
+  char      Type;                   // UDP message type, or N new stream, X close, Q replayed pair
+  uint8_t   Seq;
+  uint8_t   Data[8];                // E frame bytes 2 to 7, W speed, weight, ratio, Farnsworth,
+                                    // D and U time keyed, Q mark and space uS
+} Event;
+
+// Single producer single consumer ring
+class Ring
+{
+  private:
+    Event                 items[RingSize];
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+  public:
+    bool push(const Event &ev)
+    {
+      uint32_t t = tail.load(std::memory_order_relaxed);
+      if((t - head.load(std::memory_order_acquire)) >= RingSize) return false;
+      items[t & (RingSize - 1)] = ev;
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+    bool pop(Event &ev)
+    {
+      uint32_t h = head.load(std::memory_order_relaxed);
+      if(h == tail.load(std::memory_order_acquire)) return false;
+      ev = items[h & (RingSize - 1)];
+      head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+};
+
+// Output sinks, key() is called from the worker threads
+
+class Sink
+{
+  public:
+    virtual ~Sink() {}
+    virtual void key(int session, bool down, uint64_t ns) = 0;
+    // Called once per worker tick
+    virtual void flush(void) {}
+    // Called by the receiver about once a second
+    virtual void sync(void) {}
+};
+
+class NullSink : public Sink
+{
+  public:
+    void key(int, bool, uint64_t) {}
+};
+
+// Each worker fills its own fixed buffer, written out when full or at the end of
+// its pass. The stdio buffer is given up front, nothing is allocated per edge.
+#define LineBufSize   16384
+
+class FileSink : public Sink
+{
+  private:
+    FILE        *f;
+    std::mutex  lock;
+    uint64_t    start;
+    char        io[65536];
+    static thread_local char buffer[LineBufSize];
+    static thread_local int  used;
+  public:
+    FileSink(FILE *file) : f(file)
+    {
+      start = Nanos();
+      setvbuf(f, io, _IOFBF, sizeof(io));
+    }
+    ~FileSink() { fclose(f); }
+    void key(int session, bool down, uint64_t ns)
+    {
+      if((LineBufSize - used) < 48) flush();
+      used += snprintf(buffer + used, 48, "%llu %d %d\n", (unsigned long long)(ns - start), session, down);
+    }
+    void flush(void)
+    {
+      if(used == 0) return;
+      std::lock_guard<std::mutex> guard(lock);
+      fwrite(buffer, 1, used, f);
+      used = 0;
+    }
+    void sync(void)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      fflush(f);
+    }
+};
+thread_local char FileSink::buffer[LineBufSize];
+thread_local int  FileSink::used = 0;
+
+// Linux GPIO character device, one line handle per session requested on the first
+// edge. Each session belongs to one worker so its handle is only used by that thread.
+class GpioSink : public Sink
+{
+  private:
+    int             chip;
+    int             base;
+    std::vector<int> handles;
+    std::atomic<unsigned long> failed{0};
+  public:
+    GpioSink(int fd, int first) : chip(fd), base(first), handles(MaxSessions, -1) {}
+    ~GpioSink()
+    {
+      for(int h : handles) if(h >= 0) close(h);
+      close(chip);
+    }
+    void key(int session, bool down, uint64_t)
+    {
+      int &h = handles[session];
+      if(h == -1)
+      {
+        gpiohandle_request req;
+        memset(&req, 0, sizeof(req));
+        req.lineoffsets[0] = base + session;
+        req.lines = 1;
+        req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+        snprintf(req.consumer_label, sizeof(req.consumer_label), "keyd%d", session);
+        h = (ioctl(chip, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0) ? -2 : req.fd;
+      }
+      if(h < 0) { failed++; return; }
+      gpiohandle_data data;
+      memset(&data, 0, sizeof(data));
+      data.values[0] = down;
+      if(ioctl(h, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0) failed++;
+    }
+};
+
+static Sink *OpenSink(const char *spec)
+{
+  if(strcmp(spec, "null") == 0) return new NullSink();
+  if(strncmp(spec, "file:", 5) == 0)
+  {
+    FILE *f = fopen(spec + 5, "w");
+    if(f == NULL) { perror(spec + 5); return NULL; }
+    return new FileSink(f);
+  }
+  if(strncmp(spec, "gpio:", 5) == 0)
+  {
+    std::string path = spec + 5;
+    int base = 0;
+    size_t colon = path.find(':');
+    if(colon != std::string::npos)
+    {
+      base = atoi(path.c_str() + colon + 1);
+      path.resize(colon);
+    }
+    int fd = open(path.c_str(), O_RDWR);
+    if(fd < 0) { perror(path.c_str()); return NULL; }
+    return new GpioSink(fd, base);
+  }
+  fprintf(stderr, "Unknown sink %s\n", spec);
+  return NULL;
+}
+
+// Sessions
+
+enum SessionStates
+{
+  SessionFree,
+  SessionActive,
+  SessionClosing
+};
+
+struct LinkTest
+{
+  bool      Active;
+  float     Spacing;                // Expected message spacing, mS
+  int       Size;                   // Samples wanted
+  int       Samples;
+  int       Missed;
+  float     MinError, MaxError, SumSq;
+  uint64_t  Last;
+};
+
+struct Session
+{
+  std::atomic<int> state{SessionFree};
+  // Receiver thread
+  sockaddr_in    addr;
+  uint64_t       key;
+  int            id;
+  SeqWindow      window;
+  uint64_t       lastRx;
+  unsigned long  packets;
+  LinkTest       link;
+  // Owning worker thread
+  Morse<0, true> morse;
+  Lease          lease;
+  uint8_t        frameChar, frameQueued;
+  int            wpm, weight, ratio, farnsworth;
+  // Published by the worker
+  std::atomic<unsigned long> edges{0};
+  std::atomic<unsigned long> expired{0};
+};
+
+static Session *sessions;
+static Sink    *sink;
+static int     numWorkers;
+static int     tickUs = 200;
+
+// The session a worker is running, key edges from its Morse player go to the sink
+static thread_local Session *current = NULL;
+
+uint32_t micros(void) { return Nanos() / 1000; }
+void pinMode(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) { return 0; }
+void digitalWrite(uint8_t, uint8_t val)
+{
+  if(current == NULL) return;
+  sink->key(current - sessions, val != 0, Nanos());
+  current->edges.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Worker state, only touched by the worker thread
+static void SessionReset(Session &s)
+{
+  s.morse.abort();
+  s.morse.KeyUp();
+  s.morse.lease(DefaultLease);
+  s.morse.wpm(s.wpm = 19, s.weight = 50, s.ratio = 30, s.farnsworth = 0);
+  s.lease.reset();
+  s.frameChar = s.frameQueued = 0;
+}
+
+// Workers
+
+struct Worker
+{
+  int         index;
+  Ring        ring;
+  Histogram   applied;              // Kernel receive to key event played
+  std::thread thread;
+};
+
+static std::vector<Worker *> workers;
+
+// An R after the lease ran out keys the transmitter again, see Lease.h
+static void LeaseRenew(Session &s)
+{
+  uint32_t now = micros();
+
+  if(!s.morse.keyed())
+  {
+    if(!s.lease.lapsed) return;
+    s.lease.rekeys++;
+    s.morse.KeyDown();
+    s.lease.start(now);
+    return;
+  }
+  s.morse.lease(s.lease.renew(now));
+  s.morse.renew();
+}
+
+static void CharFrame(Session &s, const uint8_t *frame)
+{
+  uint8_t count = frame[1];
+  uint8_t bits = frame[2];
+
+  if((frame[3] != s.wpm) || (frame[4] != s.weight) || (frame[5] != s.ratio))
+  {
+    if((frame[3] >= minWPM) && (frame[3] <= maxWPM)) s.wpm = frame[3];
+    s.weight = frame[4];
+    s.ratio = frame[5];
+    s.morse.wpm(s.wpm, s.weight, s.ratio, s.farnsworth);
+  }
+  if(frame[0] != s.frameChar)
+  {
+    s.frameChar = frame[0];
+    s.frameQueued = 0;
+  }
+  if(count > 8) count = 8;
+  for(; s.frameQueued < count; s.frameQueued++)
+  {
+    if(bits & (1 << s.frameQueued)) s.morse.Dash();
+    else s.morse.Dit();
+  }
+}
+
+static void Apply(Worker *w, const Event &ev)
+{
+  ALLOC_GUARD("Apply");
+  Session &s = sessions[ev.Session];
+
+  current = &s;
+  switch (ev.Type)
+  {
+    case 'D':
+      s.morse.KeyDown();
+      s.lease.start(micros());
+      break;
+    case 'U':
+      s.morse.KeyUp();
+      break;
+    case 'Q':
+    {
+      uint32_t mark, space;
+      memcpy(&mark, ev.Data, 4);
+      memcpy(&space, ev.Data + 4, 4);
+      s.morse.queue(mark, space);
+      break;
+    }
+    case '.':
+      s.morse.Dit();
+      break;
+    case '-':
+      s.morse.Dash();
+      break;
+    case 'E':
+      CharFrame(s, ev.Data);
+      break;
+    case 'R':
+      LeaseRenew(s);
+      break;
+    case 'W':
+      if((ev.Data[0] >= minWPM) && (ev.Data[0] <= maxWPM)) s.wpm = ev.Data[0];
+      if(ev.Data[1] != 0) s.weight = ev.Data[1];
+      if(ev.Data[2] != 0) s.ratio = ev.Data[2];
+      s.farnsworth = ev.Data[3];
+      s.morse.wpm(s.wpm, s.weight, s.ratio, s.farnsworth);
+      break;
+    case 'A':
+      s.morse.abort();
+      break;
+    case 'N':
+      // New stream from a SESSION with a new id
+      s.lease.reset();
+      s.morse.lease(DefaultLease);
+      break;
+    case 'X':
+      SessionReset(s);
+      s.expired.store(0, std::memory_order_relaxed);
+      s.edges.store(0, std::memory_order_relaxed);
+      s.state.store(SessionFree, std::memory_order_release);
+      return;
+  }
+  current = NULL;
+  w->applied.add((Nanos(CLOCK_REALTIME) - ev.RxNs) / 1000);
+}
+
+static void WorkerRun(Worker *w)
+{
+  Event    ev;
+  timespec next;
+  uint32_t lastCheck = micros();
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while(running)
+  {
+    while(w->ring.pop(ev)) Apply(w, ev);
+    bool check = (micros() - lastCheck) >= 1000;
+    if(check) lastCheck = micros();
+    for(int i = w->index; i < MaxSessions; i += numWorkers)
+    {
+      Session &s = sessions[i];
+      if(s.state.load(std::memory_order_acquire) != SessionActive) continue;
+      ALLOC_GUARD("Morse::process");
+      current = &s;
+      s.morse.process();
+      if(check && s.morse.check())
+      {
+        uint32_t us;
+        if(s.lease.expired(us)) s.morse.lease(us);
+        s.expired.store(s.morse.expired, std::memory_order_relaxed);
+      }
+    }
+    current = NULL;
+    sink->flush();
+    if(tickUs == 0) continue;
+    next.tv_nsec += tickUs * 1000;
+    if(next.tv_nsec >= 1000000000) { next.tv_sec++; next.tv_nsec -= 1000000000; }
+    // Running late, start again from now rather than spinning to catch up
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if((now.tv_sec > next.tv_sec) || ((now.tv_sec == next.tv_sec) && (now.tv_nsec > next.tv_nsec))) next = now;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+}
+
+// Receiver
+
+static std::unordered_map<uint64_t, int> byAddress;
+static std::unordered_map<uint32_t, std::pair<int, int>> pendingSession;   // IP to id, seq
+static int           nextSlot = 0;
+static Histogram     acked;         // Kernel receive to acknowledgement sent
+static unsigned long packets, batches, acks, drops, unsupported, rejected;
+
+static uint64_t AddressKey(const sockaddr_in &a)
+{
+  return ((uint64_t)a.sin_addr.s_addr << 16) | a.sin_port;
+}
+
+static bool Handoff(int slot, const Event &ev)
+{
+  if(workers[slot % numWorkers]->ring.push(ev)) return true;
+  drops++;
+  return false;
+}
+
+// Applies SESSION,id,seq to a session, a new id starts the receive window at seq
+static void SessionStart(Session &s, int slot, int id, int seq)
+{
+  if(id == s.id) return;
+  s.id = id;
+  s.window.start(seq);
+  Event ev = {Nanos(CLOCK_REALTIME), (uint16_t)slot, 'N', 0, {0}};
+  Handoff(slot, ev);
+}
+
+// Events of one receive batch, held so key downs and ups can be paired as RxBatch.h
+// does before they are handed off
+
+typedef struct
+{
+  int       Slot;
+  Event     Ev;
+  bool      Timed;                  // D or U with the time keyed
+  bool      Drop;
+  bool      Fitted;                 // Q fitted to ReplayMax
+} Held;
+
+static Held held[BatchSize];
+static int  numHeld = 0;
+
+static void Hold(int slot, const Event &ev, bool timed)
+{
+  held[numHeld++] = {slot, ev, timed, false, false};
+}
+
+static uint32_t HeldTime(int i)
+{
+  uint32_t t;
+
+  memcpy(&t, held[i].Ev.Data, 4);
+  return t;
+}
+
+// Next key down or up of the same session after i, -1 if none
+static int NextUpDown(int i)
+{
+  for(int j = i + 1; j < numHeld; j++)
+  {
+    if(held[j].Slot != held[i].Slot) continue;
+    if((held[j].Ev.Type == 'D') || (held[j].Ev.Type == 'U')) return j;
+  }
+  return -1;
+}
+
+// Pairs the held key downs and ups and hands the batch off in order
+static void Flush(void)
+{
+  for(int i = 0; i < numHeld; i++)
+  {
+    Held &d = held[i];
+    if(d.Ev.Type != 'D') continue;
+    int j = NextUpDown(i);
+    if(j < 0) continue;
+    Held &u = held[j];
+    // Superseded, its key up was lost
+    if(u.Ev.Type == 'D')
+    {
+      d.Drop = true;
+      continue;
+    }
+    if(!d.Timed || !u.Timed) continue;
+    int pairs = 0;
+    for(int p = 0; p < i; p++) if((held[p].Slot == d.Slot) && (held[p].Ev.Type == 'Q')) pairs++;
+    if(pairs >= ReplayPairs) continue;
+    int      k = NextUpDown(j);
+    int32_t  mark = HeldTime(j) - HeldTime(i);
+    int32_t  space = ((k >= 0) && held[k].Timed) ? (int32_t)(HeldTime(k) - HeldTime(j)) : 0;
+    if((mark <= 0) || (space < 0)) continue;
+    d.Ev.Type = 'Q';
+    memcpy(d.Ev.Data, &mark, 4);
+    memcpy(d.Ev.Data + 4, &space, 4);
+    u.Drop = true;
+  }
+  // A session's pairs are played faster, in proportion, to fit in ReplayMax
+  for(int i = 0; i < numHeld; i++)
+  {
+    if((held[i].Ev.Type != 'Q') || held[i].Fitted) continue;
+    uint64_t total = 0;
+    uint32_t v[2];
+    for(int j = i; j < numHeld; j++)
+    {
+      if((held[j].Slot != held[i].Slot) || (held[j].Ev.Type != 'Q')) continue;
+      memcpy(v, held[j].Ev.Data, 8);
+      total += v[0] + v[1];
+    }
+    for(int j = i; j < numHeld; j++)
+    {
+      if((held[j].Slot != held[i].Slot) || (held[j].Ev.Type != 'Q')) continue;
+      held[j].Fitted = true;
+      if(total <= ReplayMax) continue;
+      memcpy(v, held[j].Ev.Data, 8);
+      v[0] = v[0] * (uint64_t)ReplayMax / total;
+      v[1] = v[1] * (uint64_t)ReplayMax / total;
+      memcpy(held[j].Ev.Data, v, 8);
+    }
+  }
+  for(int i = 0; i < numHeld; i++) if(!held[i].Drop) Handoff(held[i].Slot, held[i].Ev);
+  numHeld = 0;
+}
+
+static int SessionFind(const sockaddr_in &a, uint64_t now)
+{
+  uint64_t key = AddressKey(a);
+  auto it = byAddress.find(key);
+
+  if(it != byAddress.end()) return it->second;
+  for(int n = 0; n < MaxSessions; n++)
+  {
+    int slot = (nextSlot + n) % MaxSessions;
+    Session &s = sessions[slot];
+    if(s.state.load(std::memory_order_acquire) != SessionFree) continue;
+    nextSlot = slot + 1;
+    s.addr = a;
+    s.key = key;
+    s.id = 0;
+    s.window.reset();
+    s.window.resetStats();
+    s.lastRx = now;
+    s.packets = 0;
+    memset(&s.link, 0, sizeof(s.link));
+    s.state.store(SessionActive, std::memory_order_release);
+    byAddress[key] = slot;
+    auto p = pendingSession.find(a.sin_addr.s_addr);
+    if(p != pendingSession.end())
+    {
+      SessionStart(s, slot, p->second.first, p->second.second);
+      pendingSession.erase(p);
+    }
+    return slot;
+  }
+  rejected++;
+  return -1;
+}
+
+// T,spacing,size starts a link test, T alone ends it. Each t is a sample.
+static void LinkTestMessage(LinkTest &t, const char *buf, uint64_t now)
+{
+  if(buf[0] == 'T')
+  {
+    if(buf[1] != ',') { t.Active = false; return; }
+    char *end;
+    t.Spacing = strtof(buf + 2, &end);
+    if(*end != ',') return;
+    t.Size = atoi(end + 1);
+    t.Samples = -1;
+    t.Missed = 0;
+    t.MinError = t.MaxError = t.SumSq = 0;
+    t.Active = t.Size > 0;
+    return;
+  }
+  if(!t.Active) return;
+  if(t.Samples++ >= 0)
+  {
+    float e = (now - t.Last) / 1e6 - t.Spacing;
+    while(e > t.Spacing) { t.Missed++; e -= t.Spacing; }
+    if(e < t.MinError) t.MinError = e;
+    if(e > t.MaxError) t.MaxError = e;
+    t.SumSq += e * e;
+  }
+  t.Last = now;
+  if(t.Samples >= t.Size) t.Active = false;
+}
+
+static void ReceiveBatch(int udp)
+{
+  static char      bufs[BatchSize][256];
+  static char      ctrl[BatchSize][64];
+  static sockaddr_in from[BatchSize];
+  static iovec     iov[BatchSize];
+  static mmsghdr   msgs[BatchSize];
+  static uint8_t   ackBuf[BatchSize][4];
+  static iovec     ackIov[BatchSize];
+  static mmsghdr   ackMsgs[BatchSize];
+  uint64_t         rxNs[BatchSize];
+  uint64_t         ackRx[BatchSize];
+
+  while(true)
+  {
+    for(int i = 0; i < BatchSize; i++)
+    {
+      iov[i] = {bufs[i], sizeof(bufs[i]) - 1};
+      memset(&msgs[i].msg_hdr, 0, sizeof(msghdr));
+      msgs[i].msg_hdr.msg_name = &from[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_control = ctrl[i];
+      msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+    }
+    int n = recvmmsg(udp, msgs, BatchSize, MSG_DONTWAIT, NULL);
+    if(n <= 0) return;
+    batches++;
+    packets += n;
+    uint64_t now = Nanos();
+    uint64_t wall = Nanos(CLOCK_REALTIME);
+    int      nacks = 0;
+    for(int i = 0; i < n; i++)
+    {
+      char    *buf = bufs[i];
+      int     num = msgs[i].msg_len;
+      buf[num] = 0;
+      rxNs[i] = wall;
+      for(cmsghdr *c = CMSG_FIRSTHDR(&msgs[i].msg_hdr); c != NULL; c = CMSG_NXTHDR(&msgs[i].msg_hdr, c))
+      {
+        if((c->cmsg_level != SOL_SOCKET) || (c->cmsg_type != SCM_TIMESTAMPNS)) continue;
+        timespec ts;
+        memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+        rxNs[i] = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+      }
+      if(num < 1) continue;
+      int slot = SessionFind(from[i], now);
+      if(slot < 0) continue;
+      // A new session may allocate in SessionFind, nothing after it does
+      ALLOC_GUARD("ProcessUDP");
+      Session &s = sessions[slot];
+      s.lastRx = now;
+      s.packets++;
+      Event ev = {rxNs[i], (uint16_t)slot, buf[0], (uint8_t)((num >= 2) ? buf[1] : 0), {0}};
+      switch (buf[0])
+      {
+        case 'D':
+        case 'U':
+        case '.':
+        case '-':
+        case 'E':
+          if((buf[0] == 'E') && (num < 8)) break;
+          if(buf[0] == 'E') memcpy(ev.Data, &buf[2], 6);
+          if(((buf[0] == 'D') || (buf[0] == 'U')) && (num >= 6)) memcpy(ev.Data, &buf[2], 4);
+          if(num >= 2)
+          {
+            bool play = s.window.accept(buf[1]);
+            uint8_t *k = ackBuf[nacks];
+            k[0] = 'K';
+            k[1] = s.window.high;
+            k[2] = s.window.mask & 0xFF;
+            k[3] = s.window.mask >> 8;
+            ackIov[nacks] = {k, 4};
+            memset(&ackMsgs[nacks].msg_hdr, 0, sizeof(msghdr));
+            ackMsgs[nacks].msg_hdr.msg_name = &from[i];
+            ackMsgs[nacks].msg_hdr.msg_namelen = sizeof(from[i]);
+            ackMsgs[nacks].msg_hdr.msg_iov = &ackIov[nacks];
+            ackMsgs[nacks].msg_hdr.msg_iovlen = 1;
+            ackRx[nacks++] = rxNs[i];
+            if(!play) break;
+          }
+          Hold(slot, ev, ((buf[0] == 'D') || (buf[0] == 'U')) && (num >= 6));
+          break;
+        case 'R':
+          // Only renews the key down that is still current
+          if((num >= 2) && ((uint8_t)buf[1] == s.window.high)) Hold(slot, ev, false);
+          break;
+        case 'W':
+        {
+          // W,wpm[,weight,ratio,farnsworth]
+          char *p = buf + 1;
+          for(int f = 0; (f < 4) && (*p == ','); f++) ev.Data[f] = strtol(p + 1, &p, 10);
+          Hold(slot, ev, false);
+          break;
+        }
+        case 'A':
+          Hold(slot, ev, false);
+          break;
+        case 'T':
+        case 't':
+          LinkTestMessage(s.link, buf, now);
+          break;
+        case 'p':
+          // Link keep alive, do nothing
+          break;
+        default:
+          unsupported++;
+          break;
+      }
+    }
+    Flush();
+    if(nacks > 0)
+    {
+      int sent = sendmmsg(udp, ackMsgs, nacks, MSG_DONTWAIT);
+      if(sent > 0) acks += sent;
+      uint64_t done = Nanos(CLOCK_REALTIME);
+      for(int i = 0; i < nacks; i++) acked.add((done - ackRx[i]) / 1000);
+    }
+    if(n < BatchSize) return;
+  }
+}
+
+// Closes sessions that have been quiet for idle nS
+static void Expire(uint64_t idle)
+{
+  uint64_t now = Nanos();
+
+  for(auto it = byAddress.begin(); it != byAddress.end();)
+  {
+    Session &s = sessions[it->second];
+    if((now - s.lastRx) < idle) { ++it; continue; }
+    Event ev = {Nanos(CLOCK_REALTIME), (uint16_t)it->second, 'X', 0, {0}};
+    if(!workers[it->second % numWorkers]->ring.push(ev)) { ++it; continue; }
+    s.state.store(SessionClosing, std::memory_order_release);
+    it = byAddress.erase(it);
+  }
+}
+
+// TCP command port
+
+struct Client
+{
+  std::string in;
+  uint32_t    ip;
+};
+
+static std::unordered_map<int, Client> clients;
+
+#define ACK     "\x06\n\r"
+#define NAK     "\x15?\n\r"
+#define ACKonly "\x06"
+
+static void HistogramLine(std::string &r, Histogram &h)
+{
+  char num[24];
+
+  for(int i = 0; i < HistBins; i++)
+  {
+    snprintf(num, sizeof(num), (i == 0) ? "%lu" : ",%lu", h.bins[i].load(std::memory_order_relaxed));
+    r += num;
+  }
+  r += "\n";
+}
+
+static unsigned long AppliedWorst(void)
+{
+  unsigned long worst = 0;
+
+  for(Worker *w : workers) if(w->applied.worst > worst) worst = w->applied.worst;
+  return worst;
+}
+
+static void Command(Client &c, char *line, std::string &r)
+{
+  char buf[256];
+  char *args = strchr(line, ',');
+
+  if(args != NULL) *args++ = 0;
+  if(strcmp(line, "GVER") == 0)
+  {
+    r += ACKonly;
+    r += Version;
+    r += "\n";
+  }
+  else if(strcmp(line, "GSESSIONS") == 0)
+  {
+    r += ACKonly;
+    snprintf(buf, sizeof(buf), "%d\n", (int)byAddress.size());
+    r += buf;
+    for(auto &a : byAddress)
+    {
+      Session &s = sessions[a.second];
+      char ip[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &s.addr.sin_addr, ip, sizeof(ip));
+      snprintf(buf, sizeof(buf), "%d,%s:%d,%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", a.second, ip, ntohs(s.addr.sin_port), s.id,
+               s.packets, s.window.accepted, s.window.duplicates, s.window.stale, s.window.gaps,
+               s.edges.load(std::memory_order_relaxed), s.expired.load(std::memory_order_relaxed));
+      r += buf;
+    }
+  }
+  else if(strcmp(line, "GSTATS") == 0)
+  {
+    // The worker histograms are merged for the percentiles
+    Histogram all;
+    all.reset();
+    for(Worker *w : workers) for(int i = 0; i < HistBins; i++) all.bins[i] += w->applied.bins[i].load(std::memory_order_relaxed);
+    all.worst = AppliedWorst();
+    r += ACKonly;
+    snprintf(buf, sizeof(buf), "%lu,%lu,%lu,%lu,%lu,%lu,%d,%u,%u,%u,%u,%u,%u\n", packets, batches, acks, drops, unsupported, rejected,
+             (int)byAddress.size(), acked.percentile(0.5), acked.percentile(0.99), acked.worst.load(),
+             all.percentile(0.5), all.percentile(0.99), all.worst.load());
+    r += buf;
+  }
+  else if(strcmp(line, "GHIST") == 0)
+  {
+    Histogram all;
+    all.reset();
+    for(Worker *w : workers) for(int i = 0; i < HistBins; i++) all.bins[i] += w->applied.bins[i].load(std::memory_order_relaxed);
+    r += ACKonly;
+    HistogramLine(r, acked);
+    HistogramLine(r, all);
+  }
+  else if(strcmp(line, "RSTATS") == 0)
+  {
+    packets = batches = acks = drops = unsupported = rejected = 0;
+    acked.reset();
+    for(Worker *w : workers) w->applied.reset();
+    r += ACK;
+  }
+  else if((strcmp(line, "SESSION") == 0) && (args != NULL) && (strchr(args, ',') != NULL))
+  {
+    int id = atoi(args);
+    int seq = atoi(strchr(args, ',') + 1);
+    bool found = false;
+    for(auto &a : byAddress)
+    {
+      Session &s = sessions[a.second];
+      if(s.addr.sin_addr.s_addr != c.ip) continue;
+      SessionStart(s, a.second, id, seq);
+      found = true;
+    }
+    // No UDP yet from this Remote, applied when its first message arrives
+    if(!found) pendingSession[c.ip] = std::make_pair(id, seq);
+    r += ACK;
+  }
+  else if((strcmp(line, "GLINKTEST") == 0) && (args != NULL))
+  {
+    int slot = atoi(args);
+    if((slot < 0) || (slot >= MaxSessions) || (sessions[slot].state.load() != SessionActive)) { r += NAK; return; }
+    LinkTest &t = sessions[slot].link;
+    int n = (t.Samples > 0) ? t.Samples : 0;
+    r += ACKonly;
+    snprintf(buf, sizeof(buf), "%d,%d,%.3f,%.3f,%.3f\n", n, t.Missed, t.MinError, t.MaxError, (n > 0) ? sqrt(t.SumSq / n) : 0.0);
+    r += buf;
+  }
+#ifdef ALLOC_TRACKING
+  else if(strcmp(line, "GALLOC") == 0)
+  {
+    r += ACKonly;
+    snprintf(buf, sizeof(buf), "%ld,%ld,%lu,%lu,%lu\n", allocTrack.live, allocTrack.peak, allocTrack.allocs,
+             allocTrack.frees, allocTrack.violations);
+    r += buf;
+    for(int i = 0; i < allocTrack.numSites; i++)
+    {
+      snprintf(buf, sizeof(buf), "%p,%lu,%lu\n", allocTrack.sites[i].Site, allocTrack.sites[i].Count, allocTrack.sites[i].Bytes);
+      r += buf;
+    }
+  }
+#endif
+  else r += NAK;
+}
+
+static void ClientInput(int fd)
+{
+  char buf[512];
+  int  n = read(fd, buf, sizeof(buf));
+
+  if(n <= 0)
+  {
+    close(fd);
+    clients.erase(fd);
+    return;
+  }
+  Client &c = clients[fd];
+  std::string r;
+  c.in.append(buf, n);
+  size_t end;
+  while((end = c.in.find_first_of("\n;")) != std::string::npos)
+  {
+    std::string line = c.in.substr(0, end);
+    c.in.erase(0, end + 1);
+    while(!line.empty() && ((line.back() == '\r') || (line.back() == ' '))) line.pop_back();
+    if(line.empty()) continue;
+    for(char &ch : line) ch = toupper(ch);
+    Command(c, &line[0], r);
+  }
+  if(c.in.size() > 1024) c.in.clear();
+  // All the replies to this read go out in one write
+  if(!r.empty() && (write(fd, r.data(), r.size()) < 0)) perror("write");
+}
+
+int main(int argc, char *argv[])
+{
+  int         udpPort = 2015, tcpPort = 2015, idle = 300;
+  const char  *sinkSpec = "null";
+
+  numWorkers = std::thread::hardware_concurrency();
+  for(int i = 1; i < argc; i++)
+  {
+    if((argv[i][0] != '-') || (i + 1 >= argc))
+    {
+      fprintf(stderr, "Usage: keyd [-u udp port] [-t tcp port] [-w workers] [-p tick uS] [-i idle s] [-o null|file:path|gpio:chip[:base]] [-a 0|1]\n");
+      return 1;
+    }
+    const char *v = argv[++i];
+    switch (argv[i-1][1])
+    {
+      case 'u': udpPort = atoi(v); break;
+      case 't': tcpPort = atoi(v); break;
+      case 'w': numWorkers = atoi(v); break;
+      case 'p': tickUs = atoi(v); break;
+      case 'i': idle = atoi(v); break;
+      case 'o': sinkSpec = v; break;
+#ifdef ALLOC_TRACKING
+      case 'a': allocTrack.testMode = atoi(v) != 0; break;
+#endif
+    }
+  }
+  if(numWorkers < 1) numWorkers = 1;
+  if((sink = OpenSink(sinkSpec)) == NULL) return 1;
+  // Every session starts in a known state before any thread runs, no edges go to
+  // the sink from here
+  sessions = new Session[MaxSessions];
+  for(int i = 0; i < MaxSessions; i++)
+  {
+    sessions[i].morse.begin();
+    SessionReset(sessions[i]);
+  }
+
+  int udp = socket(AF_INET, SOCK_DGRAM, 0);
+  int on = 1, rcvbuf = 4 << 20;
+  setsockopt(udp, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+  setsockopt(udp, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  addr.sin_port = htons(udpPort);
+  if(bind(udp, (sockaddr *)&addr, sizeof(addr)) < 0) { perror("udp bind"); return 1; }
+  int tcp = socket(AF_INET, SOCK_STREAM, 0);
+  setsockopt(tcp, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  addr.sin_port = htons(tcpPort);
+  if(bind(tcp, (sockaddr *)&addr, sizeof(addr)) < 0) { perror("tcp bind"); return 1; }
+  listen(tcp, 64);
+
+  int ep = epoll_create1(0);
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = udp;
+  epoll_ctl(ep, EPOLL_CTL_ADD, udp, &ev);
+  ev.data.fd = tcp;
+  epoll_ctl(ep, EPOLL_CTL_ADD, tcp, &ev);
+
+  for(int i = 0; i < numWorkers; i++)
+  {
+    Worker *w = new Worker();
+    w->index = i;
+    w->applied.reset();
+    workers.push_back(w);
+  }
+  acked.reset();
+  for(Worker *w : workers) w->thread = std::thread(WorkerRun, w);
+  signal(SIGINT, Stop);
+  signal(SIGTERM, Stop);
+  signal(SIGPIPE, SIG_IGN);
+  printf("%s, UDP %d, TCP %d, %d workers, %d uS tick, sink %s\n", Version, udpPort, tcpPort, numWorkers, tickUs, sinkSpec);
+#ifdef ALLOC_TRACKING
+  allocTrack.arm();
+#endif
+
+  uint64_t lastScan = Nanos();
+  epoll_event events[32];
+  while(running)
+  {
+    int n = epoll_wait(ep, events, 32, 100);
+    for(int i = 0; i < n; i++)
+    {
+      int fd = events[i].data.fd;
+      if(fd == udp) ReceiveBatch(udp);
+      else if(fd == tcp)
+      {
+        sockaddr_in peer;
+        socklen_t   len = sizeof(peer);
+        int c = accept(tcp, (sockaddr *)&peer, &len);
+        if(c < 0) continue;
+        clients[c].ip = peer.sin_addr.s_addr;
+        ev.data.fd = c;
+        epoll_ctl(ep, EPOLL_CTL_ADD, c, &ev);
+      }
+      else ClientInput(fd);
+    }
+    if((Nanos() - lastScan) > 1000000000ULL)
+    {
+      lastScan = Nanos();
+      Expire((uint64_t)idle * 1000000000ULL);
+      sink->sync();
+    }
+  }
+  for(Worker *w : workers) w->thread.join();
+  sink->flush();
+  sink->sync();
+  printf("%lu packets in %lu batches, %lu acks, %lu ring full, %lu unsupported, %lu rejected\n",
+         packets, batches, acks, drops, unsupported, rejected);
+  printf("Receive to ack uS p50 %u p99 %u worst %u\n", acked.percentile(0.5), acked.percentile(0.99), acked.worst.load());
+  delete sink;
+  return 0;
+}
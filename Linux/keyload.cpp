@@ -0,0 +1,506 @@
+/*
+ * keyload.cpp
+ *
+ * Load generator for the KG7YU remote keyer system. Simulates N Remote controllers
+ * sending the UDP keying protocol of Remote.ino to a Local controller or keyd, and
+ * steps the number of Remotes up until the Local stops keeping up.
+ *
+ * Each Remote keys random contest style text at its own speed with a chosen fist,
+ * as a straight key (D and U with R lease renewals every 10 mS while down), in dit
+ * dah mode (. and - at each element start), or a mix. Every key event carries a
+ * sequence number and the K acknowledgements from the Local are matched against
+ * them. 'p' keep alive pings, bursts of queued elements, as sent after a WiFi stall,
+ * and T, t link tests can be added. Events are not retransmitted, an event that is
+ * not acknowledged by the end of the step is counted lost.
+ *
+ * With -c the Local is also queried over its TCP command port at the start and end
+ * of each step: GRXSTAT and GLOOP on the Local firmware, GSTATS on keyd. Its stale
+ * and gap counts are the sequence errors, loop overruns or ring full drops the
+ * overruns. The firmware has one receive window, use -q shared so all the Remotes
+ * share one sequence counter unless the point is to see it fail.
+ *
+ * A step fails when more than the loss limit of events go unacknowledged or the Local
+ * reports sequence errors or overruns. The last step that passed is the headroom.
+ *
+ * Build:
+ *    g++ -O2 -o keyload keyload.cpp
+ *
+ * Usage:
+ *    keyload <host> <udp port> [options]
+ *       -n start[,step,max]  Remotes, a step and max ramp the count (default 1)
+ *       -d seconds           Step length (default 10)
+ *       -w wpm[-wpm]         Speed, a range gives each Remote a random speed (default 25)
+ *       -m straight|dd|mix   Keying mode (default dd)
+ *       -f perfect|good|sloppy|bug   Fist (default good)
+ *       -p mS                Ping period, 0 for none (default 250)
+ *       -b count,mS          Burst of count dits every mS
+ *       -T mS,samples        Link test at the start of each step, results are read on the Local
+ *       -q shared|remote     Sequence counter per Remote or shared (default remote)
+ *       -c tcp port          Query the Local over its TCP command port
+ *       -l percent           Loss limit (default 0.1)
+ *       -s seed              Random seed (default 1)
+ *
+ * Output is one CSV line per step:
+ *    remotes, packets/s offered, key events sent, acked %, lost, ack RTT p50 and p99 mS, local
+ *    sequence errors, local duplicates, local overruns or drops, ok or FAIL
+ *
+ * Gordon Anderson
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#define RenewPeriod   10000000ULL   // Straight key lease renewal, nS
+
+static std::mt19937 rng;
+
+static uint64_t Nanos(void)
+{
+  timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool Resolve(const char *host, int port, sockaddr_in *addr)
+{
+  hostent *h = gethostbyname(host);
+
+  if(h == NULL) return false;
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons(port);
+  memcpy(&addr->sin_addr, h->h_addr, 4);
+  return true;
+}
+
+// Fists, the spread of mark and space lengths as a fraction of their nominal length
+typedef struct
+{
+  const char  *Name;
+  double      DitSD;
+  double      DahSD;
+  double      SpaceSD;
+  double      Ratio;                // Dah to dit
+} Fist;
+
+static const Fist fists[] =
+{
+  {"perfect", 0.0,  0.0,  0.0,  3.0},
+  {"good",    0.05, 0.05, 0.08, 3.0},
+  {"sloppy",  0.15, 0.15, 0.25, 3.0},
+  {"bug",     0.01, 0.20, 0.15, 3.6},   // Machine dits, hand dahs
+  {}
+};
+
+static const char *words[] = {"CQ", "TEST", "DE", "KG7YU", "5NN", "TU", "QRZ", "73", "AGN", "UR", "RST", "599", "K", "WA"};
+
+// Morse codes for the characters in the words
+static const char *Code(char c)
+{
+  static const char *letters[] = {".-","-...","-.-.","-..",".","..-.","--.","....","..",".---","-.-",".-..","--",
+                                  "-.","---",".--.","--.-",".-.","...","-","..-","...-",".--","-..-","-.--","--.."};
+  static const char *digits[] = {"-----",".----","..---","...--","....-",".....","-....","--...","---..","----."};
+
+  if((c >= 'A') && (c <= 'Z')) return letters[c - 'A'];
+  if((c >= '0') && (c <= '9')) return digits[c - '0'];
+  return "";
+}
+
+typedef struct
+{
+  uint64_t  Mark;                   // nS
+  uint64_t  Space;
+  bool      Dah;
+} Element;
+
+struct Remote
+{
+  int         fd;
+  double      dit;                  // nS
+  bool        straight;
+  std::vector<Element> elements;
+  size_t      next;
+  bool        inMark;
+  uint8_t     downSeq;
+  uint64_t    keyDue, renewDue, pingDue, burstDue, testDue;
+  int         testLeft;
+  uint64_t    sentAt[256];          // Send time of each pending sequence number, 0 if none
+  unsigned long packets, sent, acked, lost;
+};
+
+// Settings
+static sockaddr_in local;
+static const Fist  *fist = &fists[1];
+static int         modeSel = 1;     // 0 straight, 1 dit dah, 2 mix
+static int         wpmLo = 25, wpmHi = 25;
+static uint64_t    pingPeriod = 250000000ULL;
+static int         burstCount = 0;
+static uint64_t    burstPeriod;
+static int         testSpacing = 0, testSamples = 0;
+static bool        sharedSeq = false;
+static uint8_t     seqShared = 0;
+static std::vector<uint32_t> rtts;  // uS, this step
+
+static double Gauss(double sd)
+{
+  std::normal_distribution<double> n(0.0, sd);
+  return (sd == 0) ? 0 : n(rng);
+}
+
+static uint64_t Vary(double nominal, double sd)
+{
+  double v = nominal * (1.0 + Gauss(sd));
+  return (v < nominal * 0.3) ? nominal * 0.3 : v;
+}
+
+// Appends a random word and word space to a Remote's element list
+static void AddWord(Remote &r)
+{
+  const char *w = words[rng() % (sizeof(words) / sizeof(words[0]))];
+
+  for(int i = 0; w[i] != 0; i++)
+  {
+    const char *code = Code(w[i]);
+    for(int j = 0; code[j] != 0; j++)
+    {
+      Element e;
+      e.Dah = (code[j] == '-');
+      e.Mark = e.Dah ? Vary(r.dit * fist->Ratio, fist->DahSD) : Vary(r.dit, fist->DitSD);
+      e.Space = Vary(r.dit * ((code[j+1] != 0) ? 1 : 3), fist->SpaceSD);
+      r.elements.push_back(e);
+    }
+  }
+  r.elements.back().Space = Vary(r.dit * 7, fist->SpaceSD);
+}
+
+static void Send(Remote &r, const void *buf, int len)
+{
+  r.packets++;
+  sendto(r.fd, buf, len, 0, (sockaddr *)&local, sizeof(local));
+}
+
+static void SendEvent(Remote &r, char type, uint64_t now)
+{
+  uint8_t seq = sharedSeq ? seqShared++ : (uint8_t)r.sent;
+  uint8_t buf[2] = {(uint8_t)type, seq};
+
+  // A sequence number coming round again while still pending, the first was lost
+  if(r.sentAt[seq] != 0) r.lost++;
+  r.sentAt[seq] = now;
+  if(type == 'D') r.downSeq = seq;
+  r.sent++;
+  Send(r, buf, 2);
+}
+
+static void Ack(Remote &r, const uint8_t *k, uint64_t now)
+{
+  for(int i = 0; i <= 16; i++)
+  {
+    if((i > 0) && !(((k[2] | (k[3] << 8)) >> (i - 1)) & 1)) continue;
+    uint8_t seq = k[1] - i;
+    if(r.sentAt[seq] == 0) continue;
+    rtts.push_back((now - r.sentAt[seq]) / 1000);
+    r.sentAt[seq] = 0;
+    r.acked++;
+  }
+}
+
+// Sends whatever is due, returns the time of the next thing due
+static uint64_t Service(Remote &r, uint64_t now)
+{
+  if(now >= r.keyDue)
+  {
+    if(r.next >= r.elements.size())
+    {
+      r.elements.clear();
+      r.next = 0;
+      AddWord(r);
+    }
+    Element &e = r.elements[r.next];
+    if(!r.inMark)
+    {
+      if(r.straight)
+      {
+        SendEvent(r, 'D', now);
+        r.renewDue = now + RenewPeriod;
+      }
+      else SendEvent(r, e.Dah ? '-' : '.', now);
+      r.inMark = true;
+      r.keyDue += e.Mark;
+    }
+    else
+    {
+      if(r.straight) SendEvent(r, 'U', now);
+      r.inMark = false;
+      r.keyDue += e.Space;
+      r.next++;
+    }
+  }
+  if(r.straight && r.inMark && (now >= r.renewDue))
+  {
+    uint8_t buf[2] = {'R', r.downSeq};
+    Send(r, buf, 2);
+    r.renewDue += RenewPeriod;
+  }
+  if((pingPeriod > 0) && (now >= r.pingDue))
+  {
+    uint8_t buf[2] = {'p', (uint8_t)r.sent};
+    Send(r, buf, 2);
+    r.pingDue += pingPeriod;
+  }
+  if((burstCount > 0) && (now >= r.burstDue))
+  {
+    for(int i = 0; i < burstCount; i++) SendEvent(r, '.', now);
+    r.burstDue += burstPeriod;
+  }
+  if((r.testLeft > 0) && (now >= r.testDue))
+  {
+    Send(r, "t", 1);
+    r.testLeft--;
+    r.testDue += testSpacing * 1000000ULL;
+  }
+  uint64_t due = r.keyDue;
+  if(r.straight && r.inMark) due = std::min(due, r.renewDue);
+  if(pingPeriod > 0) due = std::min(due, r.pingDue);
+  if(burstCount > 0) due = std::min(due, r.burstDue);
+  if(r.testLeft > 0) due = std::min(due, r.testDue);
+  return due;
+}
+
+// Local command port, -1 if not used
+static int  control = -1;
+static bool controlKeyd = false;
+
+static std::string Query(const char *cmd)
+{
+  std::string reply;
+  char        ch;
+
+  if(write(control, cmd, strlen(cmd)) < 0) return reply;
+  while(read(control, &ch, 1) == 1)
+  {
+    if(ch == '\n') break;
+    if((ch != 0x06) && (ch != '\r')) reply += ch;
+  }
+  return reply;
+}
+
+static unsigned long Field(const std::string &s, int n)
+{
+  const char *p = s.c_str();
+
+  for(int i = 0; (i < n) && (p != NULL); i++) if((p = strchr(p, ',')) != NULL) p++;
+  return (p == NULL) ? 0 : strtoul(p, NULL, 10);
+}
+
+// Sequence errors, duplicates and overruns or drops from the Local
+typedef struct
+{
+  unsigned long SeqErrors;
+  unsigned long Duplicates;
+  unsigned long Overruns;
+} LocalStats;
+
+static LocalStats QueryLocal(void)
+{
+  LocalStats s = {0, 0, 0};
+
+  if(control < 0) return s;
+  if(controlKeyd)
+  {
+    // keyd counts per session, the totals are summed here
+    std::string r = Query("GSESSIONS\n");
+    int n = atoi(r.c_str());
+    for(int i = 0; i < n; i++)
+    {
+      r = Query("");
+      s.SeqErrors += Field(r, 6) + Field(r, 7);
+      s.Duplicates += Field(r, 5);
+    }
+    s.Overruns = Field(Query("GSTATS\n"), 3);
+    return s;
+  }
+  std::string r = Query("GRXSTAT\n");
+  s.SeqErrors = Field(r, 2) + Field(r, 3);
+  s.Duplicates = Field(r, 1);
+  s.Overruns = Field(Query("GLOOP\n"), 1);
+  return s;
+}
+
+static bool Step(std::vector<Remote> &remotes, int n, int seconds, double lossLimit)
+{
+  int         ep = epoll_create1(0);
+  uint64_t    start = Nanos();
+  LocalStats  before;
+
+  rtts.clear();
+  while((int)remotes.size() < n)
+  {
+    Remote r = Remote();
+    memset(r.sentAt, 0, sizeof(r.sentAt));
+    r.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int wpm = wpmLo + ((wpmHi > wpmLo) ? rng() % (wpmHi - wpmLo + 1) : 0);
+    r.dit = 1.2e9 / wpm;
+    r.straight = (modeSel == 0) || ((modeSel == 2) && (remotes.size() & 1));
+    r.next = 0;
+    r.inMark = false;
+    r.downSeq = 0;
+    remotes.push_back(r);
+  }
+  for(size_t i = 0; i < remotes.size(); i++)
+  {
+    Remote &r = remotes[i];
+    r.packets = r.sent = r.acked = r.lost = 0;
+    memset(r.sentAt, 0, sizeof(r.sentAt));
+    // Spread the starts so the Remotes do not key in step
+    r.keyDue = start + rng() % (uint64_t)(r.dit * 7);
+    r.pingDue = start + rng() % (pingPeriod + 1);
+    r.burstDue = start + ((burstCount > 0) ? rng() % burstPeriod : 0);
+    r.testLeft = 0;
+    if(testSamples > 0)
+    {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "T,%d,%d", testSpacing, testSamples);
+      Send(r, buf, strlen(buf));
+      r.testLeft = testSamples + 1;
+      r.testDue = start + testSpacing * 1000000ULL;
+    }
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+    epoll_ctl(ep, EPOLL_CTL_ADD, r.fd, &ev);
+  }
+  before = QueryLocal();
+
+  uint64_t end = start + seconds * 1000000000ULL;
+  epoll_event events[64];
+  uint8_t     k[16];
+  while(true)
+  {
+    uint64_t now = Nanos();
+    uint64_t due = UINT64_MAX;
+    if(now < end) for(Remote &r : remotes) due = std::min(due, Service(r, now));
+    else due = now;
+    // Collect acknowledgements until the next event is due, and for a while after
+    // the step so the last events can be acknowledged
+    if(now > end + 200000000ULL) break;
+    int wait = (due > now) ? (due - now) / 1000000 : 0;
+    int got = epoll_wait(ep, events, 64, (now >= end) ? 10 : wait);
+    for(int i = 0; i < got; i++)
+    {
+      Remote &r = remotes[events[i].data.u32];
+      while(recv(r.fd, k, sizeof(k), MSG_DONTWAIT) >= 4) if(k[0] == 'K') Ack(r, k, Nanos());
+    }
+  }
+  LocalStats after = QueryLocal();
+
+  unsigned long packets = 0, sent = 0, acked = 0, lost = 0;
+  for(Remote &r : remotes)
+  {
+    packets += r.packets;
+    for(int s = 0; s < 256; s++) if(r.sentAt[s] != 0) r.lost++;
+    sent += r.sent;
+    acked += r.acked;
+    lost += r.lost;
+    epoll_ctl(ep, EPOLL_CTL_DEL, r.fd, NULL);
+  }
+  close(ep);
+  std::sort(rtts.begin(), rtts.end());
+  double p50 = rtts.empty() ? 0 : rtts[rtts.size() / 2] / 1000.0;
+  double p99 = rtts.empty() ? 0 : rtts[(rtts.size() * 99) / 100] / 1000.0;
+  unsigned long seqErrors = after.SeqErrors - before.SeqErrors;
+  unsigned long overruns = after.Overruns - before.Overruns;
+  bool ok = (sent > 0) && (lost * 100.0 <= lossLimit * sent) && (seqErrors == 0) && (overruns == 0);
+  printf("%d,%.0f,%lu,%.2f,%lu,%.2f,%.2f,%lu,%lu,%lu,%s\n", n, packets / (double)seconds, sent,
+         (sent > 0) ? 100.0 * acked / sent : 0.0, lost, p50, p99, seqErrors,
+         after.Duplicates - before.Duplicates, overruns, ok ? "ok" : "FAIL");
+  fflush(stdout);
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  int     nStart = 1, nStep = 0, nMax = 1, seconds = 10, tcpPort = 0;
+  double  lossLimit = 0.1;
+
+  if(argc < 3)
+  {
+    fprintf(stderr, "Usage: keyload <host> <udp port> [-n start[,step,max]] [-d seconds] [-w wpm[-wpm]] [-m straight|dd|mix]\n"
+                    "       [-f perfect|good|sloppy|bug] [-p mS] [-b count,mS] [-T mS,samples] [-q shared|remote]\n"
+                    "       [-c tcp port] [-l percent] [-s seed]\n");
+    return 1;
+  }
+  if(!Resolve(argv[1], atoi(argv[2]), &local)) { fprintf(stderr, "Can't resolve %s\n", argv[1]); return 1; }
+  rng.seed(1);
+  for(int i = 3; i + 1 < argc; i += 2)
+  {
+    const char *v = argv[i + 1];
+    switch (argv[i][1])
+    {
+      case 'n':
+        nStart = nMax = atoi(v);
+        if(sscanf(v, "%d,%d,%d", &nStart, &nStep, &nMax) != 3) nStep = 0;
+        break;
+      case 'd': seconds = atoi(v); break;
+      case 'w':
+        if(sscanf(v, "%d-%d", &wpmLo, &wpmHi) != 2) wpmHi = wpmLo;
+        break;
+      case 'm': modeSel = (strcmp(v, "straight") == 0) ? 0 : (strcmp(v, "mix") == 0) ? 2 : 1; break;
+      case 'f':
+        for(int f = 0; fists[f].Name != NULL; f++) if(strcmp(v, fists[f].Name) == 0) fist = &fists[f];
+        break;
+      case 'p': pingPeriod = atoi(v) * 1000000ULL; break;
+      case 'b':
+        if(sscanf(v, "%d,%lu", &burstCount, &burstPeriod) != 2) burstCount = 0;
+        burstPeriod *= 1000000ULL;
+        if(burstPeriod == 0) burstCount = 0;
+        break;
+      case 'T':
+        if(sscanf(v, "%d,%d", &testSpacing, &testSamples) != 2) testSamples = 0;
+        break;
+      case 'q': sharedSeq = (strcmp(v, "shared") == 0); break;
+      case 'c': tcpPort = atoi(v); break;
+      case 'l': lossLimit = atof(v); break;
+      case 's': rng.seed(strtoul(v, NULL, 0)); break;
+    }
+  }
+  if(tcpPort > 0)
+  {
+    sockaddr_in addr = local;
+    addr.sin_port = htons(tcpPort);
+    control = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(control, (sockaddr *)&addr, sizeof(addr)) < 0) { perror("connect"); return 1; }
+    timeval tv = {1, 0};
+    setsockopt(control, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    controlKeyd = Query("GVER\n").find("KeyD") != std::string::npos;
+  }
+
+  std::vector<Remote> remotes;
+  int  passed = 0;
+  double rate = 0;
+  printf("remotes,packets/s,events,acked %%,lost,rtt p50 mS,rtt p99 mS,seq errors,duplicates,overruns,result\n");
+  for(int n = nStart; n <= nMax; n += (nStep > 0) ? nStep : nMax + 1)
+  {
+    unsigned long packets = 0;
+    if(!Step(remotes, n, seconds, lossLimit)) break;
+    for(Remote &r : remotes) packets += r.packets;
+    passed = n;
+    rate = packets / (double)seconds;
+  }
+  if(passed > 0) printf("Headroom: %d Remotes, %.0f packets/s\n", passed, rate);
+  else printf("Headroom: none, the first step failed\n");
+  return 0;
+}
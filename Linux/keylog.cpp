@@ -0,0 +1,169 @@
+/*
+ * keylog.cpp
+ *
+ * Records and replays Remote key event sessions for the KG7YU remote keyer system.
+ *
+ * record mode connects to the Local controller's record port, SRECPRT, 2016 by
+ * default, and writes every record to a log file until stopped with Ctrl-C. The
+ * record port is separate from the command port so recording never takes the
+ * command connection from the Remote.
+ *
+ * replay mode reads a log file and sends the messages to a Local controller, or
+ * anything else that speaks the keying protocol, as UDP messages. By default the
+ * original arrival spacing is kept, -f sends them as fast as possible and -s scales
+ * the spacing. Replaying field logs reproduces operator complaints exactly and a
+ * fast replay of hours of traffic measures the receive path. Authentication tags
+ * are not recorded, replay to a Local with SAUTH,FALSE.
+ *
+ * Log file format, one record per message received as sent by the Local:
+ *    0x1E, message length n, arrival time in uS (4 bytes, little endian), n message bytes
+ *
+ * Build:
+ *    g++ -O2 -o keylog keylog.cpp
+ *
+ * Usage:
+ *    keylog record <host> <record port> <file>
+ *    keylog replay <file> <host> <udp port> [-f] [-s scale]
+ *
+ * Gordon Anderson
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#define RecordMarker   0x1E
+#define RecordHeader   6
+#define RecordMax      (RecordHeader + 255)
+
+static volatile bool running = true;
+
+static void Stop(int)
+{
+  running = false;
+}
+
+static bool Resolve(const char *host, int port, sockaddr_in *addr)
+{
+  hostent *h = gethostbyname(host);
+
+  if(h == NULL) return false;
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons(port);
+  memcpy(&addr->sin_addr, h->h_addr, 4);
+  return true;
+}
+
+static uint64_t NowMicros(void)
+{
+  timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int Record(const char *host, int port, const char *file)
+{
+  sockaddr_in addr;
+  uint8_t     rec[RecordMax];
+  int         fill = -1;              // Bytes of the current record, -1 when looking for a marker
+  long        records = 0;
+  char        ch;
+
+  if(!Resolve(host, port, &addr)) { fprintf(stderr, "Can't resolve %s\n", host); return 1; }
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  if(connect(s, (sockaddr *)&addr, sizeof(addr)) < 0) { perror("connect"); return 1; }
+  FILE *f = fopen(file, "wb");
+  if(f == NULL) { perror(file); return 1; }
+  signal(SIGINT, Stop);
+  while(running && (read(s, &ch, 1) == 1))
+  {
+    if(fill < 0)
+    {
+      // Resynchronize on the next marker
+      if((uint8_t)ch == RecordMarker)
+      {
+        rec[0] = ch;
+        fill = 1;
+      }
+      continue;
+    }
+    rec[fill++] = ch;
+    if((fill < RecordHeader) || (fill < RecordHeader + rec[1])) continue;
+    fwrite(rec, fill, 1, f);
+    fill = -1;
+    if((++records % 100) == 0) { printf("\r%ld records", records); fflush(stdout); }
+  }
+  printf("\r%ld records\n", records);
+  fclose(f);
+  close(s);
+  return 0;
+}
+
+static int Replay(const char *file, const char *host, int port, bool fast, double scale)
+{
+  sockaddr_in addr;
+  uint8_t     rec[RecordMax];
+  uint32_t    first = 0, arrival;
+  uint64_t    offset = 0, start, lateMax = 0;
+  long        records = 0;
+
+  if(!Resolve(host, port, &addr)) { fprintf(stderr, "Can't resolve %s\n", host); return 1; }
+  FILE *f = fopen(file, "rb");
+  if(f == NULL) { perror(file); return 1; }
+  int s = socket(AF_INET, SOCK_DGRAM, 0);
+  signal(SIGINT, Stop);
+  start = NowMicros();
+  while(running && (fread(rec, RecordHeader, 1, f) == 1))
+  {
+    if(rec[0] != RecordMarker) { fprintf(stderr, "Bad record at %ld\n", records); break; }
+    if((rec[1] > 0) && (fread(&rec[RecordHeader], rec[1], 1, f) != 1)) { fprintf(stderr, "Short record at %ld\n", records); break; }
+    arrival = rec[2] | (rec[3] << 8) | (rec[4] << 16) | ((uint32_t)rec[5] << 24);
+    if(records == 0) first = arrival;
+    // Arrival times wrap every 71 minutes, the difference is always correct
+    offset += (uint32_t)(arrival - first);
+    first = arrival;
+    if(!fast)
+    {
+      uint64_t due = start + (uint64_t)(offset * scale);
+      uint64_t now = NowMicros();
+      if(due > now) usleep(due - now);
+      else if((now - due) > lateMax) lateMax = now - due;
+    }
+    sendto(s, &rec[RecordHeader], rec[1], 0, (sockaddr *)&addr, sizeof(addr));
+    records++;
+  }
+  uint64_t elapsed = NowMicros() - start;
+  printf("%ld messages in %.3f s, log spans %.3f s", records, elapsed / 1e6, offset / 1e6);
+  if(fast && (elapsed > 0)) printf(", %.0f messages/s", records * 1e6 / elapsed);
+  if(!fast) printf(", worst lateness %llu uS", (unsigned long long)lateMax);
+  printf("\n");
+  fclose(f);
+  close(s);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  if((argc == 5) && (strcmp(argv[1], "record") == 0)) return Record(argv[2], atoi(argv[3]), argv[4]);
+  if((argc >= 5) && (strcmp(argv[1], "replay") == 0))
+  {
+    bool   fast = false;
+    double scale = 1.0;
+    for(int i = 5; i < argc; i++)
+    {
+      if(strcmp(argv[i], "-f") == 0) fast = true;
+      else if((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) scale = atof(argv[++i]);
+    }
+    return Replay(argv[2], argv[3], atoi(argv[4]), fast, scale);
+  }
+  fprintf(stderr, "Usage:\n  keylog record <host> <record port> <file>\n  keylog replay <file> <host> <udp port> [-f] [-s scale]\n");
+  return 1;
+}
@@ -0,0 +1,881 @@
+/*
+ * keysim.cpp
+ *
+ * Virtual time simulation of a Remote to Local keying session for the KG7YU remote
+ * keyer system.
+ *
+ * The Remote and Local firmware run here as they are, built for the host behind the
+ * board headers in sim/, see sim/LocalSketch.cpp and sim/RemoteSketch.cpp. This file
+ * is the board and the network they run on: the clock, the pins, the USB serial
+ * ports and a network with delay, jitter and loss on every UDP datagram in both
+ * directions. TCP bytes arrive in order after the delay. Both loops are called every
+ * StepUs. With a stall the network holds every datagram for that long once a second
+ * and then delivers them together, the way WiFi power save does, the Local reads them
+ * as a backlog, see RxBatch.h.
+ *
+ * The sketches are set up through their serial command interfaces the way an
+ * operator would, SWPM, SDDMODE, SCHARMODE and CONNECT on the Remote, SWPM, SCOALESCE
+ * and SDECODE on the Local. Once the Remote reports the link up a text script is
+ * keyed on the Remote's straight key or paddle inputs. The paddle operator presses
+ * each paddle ahead of its element and lets go once the keyer has started it. The
+ * Remote's keyer implements the non iambic mode only, that is the mode used here.
+ *
+ * Marks in are the Remote's key output, marks out the Local's transmitter key. The
+ * Local streams the text it decodes from its key output to the Remote over TCP, the
+ * Remote writes it to its serial port and it is read from there. The statistics at
+ * the end come from GACKSTAT on the Remote and GLEASE and GRXSTAT on the Local.
+ *
+ * Time is virtual, a run takes well under a second, and all randomness comes from a
+ * seeded generator so every run is reproducible. Each run is a child process that
+ * starts from the sketches' power on state, the sweep runs one per processor.
+ *
+ * Build, from this directory:
+ *    g++ -O2 -I sim -I sim/lower -o keysim keysim.cpp sim/LocalSketch.cpp sim/RemoteSketch.cpp
+ *
+ * Usage:
+ *    keysim run [-w wpm] [-m straight|paddle|dd|char] [-l loss %] [-d delay mS] [-j jitter mS] [-c off|replay|latest] [-t stall mS] [-s seed] [text]
+ *    keysim sweep [-c off|replay|latest] [-t stall mS] [-s seed] [text]
+ *
+ * Each run prints one CSV line:
+ *    wpm, mode, coalesce, loss, delay, jitter, stall, seed, characters sent, character errors,
+ *    marks in, marks out, marks paired, average and worst playout delay mS, worst mark
+ *    length error uS, retransmits, leases expired, keyed again after expiry, late key
+ *    downs, decoded text
+ *
+ * Marks are paired in time order, an output mark pairs with the input mark it starts
+ * after if the lengths agree, see Score. The playout delays are left empty when the
+ * decoded text is not the text sent.
+ *
+ * Gordon Anderson
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <queue>
+#include "Arduino.h"
+#include "Ethernet.h"
+#include "EEPROM.h"
+#include "../Local/Morse.h"
+#include "../Local/RxBatch.h"
+
+// The sketches, see sim/LocalSketch.cpp and sim/RemoteSketch.cpp
+namespace Local
+{
+  void setup(void);
+  void loop(void);
+}
+namespace Remote
+{
+  void setup(void);
+  void loop(void);
+}
+
+#define LocalNode     0
+#define RemoteNode    1
+#define Nodes         2
+
+#define StepUs        50            // Simulation step, uS
+#define MaxPins       32
+#define TxKeyPin      13            // Local transmitter key output
+#define KeyerOutPin   15            // Remote key output, KEYOUT
+#define DitPin        14            // Remote paddles and straight key, active low
+#define DahPin        12
+#define StraightPin   4
+#define PressLead     12000         // uS a paddle is pressed ahead of its element
+#define PairWindow    1000000       // uS, longest playout delay a mark is paired over
+#define LinkWait      30000000      // uS to wait for the Remote to connect
+#define ReplyWait     1000000       // uS to wait for a command reply
+
+// Virtual clock and the boards
+
+static uint32_t now = 0;
+
+typedef struct
+{
+  uint32_t  Start;
+  uint32_t  Length;
+} Mark;
+
+typedef struct
+{
+  IPAddress         IP;
+  uint8_t           Pins[MaxPins];
+  std::string       SerialIn;
+  std::string       SerialOut;
+  uint8_t           KeyPin;         // Marks on this pin are recorded
+  uint32_t          KeyDownAt;
+  std::vector<Mark> Marks;
+} Node;
+
+static Node nodes[Nodes];
+int simNode = LocalNode;
+
+HardwareSerial Serial;
+EthernetClass  Ethernet;
+EEPROMClass    EEPROM;
+
+uint32_t micros(void) { return now; }
+// Holds the running sketch, the other one does not run meanwhile
+void delay(unsigned long ms) { now += ms * 1000; }
+void pinMode(uint8_t, uint8_t) {}
+void tone(uint8_t, unsigned int) {}
+void noTone(uint8_t) {}
+
+int digitalRead(uint8_t pin)
+{
+  return (pin < MaxPins) ? nodes[simNode].Pins[pin] : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  Node &n = nodes[simNode];
+
+  if(pin >= MaxPins) return;
+  val = (val != LOW);
+  if((pin == n.KeyPin) && (val != n.Pins[pin]))
+  {
+    if(val) n.KeyDownAt = now;
+    else n.Marks.push_back({n.KeyDownAt, now - n.KeyDownAt});
+  }
+  n.Pins[pin] = val;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  nodes[simNode].SerialOut += (char)c;
+  return 1;
+}
+
+int HardwareSerial::available(void) { return nodes[simNode].SerialIn.size(); }
+
+int HardwareSerial::read(void)
+{
+  std::string &in = nodes[simNode].SerialIn;
+
+  if(in.empty()) return -1;
+  int c = (uint8_t)in[0];
+  in.erase(0, 1);
+  return c;
+}
+
+int HardwareSerial::peek(void)
+{
+  std::string &in = nodes[simNode].SerialIn;
+
+  return in.empty() ? -1 : (uint8_t)in[0];
+}
+
+// Seeded generator so runs repeat exactly
+
+static uint32_t rng;
+
+static uint32_t Random(void)
+{
+  rng = rng * 1664525 + 1013904223;
+  return rng >> 8;
+}
+
+long random(long howbig)
+{
+  return (howbig <= 0) ? 0 : Random() % howbig;
+}
+
+// Run parameters
+
+enum KeyingModes
+{
+  KeyStraight,                      // Straight key, D and U
+  KeyPaddle,                        // Paddles, the keyer sends D and U
+  KeyDD,                            // Paddles in dit dah mode, . and -
+  KeyChar                           // Paddles in dit dah mode with character frames, E
+};
+
+const char *modeNames[] = {"straight", "paddle", "dd", "char"};
+const char *coalesceNames[] = {"OFF", "REPLAY", "LATEST"};
+
+typedef struct
+{
+  int       Wpm;
+  int       Mode;
+  int       LossPct;
+  int       DelayMs;
+  int       JitterMs;
+  int       Coalesce;
+  int       StallMs;
+  uint32_t  Seed;
+} RunParams;
+
+static RunParams params;
+
+static int NodeOf(const IPAddress &ip)
+{
+  for(int i = 0; i < Nodes; i++) if(nodes[i].IP == ip) return i;
+  return -1;
+}
+
+static uint32_t Delay(void)
+{
+  uint32_t delay = params.DelayMs * 1000;
+  if(params.JitterMs > 0) delay += Random() % (params.JitterMs * 1000);
+  return delay;
+}
+
+// UDP, datagrams are delivered to the bound socket in arrival time order
+
+typedef struct
+{
+  uint32_t    At;
+  uint32_t    Order;
+  IPAddress   FromIP;
+  uint16_t    FromPort;
+  IPAddress   ToIP;
+  uint16_t    ToPort;
+  std::string Data;
+} Datagram;
+
+struct Later
+{
+  bool operator()(const Datagram &a, const Datagram &b) const { return (a.At != b.At) ? (a.At > b.At) : (a.Order > b.Order); }
+};
+
+typedef struct
+{
+  std::deque<Datagram> In;
+  Datagram             Current;
+  size_t               Pos;
+  Datagram             Out;
+} Socket;
+
+static std::priority_queue<Datagram, std::vector<Datagram>, Later> inFlight;
+static std::map<std::pair<int, uint16_t>, Socket> sockets;
+static uint32_t order;
+
+static void Deliver(void)
+{
+  if((now % 1000000) < (uint32_t)params.StallMs * 1000) return;
+  while(!inFlight.empty() && ((int32_t)(now - inFlight.top().At) >= 0))
+  {
+    const Datagram &d = inFlight.top();
+    auto s = sockets.find({NodeOf(d.ToIP), d.ToPort});
+    if(s != sockets.end()) s->second.In.push_back(d);
+    inFlight.pop();
+  }
+}
+
+uint8_t UDP::begin(uint16_t port)
+{
+  node = simNode;
+  this->port = port;
+  sockets[{node, port}] = Socket();
+  return 1;
+}
+
+void UDP::stop(void) { sockets.erase({node, port}); }
+
+int UDP::parsePacket(void)
+{
+  auto s = sockets.find({node, port});
+  if((s == sockets.end()) || s->second.In.empty()) return 0;
+  s->second.Current = s->second.In.front();
+  s->second.In.pop_front();
+  s->second.Pos = 0;
+  return s->second.Current.Data.size();
+}
+
+int UDP::available(void)
+{
+  auto s = sockets.find({node, port});
+  if(s == sockets.end()) return 0;
+  return s->second.Current.Data.size() - s->second.Pos;
+}
+
+int UDP::read(uint8_t *buf, size_t size)
+{
+  size_t n = 0;
+  int    c;
+
+  while((n < size) && ((c = read()) >= 0)) buf[n++] = c;
+  return n;
+}
+
+int UDP::read(void)
+{
+  if(available() <= 0) return -1;
+  Socket &s = sockets[{node, port}];
+  return (uint8_t)s.Current.Data[s.Pos++];
+}
+
+int UDP::peek(void)
+{
+  if(available() <= 0) return -1;
+  Socket &s = sockets[{node, port}];
+  return (uint8_t)s.Current.Data[s.Pos];
+}
+
+IPAddress UDP::remoteIP(void) { return sockets[{node, port}].Current.FromIP; }
+uint16_t UDP::remotePort(void) { return sockets[{node, port}].Current.FromPort; }
+
+int UDP::beginPacket(IPAddress ip, uint16_t port)
+{
+  Datagram &d = sockets[{node, this->port}].Out;
+
+  d.FromIP = nodes[node].IP;
+  d.FromPort = this->port;
+  d.ToIP = ip;
+  d.ToPort = port;
+  d.Data.clear();
+  return 1;
+}
+
+size_t UDP::write(uint8_t c)
+{
+  sockets[{node, port}].Out.Data += (char)c;
+  return 1;
+}
+
+size_t UDP::write(const uint8_t *buf, size_t size)
+{
+  sockets[{node, port}].Out.Data.append((const char *)buf, size);
+  return size;
+}
+
+int UDP::endPacket(void)
+{
+  Datagram d = sockets[{node, port}].Out;
+
+  if((int)(Random() % 100) < params.LossPct) return 1;
+  d.At = now + Delay();
+  d.Order = order++;
+  inFlight.push(d);
+  return 1;
+}
+
+// TCP. A connection has two ends, 0 connected and 1 accepted, a client id is
+// 2 * connection + end + 1.
+
+typedef struct
+{
+  uint32_t  At;
+  uint8_t   Byte;
+} TcpByte;
+
+typedef struct
+{
+  int              Node[2];
+  uint16_t         Port;            // Port end 1 accepted on
+  bool             Open;
+  std::deque<TcpByte> In[2];           // Bytes for each end
+} Connection;
+
+static std::vector<Connection> connections;
+static std::vector<std::pair<int, uint16_t>> listeners;
+
+static Connection &Conn(int id) { return connections[(id - 1) / 2]; }
+static int End(int id) { return (id - 1) % 2; }
+
+// Bytes that have arrived for the end
+static int Arrived(int id)
+{
+  int n = 0;
+
+  for(const TcpByte &b : Conn(id).In[End(id)])
+  {
+    if((int32_t)(now - b.At) < 0) break;
+    n++;
+  }
+  return n;
+}
+
+// The handshake takes a round trip and holds the running sketch, a connect that
+// takes longer than the timeout fails
+int Client::connect(IPAddress ip, uint16_t port)
+{
+  int to = NodeOf(ip);
+  bool listening = false;
+
+  for(auto &l : listeners) if((l.first == to) && (l.second == port)) listening = true;
+  uint32_t rtt = Delay() + Delay();
+  if(!listening || (rtt > timeout * 1000))
+  {
+    now += timeout * 1000;
+    return 0;
+  }
+  now += rtt;
+  connections.push_back(Connection());
+  Connection &c = connections.back();
+  c.Node[0] = simNode;
+  c.Node[1] = to;
+  c.Port = port;
+  c.Open = true;
+  id = 2 * (connections.size() - 1) + 1;
+  return 1;
+}
+
+uint8_t Client::connected(void)
+{
+  if(id == 0) return 0;
+  return Conn(id).Open || (Arrived(id) > 0);
+}
+
+void Client::stop(void)
+{
+  if(id != 0) Conn(id).Open = false;
+  id = 0;
+}
+
+int Client::available(void) { return (id == 0) ? 0 : Arrived(id); }
+
+int Client::read(void)
+{
+  if(available() <= 0) return -1;
+  std::deque<TcpByte> &in = Conn(id).In[End(id)];
+  int c = in.front().Byte;
+  in.pop_front();
+  return c;
+}
+
+int Client::peek(void)
+{
+  if(available() <= 0) return -1;
+  return Conn(id).In[End(id)].front().Byte;
+}
+
+size_t Client::write(uint8_t c)
+{
+  if((id == 0) || !Conn(id).Open) return 0;
+  std::deque<TcpByte> &peer = Conn(id).In[1 - End(id)];
+  uint32_t at = now + Delay();
+  // In order, a byte never overtakes the one before it
+  if(!peer.empty() && ((int32_t)(at - peer.back().At) < 0)) at = peer.back().At;
+  peer.push_back({at, c});
+  return 1;
+}
+
+size_t Client::write(const uint8_t *buf, size_t size)
+{
+  size_t n = 0;
+
+  while(n < size) if(write(buf[n++]) == 0) return n - 1;
+  return n;
+}
+
+void Server::begin(void)
+{
+  node = simNode;
+  listeners.push_back({node, port});
+}
+
+// The newest open connection on the port with bytes waiting
+int Server::accept(void)
+{
+  for(int i = connections.size() - 1; i >= 0; i--)
+  {
+    Connection &c = connections[i];
+    int id = 2 * i + 2;
+    if((c.Node[1] == node) && (c.Port == port) && c.Open && (Arrived(id) > 0)) return id;
+  }
+  return 0;
+}
+
+// Runs both sketches for one step
+static void Step(void)
+{
+  now += StepUs;
+  Deliver();
+  simNode = LocalNode;
+  Local::loop();
+  simNode = RemoteNode;
+  Remote::loop();
+}
+
+// Sends a command to a sketch's serial port and runs until it replies. Returns the
+// text after the ACK up to the end of the line, or NULL on a NAK or no reply. A query
+// waits for a value, anything else only for the ACK. The Remote also writes what
+// the Local sends over TCP to its serial port, an ACK from there has no value.
+static const char *Command(int node, const char *cmd, bool query = false)
+{
+  static std::string reply;
+  std::string &out = nodes[node].SerialOut;
+  size_t from = out.size();
+  uint32_t start = now;
+
+  nodes[node].SerialIn += cmd;
+  nodes[node].SerialIn += "\n";
+  while((now - start) < ReplyWait)
+  {
+    Step();
+    if(out.find('\x15', from) != std::string::npos) return NULL;
+    for(size_t ack = out.find('\x06', from); ack != std::string::npos; ack = out.find('\x06', ack + 1))
+    {
+      size_t end = out.find_first_of("\r\n", ack);
+      if(end == std::string::npos) break;
+      if(query && (end == ack + 1)) continue;
+      reply = out.substr(ack + 1, end - ack - 1);
+      return reply.c_str();
+    }
+  }
+  return NULL;
+}
+
+// Settings are made with the sketches' own commands, a refused one ends the run
+static void Set(int node, const char *cmd)
+{
+  if(Command(node, cmd) != NULL) return;
+  fprintf(stderr, "keysim: the %s refused %s\n", (node == LocalNode) ? "Local" : "Remote", cmd);
+  exit(1);
+}
+
+// Field n of a comma separated reply
+static long Field(const char *reply, int n)
+{
+  if(reply == NULL) return 0;
+  while((n-- > 0) && (reply != NULL)) if((reply = strchr(reply, ',')) != NULL) reply++;
+  return (reply == NULL) ? 0 : atol(reply);
+}
+
+// The operator. Elements of the text with their planned start times from the start
+// of the script, then the straight key or paddle inputs that key them.
+
+typedef struct
+{
+  uint32_t  At;
+  uint32_t  Length;
+  bool      Dah;
+} ScriptElement;
+
+static std::vector<ScriptElement> elements;
+static size_t   nextElement;
+static uint32_t scriptStart;
+static bool     pressed;
+static size_t   marksAtPress;
+static uint8_t  pressPin;
+
+static void Script(const char *text, const Timing &t)
+{
+  uint32_t at = 0;
+
+  elements.clear();
+  for(int i = 0; text[i] != 0; i++)
+  {
+    char c = toupper(text[i]);
+    if(c == ' ') { at += t.Word - t.Character; continue; }
+    for(int j = 0; patterns[j].Char != 0; j++)
+    {
+      if(patterns[j].Char != c) continue;
+      for(int k = 0; patterns[j].Code[k] != 0; k++)
+      {
+        bool dah = (patterns[j].Code[k] == '-');
+        uint32_t mark = dah ? t.Dah : t.Dit;
+        elements.push_back({at, mark, dah});
+        at += mark + ((patterns[j].Code[k+1] == 0) ? t.Character : t.Element);
+      }
+      break;
+    }
+  }
+}
+
+// Keyed marks on the Remote, counting the one in progress
+static size_t KeyerMarks(void)
+{
+  Node &r = nodes[RemoteNode];
+  return r.Marks.size() + r.Pins[KeyerOutPin];
+}
+
+static void Operator(void)
+{
+  Node &r = nodes[RemoteNode];
+  uint32_t t = now - scriptStart;
+
+  if(nextElement >= elements.size()) return;
+  const ScriptElement &e = elements[nextElement];
+  if(params.Mode == KeyStraight)
+  {
+    if(!pressed && (t >= e.At))
+    {
+      r.Pins[StraightPin] = LOW;
+      pressed = true;
+    }
+    else if(pressed && (t >= e.At + e.Length))
+    {
+      r.Pins[StraightPin] = HIGH;
+      pressed = false;
+      nextElement++;
+    }
+    return;
+  }
+  // Held until the keyer starts the element, a paddle still down at the end of
+  // the element space would repeat it
+  if(!pressed && (t + PressLead >= e.At))
+  {
+    pressPin = e.Dah ? DahPin : DitPin;
+    r.Pins[pressPin] = LOW;
+    marksAtPress = KeyerMarks();
+    pressed = true;
+  }
+  else if(pressed && (KeyerMarks() > marksAtPress))
+  {
+    r.Pins[pressPin] = HIGH;
+    pressed = false;
+    nextElement++;
+  }
+}
+
+// Scoring
+
+// Character errors, edit distance between the sent and decoded text
+static int Distance(const std::string &a, const std::string &b)
+{
+  std::vector<int> row(b.size() + 1);
+
+  for(size_t j = 0; j <= b.size(); j++) row[j] = j;
+  for(size_t i = 1; i <= a.size(); i++)
+  {
+    int diag = row[0];
+    row[0] = i;
+    for(size_t j = 1; j <= b.size(); j++)
+    {
+      int up = row[j];
+      row[j] = std::min(std::min(row[j] + 1, row[j-1] + 1), diag + (a[i-1] != b[j-1]));
+      diag = up;
+    }
+  }
+  return row[b.size()];
+}
+
+typedef struct
+{
+  int       Paired;
+  double    DelaySum;               // uS
+  int32_t   DelayMax;               // uS
+  uint32_t  LengthErr;              // Worst, uS
+} Score;
+
+static bool Similar(const Mark &a, const Mark &b)
+{
+  uint32_t err = (a.Length > b.Length) ? a.Length - b.Length : b.Length - a.Length;
+  return err < a.Length / 2;
+}
+
+// Pairs the marks in time order. An output mark pairs with the latest input mark
+// that started before it, within PairWindow, if the lengths agree. A mark that
+// does not pair was lost, or is an extra one, and is skipped.
+static Score Pair(const std::vector<Mark> &in, const std::vector<Mark> &out)
+{
+  Score  s = {0, 0, 0, 0};
+  size_t i = 0, j = 0;
+
+  while((i < in.size()) && (j < out.size()))
+  {
+    int32_t delay = (int32_t)(out[j].Start - in[i].Start);
+    if(delay < 0) { j++; continue; }
+    if(delay > PairWindow) { i++; continue; }
+    // A later input mark that also started before this output mark is closer
+    if((i + 1 < in.size()) && ((int32_t)(out[j].Start - in[i+1].Start) >= 0) && Similar(in[i+1], out[j])) { i++; continue; }
+    if(!Similar(in[i], out[j]))
+    {
+      if((i + 1 < in.size()) && ((int32_t)(out[j].Start - in[i+1].Start) >= 0)) i++;
+      else j++;
+      continue;
+    }
+    uint32_t err = (out[j].Length > in[i].Length) ? out[j].Length - in[i].Length : in[i].Length - out[j].Length;
+    s.Paired++;
+    s.DelaySum += delay;
+    if((s.Paired == 1) || (delay > s.DelayMax)) s.DelayMax = delay;
+    if(err > s.LengthErr) s.LengthErr = err;
+    i++;
+    j++;
+  }
+  return s;
+}
+
+// Decoded text from the DEC lines the Remote wrote to its serial port
+static std::string Decoded(const std::string &out)
+{
+  std::string text;
+  size_t      at = 0;
+
+  while((at = out.find("DEC,", at)) != std::string::npos)
+  {
+    at += 4;
+    size_t end = out.find(',', at);
+    if(end == std::string::npos) break;
+    text += out.substr(at, end - at);
+  }
+  while(!text.empty() && (text.back() == ' ')) text.pop_back();
+  while(!text.empty() && (text[0] == ' ')) text.erase(0, 1);
+  return text;
+}
+
+static void Run(const char *text)
+{
+  char cmd[40];
+
+  rng = params.Seed;
+  nodes[LocalNode].IP = IPAddress(10, 0, 0, 200);
+  nodes[LocalNode].KeyPin = TxKeyPin;
+  nodes[RemoteNode].IP = IPAddress(10, 0, 0, 201);
+  nodes[RemoteNode].KeyPin = KeyerOutPin;
+  for(int i = 0; i < Nodes; i++) memset(nodes[i].Pins, HIGH, MaxPins);
+  nodes[LocalNode].Pins[TxKeyPin] = nodes[RemoteNode].Pins[KeyerOutPin] = LOW;
+  simNode = LocalNode;
+  Local::setup();
+  simNode = RemoteNode;
+  Remote::setup();
+
+  sprintf(cmd, "SWPM,%d", params.Wpm);
+  Set(LocalNode, cmd);
+  Set(RemoteNode, cmd);
+  sprintf(cmd, "SCOALESCE,%s", coalesceNames[params.Coalesce]);
+  Set(LocalNode, cmd);
+  Set(LocalNode, "SDECODE,TRUE");
+  Set(RemoteNode, (params.Mode >= KeyDD) ? "SDDMODE,TRUE" : "SDDMODE,FALSE");
+  Set(RemoteNode, (params.Mode == KeyChar) ? "SCHARMODE,TRUE" : "SCHARMODE,FALSE");
+  Set(RemoteNode, "CONNECT");
+  while(Field(Command(RemoteNode, "GLINK", true), 0) != 3)
+  {
+    if(now > LinkWait)
+    {
+      fprintf(stderr, "keysim: the Remote did not connect\n");
+      exit(1);
+    }
+    for(int i = 0; i < 200; i++) Step();
+  }
+  // Let the session and timing messages land before the first key event
+  for(uint32_t start = now; (now - start) < 2 * Delay() + 100000; ) Step();
+
+  Timing t;
+  t.set(params.Wpm);
+  Script(text, t);
+  scriptStart = now;
+  nextElement = 0;
+  pressed = false;
+  nodes[RemoteNode].Marks.clear();
+  nodes[LocalNode].Marks.clear();
+  size_t serialFrom = nodes[RemoteNode].SerialOut.size();
+  uint32_t end = scriptStart + (elements.empty() ? 0 : elements.back().At) + 3000000;
+  while((int32_t)(now - end) < 0)
+  {
+    Operator();
+    Step();
+  }
+
+  const std::vector<Mark> &in = nodes[RemoteNode].Marks;
+  const std::vector<Mark> &out = nodes[LocalNode].Marks;
+  std::string sent, decoded = Decoded(nodes[RemoteNode].SerialOut.substr(serialFrom));
+  for(int i = 0; text[i] != 0; i++) sent += toupper(text[i]);
+  Score s = Pair(in, out);
+  const char *ack = Command(RemoteNode, "GACKSTAT", true);
+  long retransmits = Field(ack, 1);
+  const char *lease = Command(LocalNode, "GLEASE", true);
+  long expired = Field(lease, 4), rekeys = Field(lease, 5);
+  long late = Field(Command(LocalNode, "GRXSTAT", true), 5);
+
+  printf("%d,%s,%s,%d,%d,%d,%d,%u,%d,%d,%d,%d,%d,", params.Wpm, modeNames[params.Mode], coalesceNames[params.Coalesce],
+         params.LossPct, params.DelayMs, params.JitterMs, params.StallMs, params.Seed,
+         (int)sent.size(), Distance(sent, decoded), (int)in.size(), (int)out.size(), s.Paired);
+  if((decoded == sent) && (s.Paired > 0)) printf("%.2f,%.2f,", s.DelaySum / s.Paired / 1000.0, s.DelayMax / 1000.0);
+  else printf(",,");
+  printf("%u,%ld,%ld,%ld,%ld,\"%s\"\n", s.LengthErr, retransmits, expired, rekeys, late, decoded.c_str());
+}
+
+// Runs in a child process so every run starts from the sketches' power on state.
+// Returns a pipe the CSV line is read from.
+static int Start(const char *text, pid_t &pid)
+{
+  int fd[2];
+
+  if(pipe(fd) != 0) { perror("keysim"); exit(1); }
+  fflush(stdout);
+  if((pid = fork()) == 0)
+  {
+    close(fd[0]);
+    dup2(fd[1], 1);
+    Run(text);
+    fflush(stdout);
+    _exit(0);
+  }
+  close(fd[1]);
+  return fd[0];
+}
+
+static void Finish(int fd, pid_t pid)
+{
+  char buf[512];
+  ssize_t n;
+
+  while((n = read(fd, buf, sizeof(buf))) > 0) fwrite(buf, 1, n, stdout);
+  close(fd);
+  waitpid(pid, NULL, 0);
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *text = "CQ CQ DE KG7YU KG7YU K";
+  bool sweep = false;
+
+  params = {25, KeyStraight, 0, 20, 5, CoalesceReplay, 0, 1};
+  if((argc < 2) || ((strcmp(argv[1], "run") != 0) && (strcmp(argv[1], "sweep") != 0)))
+  {
+    fprintf(stderr, "Usage:\n  keysim run [-w wpm] [-m straight|paddle|dd|char] [-l loss %%] [-d delay mS] [-j jitter mS] [-c off|replay|latest] [-t stall mS] [-s seed] [text]\n  keysim sweep [-c off|replay|latest] [-t stall mS] [-s seed] [text]\n");
+    return 1;
+  }
+  sweep = (strcmp(argv[1], "sweep") == 0);
+  for(int i = 2; i < argc; i++)
+  {
+    if((argv[i][0] == '-') && (i + 1 < argc))
+    {
+      const char *v = argv[++i];
+      switch (argv[i-1][1])
+      {
+        case 'w': params.Wpm = atoi(v); break;
+        case 'm': for(int m = KeyStraight; m <= KeyChar; m++) if(strcmp(v, modeNames[m]) == 0) params.Mode = m; break;
+        case 'l': params.LossPct = atoi(v); break;
+        case 'd': params.DelayMs = atoi(v); break;
+        case 'j': params.JitterMs = atoi(v); break;
+        case 'c': params.Coalesce = (strcmp(v, "off") == 0) ? CoalesceOff : (strcmp(v, "latest") == 0) ? CoalesceLatest : CoalesceReplay; break;
+        case 't': params.StallMs = atoi(v); break;
+        case 's': params.Seed = strtoul(v, NULL, 0); break;
+      }
+    }
+    else text = argv[i];
+  }
+  if(params.Wpm < minWPM) params.Wpm = minWPM;
+  if(params.Wpm > maxWPM) params.Wpm = maxWPM;
+  if(params.StallMs > 900) params.StallMs = 900;
+  pid_t pid = 0;
+  if(!sweep)
+  {
+    Finish(Start(text, pid), pid);
+    return 0;
+  }
+  // One run per processor, the lines are printed in sweep order
+  const int wpms[] = {15, 25, 35, 45};
+  const int losses[] = {0, 2, 5, 10};
+  const int jitters[] = {0, 5, 20, 50};
+  std::deque<std::pair<int, pid_t>> running;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  for(int w : wpms) for(int m = KeyStraight; m <= KeyChar; m++) for(int l : losses) for(int j : jitters)
+  {
+    params.Wpm = w;
+    params.Mode = m;
+    params.LossPct = l;
+    params.JitterMs = j;
+    if((long)running.size() >= cpus)
+    {
+      Finish(running.front().first, running.front().second);
+      running.pop_front();
+    }
+    int fd = Start(text, pid);
+    running.push_back({fd, pid});
+  }
+  for(auto &r : running) Finish(r.first, r.second);
+  return 0;
+}
@@ -0,0 +1,328 @@
+/*
+ * keytest.cpp
+ *
+ * Golden timeline regression suite for the Remote's paddle keyer. The Keyer class
+ * from the Remote sketch is run under a virtual clock with scripted paddle and
+ * straight key presses at every speed from minWPM to maxWPM, in each implemented
+ * keyer mode.
+ * The key output, the key up and down call backs, the sending dit and dah call
+ * backs and the sidetone are recorded and compared with the golden timeline of
+ * each case:
+ *
+ *    elements      The marks sent, . - or k for a straight key mark, and the same
+ *                  order from the sending dit and dah call backs
+ *    timing        Each dit and dah mark, and the space between elements, against
+ *                  PARIS timing worked out here, not from Timing.h. A character or
+ *                  word space, where the keyer went idle, against the next press.
+ *                  A straight key mark against the time the key was held.
+ *    latency       First key down after the first press, the debounce
+ *    call backs    Key up and down call backs and the sidetone on the key edges
+ *
+ * Paddle times in the scripts are in tenths of a dit so a case means the same at
+ * every speed, after Lead uS with the paddles open so the debounce starts from
+ * released. The golden element strings for the iambic modes follow the mode
+ * descriptions at the top of Keyer.h. Keyer::next only has the non iambic mode so
+ * far, the other modes are not run and asking for one with -m is an error, mark
+ * them implemented in Implemented[] when they are written.
+ *
+ * The keyer samples the paddles every SampleInterval, so a press is seen at the
+ * first sample at or after it and goes out at the end of the 9 sample debounce.
+ * Press and release times are moved onto the same sample grid before a straight
+ * key mark or a space from a press is compared, the rest of the error is the StepUs
+ * call interval.
+ *
+ * Keyer::process is called every StepUs of virtual time and every call is timed on
+ * the host clock.
+ *
+ * Build, from this directory:
+ *    g++ -O2 -I sim -I ../Remote -o keytest keytest.cpp
+ *
+ * Usage:
+ *    keytest [-w wpm] [-m non|a|b|ultimatic] [-t tolerance uS] [-v]
+ *
+ * Prints one CSV line per mode and case:
+ *    mode, case, speeds, passed, worst timing error uS, worst latency uS, result
+ * then the process call count, average and worst nS per call. -v adds a line for
+ * each speed that failed with the golden and recorded elements. Exits with 1 if a
+ * case failed or the mode asked for is not implemented.
+ *
+ * Gordon Anderson
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "Keyer.h"
+
+#define DitPin        defaultDitPin
+#define DahPin        defaultDahPin
+#define StraightPin   defaultStraightKeyPin
+#define KeyPin        defaultKeyPin
+#define SidetonePin   defaultSidetonePin
+#define StepUs        20            // Virtual time between process calls, uS
+#define Lead          20000         // Paddles open before the script, uS
+#define MaxLatency    12000         // Debounce, uS
+#define Tolerance     (2 * StepUs)  // uS
+
+// Virtual clock, paddle script and recorded timeline
+
+typedef struct
+{
+  char      Paddle;                 // . dit, - dah, k straight key
+  int       From;                   // Tenths of a dit
+  int       To;
+} Hold;
+
+typedef struct
+{
+  char      Type;                   // K key pin, C key call back, T sidetone, . - sending call backs
+  bool      Down;
+  uint32_t  At;
+} Edge;
+
+static uint32_t          now;
+static uint32_t          unit;      // Dit, uS
+static const Hold        *script;
+static int               holds;
+static std::vector<Edge> timeline;
+
+// Tenths of a dit to virtual uS
+static uint32_t At(int tenths) { return Lead + tenths * unit / 10; }
+
+// Time a press or release at t is seen by the keyer, the last of the 9 debounce
+// samples. Samples are taken on the SampleInterval grid from begin() at 0.
+static uint32_t Debounced(uint32_t t) { return (t + SampleInterval - 1) / SampleInterval * SampleInterval + 8 * SampleInterval; }
+
+// Start of the mark after the element space that ends at spaceEnd, the previous
+// mark was a prev element that started at markStart. The other paddle pressed
+// during that mark or a paddle held at the end of the space sends at once, else the
+// keyer went idle and the next press starts a new character.
+static uint32_t NextStart(char prev, uint32_t markStart, uint32_t spaceEnd)
+{
+  uint32_t start = 0;
+
+  for(int i = 0; i < holds; i++)
+  {
+    const Hold &h = script[i];
+    if((At(h.From) < spaceEnd) && (At(h.To) > spaceEnd)) return spaceEnd;
+    if((h.Paddle != prev) && (At(h.From) < spaceEnd) && (At(h.To) > markStart)) return spaceEnd;
+    if((At(h.From) >= spaceEnd) && ((start == 0) || (Debounced(At(h.From)) < start))) start = Debounced(At(h.From));
+  }
+  return (start == 0) ? spaceEnd : start;
+}
+
+static bool Held(char paddle)
+{
+  for(int i = 0; i < holds; i++)
+  {
+    const Hold &h = script[i];
+    if((h.Paddle == paddle) && (now >= At(h.From)) && (now < At(h.To))) return true;
+  }
+  return false;
+}
+
+uint32_t micros(void) { return now; }
+void pinMode(uint8_t, uint8_t) {}
+// Paddles and the straight key pull down when pressed
+int digitalRead(uint8_t pin)
+{
+  if(pin == DitPin) return !Held('.');
+  if(pin == DahPin) return !Held('-');
+  if(pin == StraightPin) return !Held('k');
+  return HIGH;
+}
+void digitalWrite(uint8_t pin, uint8_t val) { if(pin == KeyPin) timeline.push_back({'K', val == HIGH, now}); }
+void tone(uint8_t, unsigned int) { timeline.push_back({'T', true, now}); }
+void noTone(uint8_t) { timeline.push_back({'T', false, now}); }
+
+static void KeyDown(void) { timeline.push_back({'C', true, now}); }
+static void KeyUp(void) { timeline.push_back({'C', false, now}); }
+static void SendingDit(void) { timeline.push_back({'.', true, now}); }
+static void SendingDah(void) { timeline.push_back({'-', true, now}); }
+
+// Cases, golden elements for the non iambic, iambic A, iambic B and Ultimatic modes
+
+typedef struct
+{
+  const char  *Name;
+  Hold        Holds[2];
+  int         Holds_;
+  const char  *Golden[4];
+} Case;
+
+static const Case cases[] =
+{
+  {"dit",             {{'.', 0, 10}},             1, {".", ".", ".", "."}},
+  {"dah release mid", {{'-', 0, 15}},             1, {"-", "-", "-", "-"}},
+  {"dit held",        {{'.', 0, 50}},             1, {"...", "...", "...", "..."}},
+  {"dah held",        {{'-', 0, 70}},             1, {"--", "--", "--", "--"}},
+  {"squeeze",         {{'.', 0, 30}, {'-', 5, 30}}, 2, {".-.", ".-", ".-.", ".-"}},
+  {"squeeze held",    {{'.', 0, 70}, {'-', 5, 70}}, 2, {".-.-", ".-.", ".-.-", ".--"}},
+  {"character space", {{'.', 0, 10}, {'.', 40, 50}}, 2, {"..", "..", "..", ".."}},
+  {"word space",      {{'-', 0, 30}, {'.', 100, 110}}, 2, {"-.", "-.", "-.", "-."}},
+  {"straight key",    {{'k', 0, 30}},             1, {"k", "k", "k", "k"}},
+};
+
+static const char       *modeNames[] = {"non", "a", "b", "ultimatic"};
+static const KeyerModes modes[] = {ModeNonIambic, ModeIambicA, ModeIambicB, ModeUltimatic};
+static const bool       Implemented[] = {true, false, false, false};
+
+typedef struct
+{
+  bool        Pass;
+  std::string Got;
+  uint32_t    Error;                // Worst mark or space error, uS
+  uint32_t    Latency;
+} Result;
+
+static unsigned long calls = 0;
+static uint64_t      cpuTotal = 0;
+static uint64_t      cpuWorst = 0;
+
+static uint64_t Nanos(void)
+{
+  timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t Diff(uint32_t a, uint32_t b) { return (a > b) ? a - b : b - a; }
+
+static Result Run(const Case &c, int mode, int wpm)
+{
+  Result   r = {true, "", 0, 0};
+  uint32_t end = 0;
+
+  now = 0;
+  unit = (1200000 + wpm / 2) / wpm;
+  script = c.Holds;
+  holds = c.Holds_;
+  timeline.clear();
+  for(int i = 0; i < holds; i++) if(At(script[i].To) > end) end = At(script[i].To);
+  end += 12 * unit + 2 * MaxLatency;
+
+  Keyer<> keyer;
+  keyer.begin();
+  keyer.setMode(modes[mode]);
+  keyer.setSpeed(wpm);
+  keyer.attachKeyDownCallBack(KeyDown);
+  keyer.attachKeyUpCallBack(KeyUp);
+  keyer.attachSendingDitCallBack(SendingDit);
+  keyer.attachSendingDahCallBack(SendingDah);
+  timeline.clear();
+  while(now < end)
+  {
+    uint64_t start = Nanos();
+    keyer.process();
+    uint64_t ns = Nanos() - start;
+    calls++;
+    cpuTotal += ns;
+    if(ns > cpuWorst) cpuWorst = ns;
+    now += StepUs;
+  }
+
+  // Marks from the key pin, call back and sidetone edges must match them
+  std::vector<Edge> key, callback, sidetone;
+  std::string       sending;
+  for(const Edge &e : timeline)
+  {
+    if(e.Type == 'K') key.push_back(e);
+    else if(e.Type == 'C') callback.push_back(e);
+    else if(e.Type == 'T') sidetone.push_back(e);
+    else sending += e.Type;
+  }
+  if(callback.size() != key.size()) r.Pass = false;
+  if(sidetone.size() != key.size()) r.Pass = false;
+  for(size_t i = 0; r.Pass && (i < key.size()); i++)
+  {
+    if((callback[i].Down != key[i].Down) || (callback[i].At != key[i].At)) r.Pass = false;
+    if((sidetone[i].Down != key[i].Down) || (sidetone[i].At != key[i].At)) r.Pass = false;
+  }
+
+  const char *golden = c.Golden[mode];
+  uint32_t   held = Debounced(At(script[0].To)) - Debounced(At(script[0].From));
+  for(size_t i = 0; i + 1 < key.size(); i += 2)
+  {
+    if(!key[i].Down || key[i + 1].Down) { r.Pass = false; break; }
+    uint32_t mark = key[i + 1].At - key[i].At;
+    char     type = (c.Holds[0].Paddle == 'k') ? 'k' : ((Diff(mark, unit) < Diff(mark, 3 * unit)) ? '.' : '-');
+    r.Got += type;
+    size_t n = r.Got.size() - 1;
+    if(n >= strlen(golden)) continue;
+    uint32_t expect = (golden[n] == '.') ? unit : ((golden[n] == '-') ? 3 * unit : held);
+    if(Diff(mark, expect) > r.Error) r.Error = Diff(mark, expect);
+    if(i < 2) continue;
+    uint32_t space = key[i].At - key[i - 1].At;
+    expect = NextStart(r.Got[n - 1], key[i - 2].At, key[i - 1].At + unit) - key[i - 1].At;
+    if(Diff(space, expect) > r.Error) r.Error = Diff(space, expect);
+  }
+  if(key.size() & 1) r.Pass = false;
+  if(!key.empty()) r.Latency = key[0].At - At(script[0].From);
+  if(r.Got != golden) r.Pass = false;
+  if((golden[0] != 'k') && (sending != golden)) r.Pass = false;
+  return r;
+}
+
+int main(int argc, char *argv[])
+{
+  int      onlyWpm = 0, onlyMode = -1;
+  uint32_t tolerance = Tolerance;
+  bool     verbose = false;
+  bool     failed = false;
+
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "-v") == 0) verbose = true;
+    else if((argv[i][0] == '-') && (i + 1 < argc))
+    {
+      const char *v = argv[++i];
+      switch (argv[i-1][1])
+      {
+        case 'w': onlyWpm = atoi(v); break;
+        case 't': tolerance = atoi(v); break;
+        case 'm':
+          for(int m = 0; m < 4; m++) if(strcmp(v, modeNames[m]) == 0) onlyMode = m;
+          if(onlyMode < 0) { fprintf(stderr, "Unknown mode %s\n", v); return 1; }
+          if(!Implemented[onlyMode]) { fprintf(stderr, "Mode %s is not implemented in Keyer.h\n", v); return 1; }
+          break;
+      }
+    }
+    else
+    {
+      fprintf(stderr, "Usage: keytest [-w wpm] [-m non|a|b|ultimatic] [-t tolerance uS] [-v]\n");
+      return 1;
+    }
+  }
+  printf("mode,case,speeds,passed,worst error uS,worst latency uS,result\n");
+  for(int m = 0; m < 4; m++)
+  {
+    if(!Implemented[m] || ((onlyMode >= 0) && (m != onlyMode))) continue;
+    for(const Case &c : cases)
+    {
+      int      speeds = 0, passed = 0;
+      uint32_t error = 0, latency = 0;
+      for(int wpm = minWPM; wpm <= maxWPM; wpm++)
+      {
+        if((onlyWpm != 0) && (wpm != onlyWpm)) continue;
+        Result r = Run(c, m, wpm);
+        if(r.Error > tolerance) r.Pass = false;
+        if(r.Latency > MaxLatency) r.Pass = false;
+        speeds++;
+        if(r.Pass) passed++;
+        if(r.Error > error) error = r.Error;
+        if(r.Latency > latency) latency = r.Latency;
+        if(verbose && !r.Pass) printf("  %s,%s,%d wpm,golden %s,got %s,error %u,latency %u\n", modeNames[m], c.Name, wpm,
+                                      c.Golden[m], r.Got.c_str(), r.Error, r.Latency);
+      }
+      if(passed != speeds) failed = true;
+      printf("%s,%s,%d,%d,%u,%u,%s\n", modeNames[m], c.Name, speeds, passed, error, latency, (passed == speeds) ? "PASS" : "FAIL");
+    }
+  }
+  printf("Keyer::process calls %lu, average %.0f nS, worst %.0f nS\n", calls,
+         calls ? (double)cpuTotal / calls : 0.0, (double)cpuWorst);
+  return failed ? 1 : 0;
+}
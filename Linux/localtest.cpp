@@ -0,0 +1,223 @@
+/*
+ * localtest.cpp
+ *
+ * Regression suite for the Local's key output. The Morse element player from the
+ * Local sketch is run under a virtual clock with scripted remote key events and
+ * queued elements, the way ProcessUDP and KeyTask drive it, and the marks on the key
+ * pin are compared with the golden marks of each case. Covers direct keying against
+ * queued elements, the key down lease and the PTT lead. R renewals and the watchdog go through
+ * Lease.h the way LeaseRenew and taskWatchdog in Local.ino use it.
+ *
+ * Morse::process and Morse::check are called every StepUs of virtual time, script
+ * events at the same time run in order before them.
+ *
+ * Build, from this directory:
+ *    g++ -O2 -I sim -I ../Local -o localtest localtest.cpp
+ *
+ * Usage:
+ *    localtest [-v]
+ *
+ * Prints one CSV line per case:
+ *    case, marks, worst error uS, expired, result
+ * -v adds the golden and recorded marks of each case that failed. Exits with 1 if a
+ * case failed.
+ *
+ * Gordon Anderson
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "Morse.h"
+#include "Lease.h"
+#include "PTT.h"
+
+#define KeyPin        13
+#define PTTPin        12
+#define StepUs        50            // Virtual time between process calls, uS
+#define Tolerance     (2 * StepUs)  // uS
+#define WPM           20            // Dit 60 mS, dah 180 mS, element space 60 mS
+#define MaxEvents     8
+#define MaxMarks      4
+
+// Virtual clock and key output capture
+
+typedef struct
+{
+  uint32_t  Start;
+  uint32_t  Length;
+} Mark;
+
+static uint32_t          now;
+static std::vector<Mark> marksOut;
+static uint32_t          keyDownAt;
+static bool              keyState = false;
+static PTT<PTTPin, true> *ptt;
+
+static bool PTTReady(void) { return ptt->ready(); }
+static void PTTDown(void) { ptt->key(true); }
+static void PTTUp(void) { ptt->key(false); }
+
+uint32_t micros(void) { return now; }
+void pinMode(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) { return 0; }
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  if((pin != KeyPin) || ((val != 0) == keyState)) return;
+  keyState = (val != 0);
+  if(keyState) keyDownAt = now;
+  else marksOut.push_back({keyDownAt, now - keyDownAt});
+}
+
+// Cases, script times and golden marks in mS
+
+typedef struct
+{
+  uint32_t  At;
+  char      Op;                     // D key down, U key up, R renew, . dit, - dah queued
+} Event;
+
+typedef struct
+{
+  const char  *Name;
+  uint32_t    Lease;                // Key down lease, mS
+  uint32_t    Lead;                 // PTT lead, mS, 0 for no PTT
+  Event       Events[MaxEvents];
+  int         Events_;
+  Mark        Golden[MaxMarks];
+  int         Golden_;
+  unsigned    Expired;              // Leases expected to run out
+} Case;
+
+static const Case cases[] =
+{
+  // The key down waits for the queued dah and its space, the key up before it went
+  // out queues the mark full length
+  {"down behind dah",  500, 0, {{0, '-'}, {50, 'D'}, {120, 'U'}}, 3, {{0, 180}, {240, 70}}, 2, 0},
+  // A key up ends the live mark and the dit queued under it then plays
+  {"dit under down",   500, 0, {{0, 'D'}, {10, '.'}, {30, 'U'}}, 3, {{0, 30}, {30, 60}}, 2, 0},
+  // The key up of a live mark must not cut a dit queued after it
+  {"up after dit",     500, 0, {{0, 'D'}, {40, 'U'}, {40, '.'}, {70, 'U'}}, 4, {{0, 40}, {40, 60}}, 2, 0},
+  // A lease that runs out drops the held back key down, not the queued dah
+  {"expiry under dah",  50, 0, {{0, '-'}, {20, 'D'}}, 2, {{0, 180}}, 1, 1},
+  // A lease that runs out ends a live mark, at the next 1 mS watchdog check
+  {"live expiry",       50, 0, {{0, 'D'}}, 1, {{0, 51}}, 1, 1},
+  // Renewals hold a live mark past the lease
+  {"live renewed",      50, 0, {{0, 'D'}, {40, 'R'}, {80, 'R'}, {100, 'U'}}, 4, {{0, 100}}, 1, 0},
+  // Losing one R in a run of 10 mS renewals must not break the mark
+  {"one R dropped",    500, 0, {{0, 'D'}, {10, 'R'}, {20, 'R'}, {30, 'R'}, {40, 'R'}, {62, 'R'}, {72, 'R'}, {80, 'U'}}, 8, {{0, 80}}, 1, 0},
+  // The lease runs out in an outage, an R for the same key down keys it again
+  {"R after expiry",   500, 0, {{0, 'D'}, {10, 'R'}, {20, 'R'}, {100, 'R'}, {110, 'R'}, {120, 'U'}}, 6, {{0, 61}, {100, 20}}, 2, 1},
+  // A 45 WPM dit shorter than the PTT lead goes out late but full length
+  {"dit under lead",   500, 25, {{0, 'D'}, {27, 'U'}}, 2, {{25, 27}}, 1, 0},
+  // Only the first mark of an over waits for the lead
+  {"second dit",       500, 25, {{0, 'D'}, {27, 'U'}, {54, 'D'}, {81, 'U'}}, 4, {{25, 27}, {54, 27}}, 2, 0},
+};
+
+static uint32_t Diff(uint32_t a, uint32_t b) { return (a > b) ? a - b : b - a; }
+
+static bool Run(const Case &c, uint32_t *error, unsigned long *expired)
+{
+  Morse<KeyPin, true> morse;
+  Lease               lease;
+  PTT<PTTPin, true>   p;
+  uint32_t            end = 0;
+  int                 next = 0;
+  bool                pass = true;
+
+  now = 0;
+  keyState = false;
+  marksOut.clear();
+  morse.begin();
+  morse.wpm(WPM);
+  morse.lease(c.Lease * 1000);
+  ptt = &p;
+  p.begin();
+  p.enabled = (c.Lead > 0);
+  p.lead = c.Lead * 1000;
+  morse.attachReady(PTTReady);
+  morse.attachKeyDown(PTTDown);
+  morse.attachKeyUp(PTTUp);
+  for(int i = 0; i < c.Golden_; i++) if(c.Golden[i].Start + c.Golden[i].Length > end) end = c.Golden[i].Start + c.Golden[i].Length;
+  end = (end + 500) * 1000;
+  for(now = 0; now < end; now += StepUs)
+  {
+    for(; (next < c.Events_) && (c.Events[next].At * 1000 <= now); next++)
+    {
+      switch (c.Events[next].Op)
+      {
+        case 'D':
+          morse.KeyDown();
+          lease.start(now);
+          break;
+        case 'U': morse.KeyUp(); break;
+        case 'R':
+          if(morse.keyed())
+          {
+            morse.lease(lease.renew(now));
+            morse.renew();
+          }
+          else if(lease.lapsed)
+          {
+            morse.KeyDown();
+            lease.start(now);
+          }
+          break;
+        case '.': morse.Dit(); break;
+        case '-': morse.Dash(); break;
+      }
+    }
+    uint32_t us;
+    morse.process();
+    if(((now % 1000) == 0) && morse.check() && lease.expired(us)) morse.lease(us);
+  }
+  *error = 0;
+  *expired = morse.expired;
+  if(keyState || ((int)marksOut.size() != c.Golden_)) pass = false;
+  for(int i = 0; pass && (i < c.Golden_); i++)
+  {
+    uint32_t e = Diff(marksOut[i].Start, c.Golden[i].Start * 1000);
+    if(Diff(marksOut[i].Length, c.Golden[i].Length * 1000) > e) e = Diff(marksOut[i].Length, c.Golden[i].Length * 1000);
+    if(e > *error) *error = e;
+  }
+  if(*error > Tolerance) pass = false;
+  if(*expired != c.Expired) pass = false;
+  if(p.violations > 0) pass = false;
+  return pass;
+}
+
+int main(int argc, char *argv[])
+{
+  bool verbose = false;
+  bool failed = false;
+
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "-v") == 0) verbose = true;
+    else
+    {
+      fprintf(stderr, "Usage: localtest [-v]\n");
+      return 1;
+    }
+  }
+  printf("case,marks,worst error uS,expired,result\n");
+  for(const Case &c : cases)
+  {
+    uint32_t      error;
+    unsigned long expired;
+    bool          pass = Run(c, &error, &expired);
+
+    if(!pass) failed = true;
+    printf("%s,%d,%u,%lu,%s\n", c.Name, (int)marksOut.size(), error, expired, pass ? "PASS" : "FAIL");
+    if(verbose && !pass)
+    {
+      printf("  golden");
+      for(int i = 0; i < c.Golden_; i++) printf(" %u+%u", c.Golden[i].Start * 1000, c.Golden[i].Length * 1000);
+      printf("\n  got   ");
+      for(const Mark &m : marksOut) printf(" %u+%u", m.Start, m.Length);
+      printf("\n");
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Arduino.h
+ *
+ * Just enough of the Arduino API to run the keying classes and the sketches from the
+ * Local and Remote off target under a virtual clock. Time only moves when the
+ * simulator moves it, pin writes are passed to the simulator.
+ *
+ * The header only keying classes need the clock and the pins. Whole sketches also
+ * use Print and Stream, the Serial port and the calls at the end of this file, they
+ * are run by keysim, see the network and board headers next to this one.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#define HIGH          1
+#define LOW           0
+#define INPUT         0
+#define OUTPUT        1
+#define INPUT_PULLUP  2
+#define DEC           10
+#define HEX           16
+
+typedef uint8_t byte;
+
+// Provided by the simulator
+uint32_t micros(void);
+void     pinMode(uint8_t pin, uint8_t mode);
+void     digitalWrite(uint8_t pin, uint8_t val);
+int      digitalRead(uint8_t pin);
+
+// Provided by simulators that run code that sounds a sidetone
+void     tone(uint8_t pin, unsigned int frequency);
+void     noTone(uint8_t pin);
+
+// Provided by simulators that run whole sketches
+void     delay(unsigned long ms);
+long     random(long howbig);
+
+static inline unsigned long millis(void) { return micros() / 1000; }
+static inline long random(long howsmall, long howbig) { return (howsmall >= howbig) ? howsmall : howsmall + random(howbig - howsmall); }
+static inline void yield(void) {}
+
+class Print;
+
+class Printable
+{
+  public:
+    virtual size_t printTo(Print &p) const = 0;
+};
+
+// Formatted output, the sketches only use the write and print calls below
+class Print
+{
+  private:
+    size_t number(unsigned long n, int base)
+    {
+      char buf[8 * sizeof(long) + 1];
+      char *p = &buf[sizeof(buf) - 1];
+
+      if(base < 2) base = 10;
+      *p = 0;
+      do
+      {
+        int d = n % base;
+        *--p = (d < 10) ? '0' + d : 'A' + d - 10;
+        n /= base;
+      } while(n != 0);
+      return write(p);
+    }
+    size_t signedNumber(long n, int base)
+    {
+      if((base != 10) || (n >= 0)) return number((unsigned long)n, base);
+      return write('-') + number(-(unsigned long)n, 10);
+    }
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size)
+    {
+      size_t n = 0;
+      while(size--) n += write(*buf++);
+      return n;
+    }
+    size_t write(const char *s) { return (s == NULL) ? 0 : write((const uint8_t *)s, strlen(s)); }
+    size_t write(const char *buf, size_t size) { return write((const uint8_t *)buf, size); }
+    virtual void flush(void) {}
+    size_t print(const char *s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return number(n, base); }
+    size_t print(int n, int base = DEC) { return signedNumber(n, base); }
+    size_t print(unsigned int n, int base = DEC) { return number(n, base); }
+    size_t print(long n, int base = DEC) { return signedNumber(n, base); }
+    size_t print(unsigned long n, int base = DEC) { return number(n, base); }
+    size_t print(double n, int digits = 2)
+    {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%.*f", digits, n);
+      return write(buf);
+    }
+    size_t print(const Printable &p) { return p.printTo(*this); }
+    size_t println(void) { return write("\r\n"); }
+    template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(T v, int f) { size_t n = print(v, f); return n + println(); }
+};
+
+class Stream : public Print
+{
+  protected:
+    unsigned long timeout = 1000;   // mS
+  public:
+    virtual int available(void) = 0;
+    virtual int read(void) = 0;
+    virtual int peek(void) = 0;
+    void setTimeout(unsigned long ms) { timeout = ms; }
+};
+
+// The host serial port of the sketch that is running, provided by the simulator
+class HardwareSerial : public Stream
+{
+  public:
+    void begin(unsigned long baud) { (void)baud; }
+    size_t write(uint8_t c);
+    using Print::write;
+    int available(void);
+    int read(void);
+    int peek(void);
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+class IPAddress : public Printable
+{
+  public:
+    uint8_t bytes[4] = {0};
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    {
+      bytes[0] = a;
+      bytes[1] = b;
+      bytes[2] = c;
+      bytes[3] = d;
+    }
+    IPAddress(const uint8_t *a) { memcpy(bytes, a, 4); }
+    IPAddress &operator=(const uint8_t *a)
+    {
+      memcpy(bytes, a, 4);
+      return *this;
+    }
+    uint8_t operator[](int i) const { return bytes[i]; }
+    uint8_t &operator[](int i) { return bytes[i]; }
+    bool operator==(const IPAddress &a) const { return memcmp(bytes, a.bytes, 4) == 0; }
+    bool operator!=(const IPAddress &a) const { return !(*this == a); }
+    bool fromString(const char *s)
+    {
+      unsigned v[4];
+      char     end;
+
+      if(sscanf(s, "%u.%u.%u.%u%c", &v[0], &v[1], &v[2], &v[3], &end) != 4) return false;
+      for(int i = 0; i < 4; i++)
+      {
+        if(v[i] > 255) return false;
+        bytes[i] = v[i];
+      }
+      return true;
+    }
+    size_t printTo(Print &p) const
+    {
+      size_t n = 0;
+      for(int i = 0; i < 4; i++)
+      {
+        if(i > 0) n += p.print('.');
+        n += p.print((unsigned)bytes[i]);
+      }
+      return n;
+    }
+};
+
+// Target calls with nothing to do here
+static inline void NVIC_SystemReset(void) {}
@@ -0,0 +1,34 @@
+/*
+ * EEPROM.h
+ *
+ * ESP8266 EEPROM emulation, blank (all 0xFF) until written. commit() keeps nothing
+ * past the run.
+ *
+ */
+#pragma once
+
+#include "Arduino.h"
+
+#define EEPROMSize  4096
+
+class EEPROMClass
+{
+  private:
+    uint8_t data[EEPROMSize];
+  public:
+    EEPROMClass() { memset(data, 0xFF, sizeof(data)); }
+    void begin(size_t size) { (void)size; }
+    template <typename T> T &get(int address, T &t)
+    {
+      memcpy((void *)&t, &data[address], sizeof(T));
+      return t;
+    }
+    template <typename T> const T &put(int address, const T &t)
+    {
+      memcpy(&data[address], (const void *)&t, sizeof(T));
+      return t;
+    }
+    bool commit(void) { return true; }
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,58 @@
+/*
+ * ESP8266WiFi.h
+ *
+ * The ESP8266 WiFi library calls the Remote uses, on the simulator's network. The
+ * WiFi associates as soon as it is asked to.
+ *
+ */
+#pragma once
+
+#include "Network.h"
+
+#define WL_IDLE_STATUS      0
+#define WL_NO_SSID_AVAIL    1
+#define WL_SCAN_COMPLETED   2
+#define WL_CONNECTED        3
+#define WL_CONNECT_FAILED   4
+#define WL_CONNECTION_LOST  5
+#define WL_DISCONNECTED     6
+#define WL_NO_SHIELD        255
+
+#define ENC_TYPE_WEP        5
+#define ENC_TYPE_TKIP       2
+#define ENC_TYPE_CCMP       4
+#define ENC_TYPE_NONE       7
+#define ENC_TYPE_AUTO       8
+
+class WiFiUDP : public UDP {};
+
+class WiFiClient : public Client
+{
+  public:
+    WiFiClient() {}
+    WiFiClient(int id) : Client(id) {}
+};
+
+class WiFiServer : public Server
+{
+  public:
+    WiFiServer(uint16_t port = 0) : Server(port) {}
+    WiFiClient available(void) { return WiFiClient(accept()); }
+};
+
+class ESP8266WiFiClass
+{
+  private:
+    int       state = WL_DISCONNECTED;
+  public:
+    int begin(const char *ssid, const char *password = NULL) { (void)ssid; (void)password; return state = WL_CONNECTED; }
+    bool hostname(const char *name) { (void)name; return true; }
+    int status(void) { return state; }
+    bool disconnect(void) { state = WL_DISCONNECTED; return true; }
+    bool softAP(const char *ssid, const char *password = NULL) { (void)ssid; (void)password; return true; }
+    int scanNetworks(void) { return 0; }
+    const char *SSID(int i) { (void)i; return ""; }
+    long RSSI(int i) { (void)i; return 0; }
+    int encryptionType(int i) { (void)i; return ENC_TYPE_NONE; }
+    IPAddress localIP(void) { return IPAddress(10, 0, 0, 201); }
+};
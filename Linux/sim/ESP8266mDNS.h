@@ -0,0 +1,17 @@
+/*
+ * ESP8266mDNS.h
+ *
+ * mDNS is not simulated, the responder starts and does nothing.
+ *
+ */
+#pragma once
+
+#include "Arduino.h"
+
+class MDNSResponder
+{
+  public:
+    bool begin(const char *host, IPAddress ip = IPAddress(), uint32_t ttl = 120) { (void)host; (void)ip; (void)ttl; return true; }
+    void addService(const char *service, const char *proto, uint16_t port) { (void)service; (void)proto; (void)port; }
+    void update(void) {}
+};
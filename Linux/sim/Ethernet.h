@@ -0,0 +1,39 @@
+/*
+ * Ethernet.h
+ *
+ * The W5500 Ethernet library calls the Local uses, on the simulator's network.
+ *
+ */
+#pragma once
+
+#include "Network.h"
+
+class EthernetUDP : public UDP {};
+
+class EthernetClient : public Client
+{
+  public:
+    EthernetClient() {}
+    EthernetClient(int id) : Client(id) {}
+};
+
+class EthernetServer : public Server
+{
+  public:
+    EthernetServer(uint16_t port = 0) : Server(port) {}
+    EthernetClient available(void) { return EthernetClient(accept()); }
+};
+
+enum EthernetLinkStatus { Unknown, LinkON, LinkOFF };
+enum EthernetHardwareStatus { EthernetNoHardware, EthernetW5100, EthernetW5200, EthernetW5500 };
+
+class EthernetClass
+{
+  public:
+    void init(uint8_t cs) { (void)cs; }
+    void begin(uint8_t *mac, IPAddress ip) { (void)mac; (void)ip; }
+    EthernetHardwareStatus hardwareStatus(void) { return EthernetW5500; }
+    EthernetLinkStatus linkStatus(void) { return LinkON; }
+};
+
+extern EthernetClass Ethernet;
@@ -0,0 +1,7 @@
+/*
+ * FlashAsEEPROM.h
+ *
+ * Nothing from this header is used off target.
+ *
+ */
+#pragma once
@@ -0,0 +1,21 @@
+/*
+ * FlashStorage.h
+ *
+ * SAMD flash storage, reads back zeros until written.
+ *
+ */
+#pragma once
+
+#include "Arduino.h"
+
+template <typename T> class FlashStorageClass
+{
+  private:
+    T data;
+  public:
+    FlashStorageClass() { memset((void *)&data, 0, sizeof(T)); }
+    T read(void) { return data; }
+    void write(T value) { data = value; }
+};
+
+#define FlashStorage(name, T) FlashStorageClass<T> name
@@ -0,0 +1,30 @@
+/*
+ * LocalSketch.cpp
+ *
+ * The Local firmware built for the host, in namespace Local so it links next to the
+ * other sketch. Each sketch is a translation unit of its own, the two carry
+ * identical copies of some headers and #pragma once would take one for the other.
+ * The board headers are included here, outside the namespace, the sketch's own
+ * includes of them are then skipped.
+ *
+ */
+#include "Arduino.h"
+#include "SPI.h"
+#include "Wire.h"
+#include "Ethernet.h"
+#include "FlashStorage.h"
+#include "FlashAsEEPROM.h"
+#include "arduino-timer.h"
+
+// The sketches are built as the Arduino tools build them, these are warnings there.
+// Serial.h defines EOF for the command parser.
+#pragma GCC diagnostic ignored "-Wnarrowing"
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+#undef EOF
+
+namespace Local
+{
+#include "../../Local/Local.ino"
+#include "../../Local/Serial.cpp"
+#include "../../Local/HostFrame.cpp"
+}
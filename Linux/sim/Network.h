@@ -0,0 +1,77 @@
+/*
+ * Network.h
+ *
+ * UDP and TCP sockets for sketches run by a simulator. The sockets are handles, the
+ * datagrams and bytes are carried by the simulator's network, which provides the
+ * members declared here. Each call belongs to the node whose sketch is running,
+ * see simNode. Ethernet.h and ESP8266WiFi.h give these the names the Local and
+ * Remote libraries use.
+ *
+ */
+#pragma once
+
+#include "Arduino.h"
+
+#define UDP_TX_PACKET_MAX_SIZE 24
+
+// Node whose sketch the simulator is running, set by the simulator
+extern int simNode;
+
+class UDP : public Stream
+{
+  private:
+    int       node = -1;
+    uint16_t  port = 0;
+  public:
+    uint8_t  begin(uint16_t port);
+    void     stop(void);
+    int      parsePacket(void);
+    int      read(void);
+    int      read(uint8_t *buf, size_t size);
+    int      read(char *buf, size_t size) { return read((uint8_t *)buf, size); }
+    int      peek(void);
+    int      available(void);
+    int      beginPacket(IPAddress ip, uint16_t port);
+    int      endPacket(void);
+    size_t   write(uint8_t c);
+    size_t   write(const uint8_t *buf, size_t size);
+    using Print::write;
+    void     flush(void) {}
+    IPAddress remoteIP(void);
+    uint16_t remotePort(void);
+};
+
+// One end of a TCP connection, id 0 is no connection
+class Client : public Stream
+{
+  protected:
+    int       id = 0;
+  public:
+    Client() {}
+    Client(int id) : id(id) {}
+    int      connect(IPAddress ip, uint16_t port);
+    uint8_t  connected(void);
+    void     stop(void);
+    int      available(void);
+    int      read(void);
+    int      peek(void);
+    size_t   write(uint8_t c);
+    size_t   write(const uint8_t *buf, size_t size);
+    using Print::write;
+    operator bool() { return id != 0; }
+    bool operator==(const Client &c) const { return id == c.id; }
+    bool operator!=(const Client &c) const { return id != c.id; }
+};
+
+// Accepts connections to a port. available() returns a connection with bytes
+// waiting, as the Ethernet library does.
+class Server
+{
+  protected:
+    uint16_t  port = 0;
+    int       node = -1;
+  public:
+    Server(uint16_t port = 0) : port(port) {}
+    void begin(void);
+    int  accept(void);
+};
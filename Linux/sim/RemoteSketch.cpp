@@ -0,0 +1,31 @@
+/*
+ * RemoteSketch.cpp
+ *
+ * The Remote firmware built for the host, in namespace Remote so it links next to the
+ * other sketch. Each sketch is a translation unit of its own, the two carry
+ * identical copies of some headers and #pragma once would take one for the other.
+ * The board headers are included here, outside the namespace, the sketch's own
+ * includes of them are then skipped.
+ *
+ */
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+#include "ESP8266mDNS.h"
+#include "EEPROM.h"
+#include "arduino-timer.h"
+#include "user_interface.h"
+
+// The sketches are built as the Arduino tools build them, these are warnings there.
+// Serial.h defines EOF for the command parser.
+#pragma GCC diagnostic ignored "-Wnarrowing"
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+#undef EOF
+
+namespace Remote
+{
+// The sketch includes it as serial.h, see lower/serial.h
+#include "../../Remote/Serial.h"
+#include "../../Remote/Remote.ino"
+#include "../../Remote/Serial.cpp"
+#include "../../Remote/HostFrame.cpp"
+}
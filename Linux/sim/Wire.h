@@ -0,0 +1,7 @@
+/*
+ * Wire.h
+ *
+ * Nothing from this header is used off target.
+ *
+ */
+#pragma once
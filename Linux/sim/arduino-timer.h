@@ -0,0 +1,51 @@
+/*
+ * arduino-timer.h
+ *
+ * The arduino-timer calls the sketches use, tasks run from tick() on the millis()
+ * clock. A task that returns false is removed.
+ *
+ */
+#pragma once
+
+#include "Arduino.h"
+
+template <size_t Tasks = 16, unsigned long (*Clock)(void) = millis, typename T = void *> class Timer
+{
+  public:
+    typedef bool (*handler_t)(T opaque);
+  private:
+    struct Task
+    {
+      handler_t     Handler;
+      T             Opaque;
+      unsigned long Start;
+      unsigned long Expires;
+      bool          Repeat;
+    } tasks[Tasks] = {};
+    Task *add(handler_t h, unsigned long ms, bool repeat, T opaque)
+    {
+      for(size_t i = 0; i < Tasks; i++)
+      {
+        if(tasks[i].Handler != NULL) continue;
+        tasks[i] = {h, opaque, Clock(), ms, repeat};
+        return &tasks[i];
+      }
+      return NULL;
+    }
+  public:
+    Task *in(unsigned long ms, handler_t h, T opaque = T()) { return add(h, ms, false, opaque); }
+    Task *every(unsigned long ms, handler_t h, T opaque = T()) { return add(h, ms, true, opaque); }
+    void tick(void)
+    {
+      for(size_t i = 0; i < Tasks; i++)
+      {
+        Task &t = tasks[i];
+        if((t.Handler == NULL) || ((Clock() - t.Start) < t.Expires)) continue;
+        bool again = t.Handler(t.Opaque) && t.Repeat;
+        if(again) t.Start += t.Expires;
+        else t.Handler = NULL;
+      }
+    }
+};
+
+static inline Timer<> timer_create_default(void) { return Timer<>(); }
@@ -0,0 +1,11 @@
+/*
+ * arduino.h
+ *
+ * The sketches include the core header as arduino.h, which only resolves on a file
+ * system that ignores case. It is in a directory of its own so it does not collide
+ * with Arduino.h where case is ignored.
+ *
+ */
+#pragma once
+
+#include "../Arduino.h"
@@ -0,0 +1,9 @@
+/*
+ * serial.h
+ *
+ * The Remote sketch includes Serial.h as serial.h, which only resolves on a file
+ * system that ignores case. Simulators include the Remote's Serial.h ahead of the
+ * sketch, so there is nothing left to do here.
+ *
+ */
+#pragma once
@@ -0,0 +1,9 @@
+/*
+ * user_interface.h
+ *
+ * The ESP8266 SDK calls the Remote uses, a restart does nothing off target.
+ *
+ */
+#pragma once
+
+static inline void system_restart(void) {}
@@ -0,0 +1,161 @@
+/*
+ * AllocTrack.cpp
+ *
+ * Allocation hooks for the tracker, see AllocTrack.h. malloc, free, realloc, calloc,
+ * new and delete are replaced with versions that call the C library's allocator and
+ * count what went through it. On the M0 these are newlib's reentrant functions, on
+ * Linux glibc's __libc_ functions. The ESP8266 has no hooks.
+ *
+ * Sizes are the allocator's usable size of the block so a free takes off exactly
+ * what the allocation added.
+ *
+ */
+#include "AllocTrack.h"
+
+#ifdef ALLOC_TRACKING
+
+AllocTrack allocTrack;
+ALLOC_TLS AllocGuardState allocGuard;
+
+#ifdef ALLOC_HOOKS
+
+#include <string.h>
+#include <new>
+
+#ifdef ARDUINO
+#include <reent.h>
+
+extern "C"
+{
+  void   *_malloc_r(struct _reent *, size_t);
+  void   _free_r(struct _reent *, void *);
+  void   *_realloc_r(struct _reent *, void *, size_t);
+  size_t _malloc_usable_size_r(struct _reent *, void *);
+}
+
+#define RealMalloc(n)       _malloc_r(_REENT, n)
+#define RealFree(p)         _free_r(_REENT, p)
+#define RealRealloc(p, n)   _realloc_r(_REENT, p, n)
+#define UsableSize(p)       _malloc_usable_size_r(_REENT, p)
+#define ALLOC_NOTHROW
+#else
+#include <errno.h>
+#include <malloc.h>
+
+extern "C"
+{
+  void *__libc_malloc(size_t);
+  void __libc_free(void *);
+  void *__libc_realloc(void *, size_t);
+  void *__libc_memalign(size_t, size_t);
+}
+
+#define RealMalloc(n)       __libc_malloc(n)
+#define RealFree(p)         __libc_free(p)
+#define RealRealloc(p, n)   __libc_realloc(p, n)
+#define UsableSize(p)       malloc_usable_size(p)
+#define ALLOC_NOTHROW       throw()
+#endif
+
+static void *Allocate(size_t n, const void *site)
+{
+  void *p = RealMalloc(n);
+
+  if(p != NULL) allocTrack.alloc(site, UsableSize(p), allocGuard);
+  return p;
+}
+
+static void Release(void *p)
+{
+  if(p == NULL) return;
+  allocTrack.release(UsableSize(p));
+  RealFree(p);
+}
+
+extern "C"
+{
+  void *malloc(size_t n) ALLOC_NOTHROW
+  {
+    return Allocate(n, __builtin_return_address(0));
+  }
+
+  void free(void *p) ALLOC_NOTHROW
+  {
+    Release(p);
+  }
+
+  void *calloc(size_t n, size_t size) ALLOC_NOTHROW
+  {
+    void *p = Allocate(n * size, __builtin_return_address(0));
+
+    if(p != NULL) memset(p, 0, n * size);
+    return p;
+  }
+
+  void *realloc(void *p, size_t n) ALLOC_NOTHROW
+  {
+    if(p == NULL) return Allocate(n, __builtin_return_address(0));
+    size_t old = UsableSize(p);
+    void   *q = RealRealloc(p, n);
+    if((q == NULL) && (n != 0)) return NULL;
+    allocTrack.release(old);
+    if(q != NULL) allocTrack.alloc(__builtin_return_address(0), UsableSize(q), allocGuard);
+    return q;
+  }
+
+#ifndef ARDUINO
+  // libstdc++ allocates aligned new with these
+  void *memalign(size_t align, size_t n) ALLOC_NOTHROW
+  {
+    void *p = __libc_memalign(align, n);
+
+    if(p != NULL) allocTrack.alloc(__builtin_return_address(0), UsableSize(p), allocGuard);
+    return p;
+  }
+
+  void *aligned_alloc(size_t align, size_t n) ALLOC_NOTHROW
+  {
+    return memalign(align, n);
+  }
+
+  int posix_memalign(void **out, size_t align, size_t n) ALLOC_NOTHROW
+  {
+    void *p = __libc_memalign(align, n);
+
+    if(p == NULL) return ENOMEM;
+    allocTrack.alloc(__builtin_return_address(0), UsableSize(p), allocGuard);
+    *out = p;
+    return 0;
+  }
+#endif
+}
+
+// new and delete are counted against their caller, not against malloc
+void *operator new(size_t n)
+{
+  void *p = Allocate(n, __builtin_return_address(0));
+
+#ifndef ARDUINO
+  if(p == NULL) throw std::bad_alloc();
+#endif
+  return p;
+}
+
+void *operator new[](size_t n)
+{
+  void *p = Allocate(n, __builtin_return_address(0));
+
+#ifndef ARDUINO
+  if(p == NULL) throw std::bad_alloc();
+#endif
+  return p;
+}
+
+void operator delete(void *p) noexcept { Release(p); }
+void operator delete[](void *p) noexcept { Release(p); }
+void operator delete(void *p, size_t) noexcept { Release(p); }
+void operator delete[](void *p, size_t) noexcept { Release(p); }
+
+#endif
+
+#endif
@@ -0,0 +1,243 @@
+#pragma once
+
+// Heap allocation tracker. With ALLOC_TRACKING defined AllocTrack.cpp takes over
+// malloc, free, realloc and calloc, new and delete go through them, and every
+// allocation is counted: live bytes, peak live bytes, allocations, frees and a
+// table of call sites (the caller's return address) with the count and bytes from
+// each. Look the addresses up in the map file or with addr2line.
+//
+// ALLOC_GUARD("name") at the top of a block marks a hot path that must not
+// allocate. Once arm() is called at the end of startup an allocation inside a
+// guarded block is a violation, counted with the zone and call site of the first
+// one. In test mode a violation is reported when the block exits, on the host it
+// aborts.
+//
+// The ESP8266 core owns malloc so there are no hooks there, the guard compares the
+// free heap on entry and exit instead. That catches an allocation that is kept,
+// not one that is freed before the block exits.
+//
+// Everything compiles out unless ALLOC_TRACKING is defined.
+
+//#define ALLOC_TRACKING
+
+#ifdef ALLOC_TRACKING
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#define ALLOC_TLS
+#else
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#define ALLOC_TLS           thread_local
+#endif
+
+#if !defined(ARDUINO_ARCH_ESP8266)
+#define ALLOC_HOOKS
+#endif
+
+#define MaxAllocSites  16
+
+typedef struct
+{
+  const void    *Site;
+  unsigned long Count;
+  unsigned long Bytes;
+} AllocSite;
+
+// Guard state of the running thread
+typedef struct
+{
+  const char    *Zone;
+  int           Depth;
+  unsigned long Violations;         // Seen by this thread
+  unsigned long Reported;           // Violations reported in test mode
+  uint32_t      FreeHeap;           // On entry, ESP8266 only
+} AllocGuardState;
+
+// Constant initialized so the hooks can use it before any constructor has run
+class AllocTrack
+{
+  private:
+#ifndef ARDUINO
+    volatile bool spin;
+    void lock(void) { while(__atomic_test_and_set(&spin, __ATOMIC_ACQUIRE)); }
+    void unlock(void) { __atomic_clear(&spin, __ATOMIC_RELEASE); }
+#else
+    void lock(void) {}
+    void unlock(void) {}
+#endif
+  public:
+    bool          armed;
+    bool          testMode;
+    long          live;             // Bytes
+    long          peak;
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long violations;
+    const char    *failZone;        // First violation
+    const void    *failSite;
+    unsigned long failBytes;
+    AllocSite     sites[MaxAllocSites];
+    int           numSites;
+    unsigned long otherSites;       // Allocations from sites that did not fit the table
+    void alloc(const void *site, unsigned long bytes, AllocGuardState &g)
+    {
+      int i;
+
+      lock();
+      allocs++;
+      live += bytes;
+      if(live > peak) peak = live;
+      for(i = 0; i < numSites; i++) if(sites[i].Site == site) break;
+      if((i == numSites) && (numSites < MaxAllocSites)) sites[numSites++].Site = site;
+      if(i < numSites)
+      {
+        sites[i].Count++;
+        sites[i].Bytes += bytes;
+      }
+      else otherSites++;
+      if(armed && (g.Depth > 0)) violation(g.Zone, site, bytes, g);
+      unlock();
+    }
+    void release(unsigned long bytes)
+    {
+      lock();
+      frees++;
+      live -= bytes;
+      unlock();
+    }
+    void violation(const char *zone, const void *site, unsigned long bytes, AllocGuardState &g)
+    {
+      if(violations++ == 0)
+      {
+        failZone = zone;
+        failSite = site;
+        failBytes = bytes;
+      }
+      g.Violations++;
+    }
+    void arm(void) { armed = true; }
+    // Clears the peak, sites and violations, live bytes stay
+    void reset(void)
+    {
+      lock();
+      peak = live;
+      allocs = frees = violations = otherSites = 0;
+      failZone = NULL;
+      failSite = NULL;
+      failBytes = 0;
+      numSites = 0;
+      unlock();
+    }
+#ifdef ARDUINO
+    // Reports live bytes, peak, allocations, frees and violations, then one line
+    // per call site, address, count and bytes. Without hooks live and peak come
+    // from the free heap.
+    void report(Stream *s)
+    {
+      s->print(live);
+      s->print(",");
+      s->print(peak);
+      s->print(",");
+      s->print(allocs);
+      s->print(",");
+      s->print(frees);
+      s->print(",");
+      s->println(violations);
+      for(int i = 0; i < numSites; i++)
+      {
+        s->print("0x");
+        s->print((unsigned long)(uintptr_t)sites[i].Site, HEX);
+        s->print(",");
+        s->print(sites[i].Count);
+        s->print(",");
+        s->println(sites[i].Bytes);
+      }
+      if(otherSites > 0)
+      {
+        s->print("other,");
+        s->println(otherSites);
+      }
+    }
+    // Reports PASS or FAIL with the zone, call site and bytes of the first violation
+    void result(Stream *s)
+    {
+      if(violations == 0)
+      {
+        s->println("PASS");
+        return;
+      }
+      s->print("FAIL,");
+      s->print(failZone);
+      s->print(",0x");
+      s->print((unsigned long)(uintptr_t)failSite, HEX);
+      s->print(",");
+      s->println(failBytes);
+    }
+#endif
+};
+
+extern AllocTrack allocTrack;
+extern ALLOC_TLS AllocGuardState allocGuard;
+
+#ifdef ARDUINO_ARCH_ESP8266
+// Heap in use is the free heap lost since the first call
+static inline void AllocSample(void)
+{
+  static uint32_t first = ESP.getFreeHeap();
+
+  allocTrack.live = first - ESP.getFreeHeap();
+  if(allocTrack.live > allocTrack.peak) allocTrack.peak = allocTrack.live;
+}
+#endif
+
+class AllocScope
+{
+  private:
+    const char    *outer;
+  public:
+    AllocScope(const char *zone)
+    {
+      outer = allocGuard.Zone;
+      allocGuard.Zone = zone;
+#ifdef ARDUINO_ARCH_ESP8266
+      if(allocGuard.Depth == 0) allocGuard.FreeHeap = ESP.getFreeHeap();
+#endif
+      allocGuard.Depth++;
+    }
+    ~AllocScope()
+    {
+#ifdef ARDUINO_ARCH_ESP8266
+      if(allocGuard.Depth == 1)
+      {
+        uint32_t now = ESP.getFreeHeap();
+        if(allocTrack.armed && (now < allocGuard.FreeHeap)) allocTrack.violation(allocGuard.Zone, NULL, allocGuard.FreeHeap - now, allocGuard);
+        AllocSample();
+      }
+#endif
+      allocGuard.Depth--;
+      if(allocTrack.testMode && (allocGuard.Violations != allocGuard.Reported))
+      {
+        allocGuard.Reported = allocGuard.Violations;
+#ifdef ARDUINO
+        Serial.print("Allocation in ");
+        Serial.println(allocGuard.Zone);
+#else
+        fprintf(stderr, "Allocation in %s, site %p, %lu bytes\n", allocGuard.Zone, allocTrack.failSite, allocTrack.failBytes);
+        abort();
+#endif
+      }
+      allocGuard.Zone = outer;
+    }
+};
+
+#define ALLOC_CAT2(a, b)    a##b
+#define ALLOC_CAT(a, b)     ALLOC_CAT2(a, b)
+#define ALLOC_GUARD(name)   AllocScope ALLOC_CAT(alloc_, __LINE__)(name)
+
+#else
+
+#define ALLOC_GUARD(name)
+
+#endif
@@ -2,22 +2,23 @@
 #define button_h
 
 #include "Arduino.h"
+#include "FastPin.h"
 
-class Button
+// Debounced input, the pin is a template argument so it is read directly from the
+// port.
+template <uint8_t btn> class Button
 {
   private:
-    uint8_t btn;
     uint16_t state;
   public:
-    void begin(uint8_t button) 
+    void begin(void) 
     {
-      btn = button;
       state = 0;
       pinMode(btn, INPUT_PULLUP);
     }
     bool debounce() 
     {
-      state = (state<<1) | digitalRead(btn) | 0xfe00;
+      state = (state<<1) | FastPin<btn>::read() | 0xfe00;
       return (state == 0xff00);
     }
 };
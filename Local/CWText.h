@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Bounded character FIFO for text to be sent in CW. Text is appended from TCP,
+// serial or UDP and drained one character at a time by the CW task as the Morse
+// element queue empties, so sending never blocks.
+//
+// Flow control is credit based, the sender may append up to credits() characters.
+// An append that does not fit is rejected as a whole.
+//
+// The CW task understands these in the text:
+//    <xx>  = prosign, characters inside the brackets are sent with no character space
+//    {nn}  = change speed to nn WPM for the rest of the stream
+
+#define CWTextSize  256
+
+class CWText
+{
+  private:
+    char  buffer[CWTextSize];
+    int   head  = 0;
+    int   tail  = 0;
+    int   count = 0;
+  public:
+    // Returns the number of characters appended, -1 if the text does not fit
+    int append(const char *text, int len)
+    {
+      if(len > (CWTextSize - count)) return -1;
+      for(int i = 0; i < len; i++)
+      {
+        buffer[tail] = text[i];
+        if(++tail >= CWTextSize) tail = 0;
+      }
+      count += len;
+      return len;
+    }
+    int append(const char *text) { return append(text, strlen(text)); }
+    // Returns the next character, -1 if empty
+    int get(void)
+    {
+      if(count == 0) return -1;
+      char c = buffer[head];
+      if(++head >= CWTextSize) head = 0;
+      count--;
+      return c;
+    }
+    void abort(void) { head = tail = count = 0; }
+    int remaining(void) { return count; }
+    int credits(void) { return CWTextSize - count; }
+};
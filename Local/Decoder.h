@@ -0,0 +1,175 @@
+#pragma once
+
+#include "Arduino.h"
+#include "Morse.h"
+
+// Streaming CW decoder fed by the key down and key up edges of the transmitter
+// output. Dit length is tracked by online 2-means clustering, marks are split into
+// dit and dah clusters and spaces into element and character clusters, each
+// centroid moves 1/8 of the way towards every sample that falls in its cluster.
+// Word spaces are spaces longer than 5 dit units.
+//
+// Each edge costs a fixed amount of work, characters are found with a table lookup
+// on the element code and all storage is fixed.
+//
+// Each decoded character carries a 0 to 100 confidence, the lowest of its elements.
+// An element scores by how far it is from the decision threshold relative to half
+// the distance between the two cluster centroids.
+
+#define DecodeSize     64           // Decoded character buffer size
+#define MaxCodeLen     7            // Longest element sequence decoded
+#define MaxDitRun      16           // Dits in a row that mean the dah cluster is lost
+
+typedef struct
+{
+  char      Char;                   // Decoded character, * if not known
+  uint8_t   Confidence;             // 0 to 100
+} Decoded;
+
+class Decoder
+{
+  private:
+    char      table[2 << MaxCodeLen];   // Element code to character
+    bool      down = false;
+    uint32_t  edgeTime;
+    // Cluster centroids, uS
+    uint32_t  ditMean, dahMean;
+    uint32_t  elementMean, charMean;
+    // Character being received, code starts with a 1 marker bit then 0 = dit, 1 = dah
+    uint8_t   code = 1;
+    uint8_t   elements = 0;
+    uint8_t   confidence = 100;
+    uint8_t   ditRun = 0;           // Marks in a row in the dit cluster
+    bool      wordDone = true;
+    // Decoded characters
+    Decoded   buffer[DecodeSize];
+    int       head = 0;
+    int       tail = 0;
+    int       count = 0;
+    static uint8_t score(uint32_t value, uint32_t lo, uint32_t hi)
+    {
+      uint32_t threshold = (lo + hi) / 2;
+      uint32_t half = (hi - lo) / 2;
+      uint32_t dist = (value > threshold) ? value - threshold : threshold - value;
+      if(half == 0) return 0;
+      if(dist >= half) return 100;
+      return (dist * 100) / half;
+    }
+    static void track(uint32_t &mean, uint32_t value) { mean = mean - (mean >> 3) + (value >> 3); }
+    void seed(uint32_t dit)
+    {
+      ditMean = elementMean = dit;
+      dahMean = charMean = 3 * dit;
+      ditRun = 0;
+    }
+    // Spaces longer than 5 units are word spaces, the unit is taken from both the dit
+    // and element clusters so mark weighting does not move it
+    uint32_t wordSpace(void) { return (5 * (ditMean + elementMean)) / 2; }
+    void put(char c, uint8_t conf)
+    {
+      if(count >= DecodeSize) return;
+      buffer[tail].Char = c;
+      buffer[tail].Confidence = conf;
+      if(++tail >= DecodeSize) tail = 0;
+      count++;
+    }
+    void endChar(void)
+    {
+      if(elements == 0) return;
+      char c = (elements <= MaxCodeLen) ? table[code] : 0;
+      if(c == 0) put('*', 0);
+      else put(c, confidence);
+      code = 1;
+      elements = 0;
+      confidence = 100;
+      wordDone = false;
+    }
+  public:
+    // Seeds the clusters from the configured dit time
+    void begin(uint32_t dit)
+    {
+      memset(table, 0, sizeof(table));
+      for(int i = 0; patterns[i].Char != 0; i++)
+      {
+        int c = 1, n = 0;
+        for(n = 0; patterns[i].Code[n] != 0; n++) c = (c << 1) | (patterns[i].Code[n] == '-');
+        if((n > 0) && (n <= MaxCodeLen)) table[c] = patterns[i].Char;
+      }
+      reset(dit);
+    }
+    void reset(uint32_t dit)
+    {
+      seed(dit);
+      code = 1;
+      elements = 0;
+      confidence = 100;
+      wordDone = true;
+    }
+    // Call on every key edge with the edge time in uS
+    void edge(bool keyDown, uint32_t now)
+    {
+      uint32_t len = now - edgeTime;
+
+      if(keyDown == down) return;
+      down = keyDown;
+      edgeTime = now;
+      if(!keyDown)
+      {
+        // End of a mark, ignore long carriers such as tune
+        if(len > 8 * dahMean) { endChar(); return; }
+        bool dah = len > (ditMean + dahMean) / 2;
+        uint8_t s = score(len, ditMean, dahMean);
+        if(s < confidence) confidence = s;
+        if(dah) track(dahMean, len);
+        else track(ditMean, len);
+        // 2-means does not follow a speed up far from its seed, dits and dahs both
+        // land in the dit cluster and its centroid settles between them. No text
+        // has that many dits in a row, so the clusters are split again from half of it
+        ditRun = dah ? 0 : ditRun + 1;
+        if(ditRun >= MaxDitRun) seed(ditMean / 2);
+        // Keep the clusters apart if one side has had no samples for a while
+        if(dahMean < 2 * ditMean) dahMean = 2 * ditMean;
+        if(elements < 8) elements++;
+        code = (code << 1) | dah;
+        return;
+      }
+      // End of a space
+      if(len < (elementMean + charMean) / 2)
+      {
+        track(elementMean, len);
+        uint8_t s = score(len, elementMean, charMean);
+        if(s < confidence) confidence = s;
+      }
+      else
+      {
+        if(len < wordSpace()) track(charMean, len);
+        endChar();
+        if(!wordDone && (len > wordSpace())) put(' ', 100);
+        wordDone = true;
+      }
+      if(charMean < 2 * elementMean) charMean = 2 * elementMean;
+    }
+    // Call often, ends the character and word when the key has been up long enough
+    void poll(uint32_t now)
+    {
+      if(down) return;
+      uint32_t len = now - edgeTime;
+      if((elements > 0) && (len > (elementMean + charMean) / 2)) endChar();
+      if(!wordDone && (len > wordSpace()))
+      {
+        put(' ', 100);
+        wordDone = true;
+      }
+    }
+    bool get(Decoded &d)
+    {
+      if(count == 0) return false;
+      d = buffer[head];
+      if(++head >= DecodeSize) head = 0;
+      count--;
+      return true;
+    }
+    int available(void) { return count; }
+    // Estimated speed from the dit cluster
+    int wpm(void) { return (ditMean == 0) ? 0 : 1200000UL / ditMean; }
+};
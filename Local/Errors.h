@@ -80,4 +80,6 @@ extern int ErrorCode;
 #define ERR_ADCNOTAVALIABLE         124     // ADC interface in use and not avaliable at this time
 #define ERR_ADCALREARYSETUP         125     // ADC interface is already setup
 #define ERR_ADCNOTSETUP             126     // ADC interface is not setup
+#define ERR_BUFFERFULL              129     // Buffer full, try again later
+#define ERR_BADFRAME                130     // Binary frame length or CRC error
 #endif
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Direct port access for pins known at compile time. Writes go straight to the port
+// set and clear registers and reads come from the port input register. Boards that
+// are not listed here fall back to the Arduino calls.
+//
+// port() returns the raw input register holding the pin, level() extracts the pin
+// from a value returned by port(). Use FastPair to sample two pins, if they share a
+// port only one register read is done.
+
+template <uint8_t pin> struct FastPin
+{
+#if defined(ARDUINO_ARCH_ESP8266)
+  // GPIO0 to GPIO15 are in the GPO/GPI registers, GPIO16 is in the RTC block
+  static inline void set(void) { if(pin < 16) GPOS = (1 << pin); else GP16O |= 1; }
+  static inline void clear(void) { if(pin < 16) GPOC = (1 << pin); else GP16O &= ~1; }
+  static inline uint32_t port(void) { return (pin < 16) ? GPI : GP16I; }
+  static inline bool level(uint32_t value) { return (pin < 16) ? ((value >> pin) & 1) : (value & 1); }
+  static inline int group(void) { return (pin < 16) ? 0 : 1; }
+#elif defined(ARDUINO_ARCH_SAMD)
+  static inline void set(void) { PORT->Group[g_APinDescription[pin].ulPort].OUTSET.reg = (1ul << g_APinDescription[pin].ulPin); }
+  static inline void clear(void) { PORT->Group[g_APinDescription[pin].ulPort].OUTCLR.reg = (1ul << g_APinDescription[pin].ulPin); }
+  static inline uint32_t port(void) { return PORT->Group[g_APinDescription[pin].ulPort].IN.reg; }
+  static inline bool level(uint32_t value) { return (value >> g_APinDescription[pin].ulPin) & 1; }
+  static inline int group(void) { return g_APinDescription[pin].ulPort; }
+#else
+  static inline void set(void) { digitalWrite(pin, HIGH); }
+  static inline void clear(void) { digitalWrite(pin, LOW); }
+  static inline uint32_t port(void) { return digitalRead(pin); }
+  static inline bool level(uint32_t value) { return value & 1; }
+  static inline int group(void) { return -1 - pin; }
+#endif
+  static inline bool read(void) { return level(port()); }
+  static inline void write(bool state) { if(state) set(); else clear(); }
+};
+
+template <uint8_t pinA, uint8_t pinB> struct FastPair
+{
+  static inline void read(bool &a, bool &b)
+  {
+    uint32_t value = FastPin<pinA>::port();
+
+    a = FastPin<pinA>::level(value);
+    if(FastPin<pinA>::group() != FastPin<pinB>::group()) value = FastPin<pinB>::port();
+    b = FastPin<pinB>::level(value);
+  }
+};
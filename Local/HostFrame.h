@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Binary host protocol, runs alongside the ASCII commands on the same streams. A
+// frame starts with STX, which never appears in an ASCII command:
+//
+//    STX, payload length, payload, CRC-16 CCITT of the length and payload (high byte first)
+//
+// The payload is an operation followed by its data. Command ids are fixed, see
+// FrameIds in HostFrame.cpp, and do not change between builds. Get and watch take
+// commands that hold a value, int, bool, float or string. Set takes the set
+// commands, a function with an int or string argument takes an int or string.
+//
+//    G id id ...              Get values, reply g then id, type, value for each
+//    S id value id value ...  Set values using the ids of the set commands, reply s.
+//                             Each value goes through its set command and gets the
+//                             same checks as the ASCII command. Nothing is set if
+//                             the frame is malformed, the first value refused stops
+//                             the rest and is replied with its error code
+//    W id id ...              Watch values, reply w. Then u frames with id, type, value
+//                             of the watched values that changed. W alone stops it.
+//
+// Errors are replied with n, error code. Values are sent as their type: int and float
+// 4 bytes little endian, bool 1 byte, string a length byte then the characters.
+
+#define STX            0x02
+#define MaxFrame       255          // Largest payload
+#define MaxFrameStr    19           // Longest string that can be set, same as ASCII
+#define MaxWatch       16
+#define FrameTimeout   100          // mS to receive a whole frame
+#define WatchPeriod    50           // mS between checks of the watched values
+
+uint16_t CRC16(const uint8_t *data, int len);
+void HostInput(char ch, Stream *src);
+void HostPoll(void);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Key down lease. While the key is held the Remote sends R,seq every LeaseRenewal uS
+// with the sequence number of the key down. The lease is the mean renewal interval
+// plus 4 times its mean deviation so it follows the link jitter, and a lease that
+// runs out doubles the deviation. Until renewals are seen the Morse default lease is
+// used.
+//
+// The lease is never shorter than LeaseMin, four renewal intervals, so losing one or
+// two R messages does not break a mark. If the lease does run out and an R for the
+// same key down arrives later the Remote is still holding the key, it is keyed again
+// and counted in rekeys. A stale R can key the transmitter for at most one lease.
+//
+// Shared by the Local sketch and the Linux tools so they apply the same lease.
+
+#define LeaseRenewal   10000                    // Remote renewal interval, uS
+#define LeaseMin       (4 * LeaseRenewal)       // uS
+#define LeaseMax       500000                   // uS
+
+class Lease
+{
+  public:
+    uint32_t      last = 0;         // Time of the key down or last renewal, uS
+    uint32_t      mean = 0;         // Mean renewal interval, uS
+    uint32_t      dev  = 0;         // Mean deviation of the renewal interval, uS
+    unsigned long renewals = 0;
+    unsigned long rekeys = 0;       // Keyed again by an R after the lease ran out
+    bool          lapsed = false;   // Ran out before the key up
+    // Returns the lease from the renewal interval statistics
+    uint32_t value(void)
+    {
+      uint32_t lease = mean + 4 * dev;
+
+      if(lease < LeaseMin) lease = LeaseMin;
+      if(lease > LeaseMax) lease = LeaseMax;
+      return lease;
+    }
+    // A key down was applied
+    void start(uint32_t now)
+    {
+      last = now;
+      lapsed = false;
+    }
+    // Measures the interval since the key down or last renewal, call on each R while
+    // the key is down. Returns the new lease.
+    uint32_t renew(uint32_t now)
+    {
+      uint32_t gap = now - last;
+
+      last = now;
+      if(renewals++ == 0)
+      {
+        mean = gap;
+        dev = gap / 2;
+      }
+      else
+      {
+        uint32_t err = (gap > mean) ? gap - mean : mean - gap;
+        mean = mean - (mean >> 3) + (gap >> 3);
+        dev = dev - (dev >> 2) + (err >> 2);
+      }
+      return value();
+    }
+    // The watchdog dropped the key. Returns true with the new lease in lease if the
+    // renewal statistics changed it.
+    bool expired(uint32_t &lease)
+    {
+      lapsed = true;
+      if(renewals == 0) return false;
+      dev *= 2;
+      lease = value();
+      return true;
+    }
+    void reset(void)
+    {
+      mean = dev = 0;
+      renewals = 0;
+      lapsed = false;
+    }
+};
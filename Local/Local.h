@@ -1,5 +1,11 @@
 #pragma once
 
+#include "Messages.h"
+#include "Recorder.h"
+#include "LoopStats.h"
+#include "Auth.h"
+#include "RxBatch.h"
+
 #define SIGNATURE  0xAA55A5A5
 
 typedef struct
@@ -11,6 +17,7 @@ typedef struct
   byte          IP[4];             // IP address 
   int           tcpPort;
   int           udpPort;
+  int           recordPort;        // Session recorder, see Recorder.h
   // Link test parameters
   bool          linkTesting;
   float         mean;              // Defined by remote system
@@ -20,10 +27,29 @@ typedef struct
   int           missedPackets;
   // Keyer parameters
   int           wpm;               // Code speed, words per minute
+  int           weight;            // Mark/space weight in percent, 50 is standard
+  int           ratio;             // Dah/dit ratio in tenths, 30 is standard
+  int           farnsworth;        // Farnsworth character speed in WPM, 0 is off
+  bool          decode;            // Stream decoded transmit text to the TCP client
+  // PTT sequencer, times in mS
+  bool          ptt;               // Sequence the PTT output ahead of the key
+  int           pttLead;           // PTT to first key down
+  int           pttTail;           // Key up to PTT release, minimum
+  int           pttHang;           // Key up time before PTT is released
+  // UDP authentication
+  bool          auth;              // Drop UDP messages without a valid tag
+  uint8_t       authKey[AuthKeySize];
+  // UDP receive batches
+  int           coalesce;          // Superseded key downs and ups, see RxBatch.h
+  int           replayMax;         // Longest replay in mS
+  // Memory keyer
+  char          Message[MaxMessages][MessageSize];
   int           Signature;         // Must be 0xAA55A5A5 for valid data
 } LocalData;
 
 extern LocalData ld;
+extern Recorder recorder;
+extern LoopStats loopStats;
 
 // Prototypes
 void Software_Reset(void);
@@ -40,3 +66,56 @@ void LinkStatus(void);
 void ConnectStatus(void);
 void SetIP(char *ipadd);
 void GetIP(void);
+void Yield(void);
+void GetTasks(void);
+void ResetTasks(void);
+void SetWeight(int weight);
+void SetRatio(int ratio);
+void SetFarnsworth(int farnsworth);
+void CWSend(void);
+void CWStop(void);
+void CWRemaining(void);
+void CWGetCredits(void);
+void DecoderWPM(void);
+void RecordStats(void);
+void GetLease(void);
+void GetProfile(void);
+void GetLoop(void);
+void ResetLoop(void);
+void ResetProfile(void);
+void GetAlloc(void);
+void ResetAlloc(void);
+void SetAllocTest(char *state);
+void GetAllocTest(void);
+void RxStats(void);
+void Session(int id, int seq);
+void GetSession(void);
+void ResetRxStats(void);
+void SetPTT(char *state);
+void SetPTTLead(int ms);
+void SetPTTTail(int ms);
+void SetPTTHang(int ms);
+void PTTStats(void);
+void ResetPTTStats(void);
+void SetAuthKey(char *first, char *second);
+void SetCoalesce(char *policy);
+void GetCoalesce(void);
+void SetReplayMax(int ms);
+void BatchStats(void);
+void ResetBatchStats(void);
+void AuthStats(void);
+void ResetAuthStats(void);
+void AuthBenchmark(void);
+void SetMessage(void);
+void GetMessage(int slot);
+void PlayMessage(int slot);
+void UDPMessage(char *buf, int num, RxMessage *m);
+bool SeqAccept(uint8_t seq, RxMessage *m);
+void LateKeyDown(uint8_t seq, RxMessage *m);
+void CharFrame(uint8_t *frame);
+void CWCredits(RxMessage *m);
+void CWAbort(void);
+void StartMessage(int slot);
+void StopMessage(void);
+void LeaseRenew(void);
+void CompileMessages(void);
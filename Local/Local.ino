@@ -24,10 +24,15 @@
  *    - Accepts UDP and TCP connections from the remote controller
  *    - Processes key up and down as well as paddle messages to key the transmitter
  *    - Link performance testing 
- *    - Fail safe max key down limits
+ *    - Session recording of every message received from the remote on its own TCP port,
+ *      SRECPRT, for replay with Linux/keylog
+ *    - Fail safe key down lease that follows the link jitter
+ *    - Optional SipHash tag on every UDP message with replay rejection, SAUTHKEY and SAUTH
+ *    - PTT sequencing with lead, tail and hang times for an amplifier or T/R relay
  *    - Auxiliary control outputs
  *    - USB powered
  *    - USB host interface commands to configure and save settings
+ *    - Binary framed host protocol with multi get, multi set and watch, see HostFrame.h
  *
  * The access point at the local location needs to be configured to forward the UDP and TCP ports to 
  * the IP address if the Local controller. The Local controller should also be assigned a fixed IP 
@@ -37,11 +42,15 @@
  * UDP message format
  *    D = key down
  *    U = key up
- *    . = generate a dit and space, dit function will block
- *    - = generate a dash and space, dash function will block
+ *    . = queue a dit and space
+ *    - = queue a dash and space
  *    W,xxx = speed in words per minute
+ *    W,xxx,www,rrr,fff = speed, weight in %, dah/dit ratio in tenths, Farnsworth character speed
  *    T,ddd,xxx = link test. ddd = message space in mS, xxx = sample size
- *    S,string = Send string, this function will block
+ *    S,string = Append string to the CW text queue, replies C,credits,remaining
+ *    A = abort CW text sending and clear the queue
+ *    Q = query the CW text queue, replies C,credits,remaining
+ *    M,n = play memory keyer message n, 1 to 4
  *    
  *  To do list:
  * 
@@ -62,6 +71,20 @@
 #include "Serial.h"
 #include "Errors.h"
 #include "Local.h"
+#include "Scheduler.h"
+#include "CWText.h"
+#include "Decoder.h"
+#include "Recorder.h"
+#include "Response.h"
+#include "SeqWindow.h"
+#include "Lease.h"
+#include "RxBatch.h"
+#include "HostFrame.h"
+#include "Profiler.h"
+#include "AllocTrack.h"
+#include "LoopStats.h"
+#include "PTT.h"
+#include "Auth.h"
 #include <FlashStorage.h>
 
 LocalData ld;
@@ -75,10 +98,20 @@ LocalData Rev_1_ld =
   10,0,0,200,
   2015,
   2015,
+  2016,
   // Link test parameters
   false,0,0,0,0,0,
   // Keyer parameters
-  19,
+  19,50,30,0,
+  false,
+  // PTT sequencer
+  false,25,15,500,
+  // UDP authentication
+  false,{0},
+  // UDP receive batches
+  CoalesceReplay,500,
+  // Memory keyer
+  {"CQ CQ CQ DE KG7YU KG7YU K", "TU 5NN", "", ""},
   SIGNATURE
 };
 
@@ -91,7 +124,58 @@ const char *Version = "KeyLocal Version 1.0, November 5, 2021";
 
 auto timer = timer_create_default();
 
-Morse morse;
+Scheduler scheduler;
+
+// Loop period histogram, overrun budget in uS
+LoopStats loopStats(1000);
+
+// Transmitter key output, pin 13 active high
+Morse<13, true> morse;
+
+// Amplifier or T/R relay PTT output, pin 12 active high
+PTT<12, true> ptt;
+
+// Text waiting to be sent in CW and the state of the text parser
+CWText cwtext;
+bool   cwProsign     = false;
+bool   cwSpeedChange = false;
+bool   cwStreamSpeed = false;
+bool   cwQueued      = false;       // CW text is in the Morse element queue
+int    cwSpeed;
+
+// Compiled memory keyer messages and the playback state, msgSlot is -1 when no
+// message is playing
+Message messages[MaxMessages];
+int     msgSlot  = -1;
+int     msgIndex = 0;
+
+// Decodes the transmitted keying so the Remote can see what went out
+Decoder decoder;
+// Each DEC line is staged and sent in one write
+Response decodeOut;
+
+// Records the messages received from the Remote for replay on the host
+Recorder recorder;
+
+// UDP message authentication, see Auth.h
+Auth udpAuth;
+
+// Receive window over the key event sequence numbers
+SeqWindow     rxWindow;
+RxBatch       rxBatch;
+unsigned long acksSent = 0;
+// The last key up applied, with its Remote event time, for a late key down
+bool          upTimed = false;
+uint8_t       upSeqNr;
+uint32_t      upTime;
+unsigned long lateMarks = 0;
+
+// Remote session, a reconnect with the same id resumes it
+int           sessionId = 0;
+unsigned long sessionResumes = 0;
+
+// Key down lease, see Lease.h
+Lease         lease;
 
 unsigned long nowT;
 unsigned long lastT;
@@ -107,178 +191,601 @@ EthernetServer server(2015);
 //EthernetServer *server;
 
 // buffers for receiving and sending data
-char packetBuffer[UDP_TX_PACKET_MAX_SIZE];       // buffer to hold incoming packet
 char ReplyBuffer[UDP_TX_PACKET_MAX_SIZE];        // buffer for outgoing messages
 
 EthernetUDP Udp;
 
 EthernetClient client;
 
-// This function process all the serial IO and commands
-void ProcessSerial(bool scan = true)
+// Session recorder, a port of its own so keylog never takes the command
+// connection from the Remote
+EthernetServer recordServer(2016);
+EthernetClient recordClient;
+
+// This function process all the serial IO and commands. Command processing stops
+// when the calling task has used its time budget, the rest is done on the next pass.
+// Returns true if there was something to do.
+bool ProcessSerial(bool scan = true)
 {
+  bool busy = false;
+
 // Process data from tcp connection  
   if(client.connected()) 
   {
     if(client.available())
     {
       //serial->println(client.read());
-      PutCh(client.read());
+      HostInput(client.read(), &client);
       serial = &client;
+      busy = true;
+    }
+    // A Remote that lost its link reconnects before this end sees the old
+    // connection close, the new connection takes over
+    EthernetClient newClient = server.available();
+    if(newClient && (newClient != client))
+    {
+      client.stop();
+      client = newClient;
     }
   } else if(server.available()) client = server.available();
 // Put serial received characters in the input ring buffer
   if (Serial.available() > 0)
   {
-    PutCh(Serial.read());
+    HostInput(Serial.read(), &Serial);
     serial = &Serial;
+    busy = true;
   }
-  if (!scan) return;
+  if (!scan) return busy;
   // If there is a command in the input ring buffer, process it!
-  if (RB_Commands(&RB) > 0) while (ProcessCommand() == 0); // Process until flag that there is nothing to do
+  if (RB_Commands(&RB) > 0) while (ProcessCommand() == 0) // Process until flag that there is nothing to do
+  {
+    busy = true;
+    if(scheduler.expired()) break;
+  }
+  return busy;
 }
 
 /*
  * UDP message format
- *    D = key down
- *    U = key up
- *    . = generate a dit and space, dit function will block
- *    - = generate a dash and space, dash function will block
+ *    D = key down, binary bytes after the D: seq, time the Remote keyed it in uS
+ *        (4 bytes, little endian). The time is optional, see RxBatch.h
+ *    U = key up, as D
+ *    . = queue a dit and space
+ *    - = queue a dash and space
  *    W,xxx = speed in words per minute
+ *    W,xxx,www,rrr,fff = speed, weight in %, dah/dit ratio in tenths, Farnsworth character speed
  *    T,ddd,xxx = link test. ddd = message space in mS, xxx = sample size
- *    S,string = Send string, this function will block
+ *    S,string = Append string to the CW text queue, replies C,credits,remaining
+ *    A = abort CW text sending and clear the queue
+ *    Q = query the CW text queue, replies C,credits,remaining
+ *    M,n = play memory keyer message n, 1 to 4
+ *    R = renew the key down lease, the sequence number is that of the key down
+ *    E = character frame, binary bytes after the E: seq, character number, element
+ *        count, element bits (1 = dah, first element in bit 0), wpm, weight, ratio
+ *
+ * D, U, ., - and E carry a sequence number and are acknowledged with a 4 byte binary
+ * reply, K, highest sequence number, bitmap of the 16 before it (low byte first).
+ * Events older than the highest received are acknowledged but not played. A key
+ * down the Remote sent again after its key up got through is played late as a mark
+ * of the length it was keyed, see LateKeyDown.
  * 
+ * A key down, dit or dash from the remote stops a message or CW text that is
+ * playing. A key down waits for the elements already queued, see Morse::KeyDown.
+ * A key down is dropped one lease time after the last R renewal, an R that arrives
+ * later for the same key down keys it again, see Lease.h.
+ *
+ * Up to RxBatchSize waiting datagrams are read in one pass and the key events are
+ * put in sequence order, a run of key downs and ups is replayed with the timing the
+ * Remote keyed it with, see RxBatch.h.
  */
-void ProcessUDP(char *buffer = NULL)
+bool ProcessUDP(char *buffer = NULL)
 {
-  char    *buf = NULL;
-  uint8_t SeqNr;
-  static  uint8_t LastSeqNr = 0;
-  static  String token;
-  static  int Ssize=0,Csample=0;
-  static  float e;
   int num;
 
-  buf = buffer;
-  if(buf != NULL) num = strlen(buf);
-  if(buf == NULL) if (num=Udp.parsePacket()) 
+  PROFILE_ZONE("ProcessUDP");
+  ALLOC_GUARD("ProcessUDP");
+
+  // From the serial port, applied as it is
+  if(buffer != NULL)
   {
-    // read the packet into packetBufffer
-    Udp.read(packetBuffer, UDP_TX_PACKET_MAX_SIZE);
-    buf = packetBuffer;
+    UDPMessage(buffer, strlen(buffer), NULL);
+    return true;
   }
-  if (buf != NULL) 
+  // At most one batch of datagrams is read per pass, rejected ones included, so a
+  // flood cannot hold this task. The batch starts with the messages held over.
+  rxBatch.clear();
+  for(int reads = rxBatch.count; reads < RxBatchSize; reads++)
   {
-    nowT = millis();
-    switch (buf[0])
     {
-      case 'D':
-        if(num>=2)
-        {
-           if(LastSeqNr == buf[1]) break;
-           morse.KeyDown();
-           SeqNr = buf[1];
-           if(++LastSeqNr != SeqNr) {Serial.print("SeqNr error D! "); Serial.println(SeqNr);} 
-           LastSeqNr = SeqNr;
-        }
-        else morse.KeyDown();
-        break;
-      case 'U':
-        if(num>=2)
-        {
-           if(LastSeqNr == buf[1]) break;
-           morse.KeyUp();
-           SeqNr = buf[1];
-           if(++LastSeqNr != SeqNr) {Serial.print("SeqNr error U! "); Serial.println(SeqNr);}
-           LastSeqNr = SeqNr;
-        }
-        else morse.KeyUp();
-        break;
-      case '.':
-        if(num>=2)
-        {
-           if(LastSeqNr == buf[1]) break;
-           morse.Dit();
-           SeqNr = buf[1];
-           if(++LastSeqNr != SeqNr) {Serial.print("SeqNr error Dit! "); Serial.println(SeqNr);}
-           LastSeqNr = SeqNr;
-        }
-        else morse.Dit();
-        break;
-      case '-':
-        if(num>=2)
-        {
-           if(LastSeqNr == buf[1]) break;
-           morse.Dash();
-           SeqNr = buf[1];
-           if(++LastSeqNr != SeqNr) {Serial.print("SeqNr error Dash! "); Serial.println(SeqNr);}
-           LastSeqNr = SeqNr;
-        }
-        else morse.Dash();
+      PROFILE_ZONE("parsePacket");
+      num = Udp.parsePacket();
+    }
+    if(num <= 0) break;
+    uint32_t arrival = micros();
+    RxMessage &m = rxBatch.next();
+    m.IP = Udp.remoteIP();
+    m.Port = Udp.remotePort();
+    Udp.read(m.Buf, RxMessageSize - 1);
+    if(num >= RxMessageSize) num = RxMessageSize - 1;
+    m.Buf[num] = 0;
+    // Drop messages without a valid tag, the tag is removed from the rest
+    if(ld.auth && !udpAuth.verify((uint8_t *)m.Buf, num)) continue;
+    m.Len = num;
+    recorder.record(m.Buf, num, arrival);
+    rxBatch.add();
+  }
+  // Only messages that passed authentication count as work
+  if(rxBatch.count == 0) return false;
+  // A message or CW text is stopped by the key events, it is not part of the backlog
+  uint32_t queued = ((msgSlot >= 0) || cwQueued) ? 0 : morse.queuedTime();
+  rxBatch.plan(rxWindow, ld.coalesce, ld.replayMax * 1000UL, morse.space(), queued);
+  if(rxBatch.queuedFit < queued) morse.fit(rxBatch.queuedFit);
+  for(int i = 0; i < rxBatch.count - rxBatch.held; i++) UDPMessage(rxBatch.messages[i].Buf, rxBatch.messages[i].Len, &rxBatch.messages[i]);
+  return true;
+}
+
+// Applies one message, m is NULL for a message from the serial port and otherwise
+// carries the action RxBatch planned for a key down or up
+void UDPMessage(char *buf, int num, RxMessage *m)
+{
+  char    token[12];
+  bool    net = (m != NULL);
+  static  int Ssize=0,Csample=0;
+  static  float e;
+
+  nowT = millis();
+  // The operator touched the key, stop the memory keyer and CW text so live keying
+  // is not held behind them. strchr also finds the terminator, a leading 0 is not a
+  // key event.
+  if((buf[0] != 0) && (strchr("D.-E", buf[0]) != NULL))
+  {
+    StopMessage();
+    if(cwQueued) CWAbort();
+  }
+  switch (buf[0])
+  {
+    case 'D':
+      if((num>=2) && !SeqAccept(buf[1], m))
+      {
+        if(net && rxWindow.late) LateKeyDown(buf[1], m);
         break;
-      case 'p':
-        // Link keep alive, do nothing
+      }
+      // A late key down must not play behind a later one
+      upTimed = false;
+      if(net && (m->Action == RxDrop)) break;
+      if(net && (m->Action == RxQueue))
+      {
+        morse.queue(m->Mark, m->Space);
         break;
-      case 'W':
-        // Get the token after the W, its the speed value
-        token = GetToken(buf,2);
-        if(token != "")
-        {
-          int i = token.toInt();
-          if((i>=minWPM)&&(i<=maxWPM)) morse.wpm(ld.wpm = i);
-        }
+      }
+      morse.KeyDown();
+      lease.start(micros());
+      break;
+    case 'R':
+      // Only renews the key down that is still current
+      if((num>=2) && ((uint8_t)buf[1] == rxWindow.high)) LeaseRenew();
+      break;
+    case 'U':
+      if((num>=2) && !SeqAccept(buf[1], m)) break;
+      if(net && (m->Action == RxDrop)) break;
+      morse.KeyUp();
+      upTimed = net && m->Timed;
+      if(upTimed)
+      {
+        upSeqNr = buf[1];
+        upTime = m->Time;
+      }
+      break;
+    case '.':
+      if((num>=2) && !SeqAccept(buf[1], m)) break;
+      morse.Dit();
+      break;
+    case '-':
+      if((num>=2) && !SeqAccept(buf[1], m)) break;
+      morse.Dash();
+      break;
+    case 'E':
+      if((num>=8) && SeqAccept(buf[1], m)) CharFrame((uint8_t *)buf);
+      break;
+    case 'p':
+      // Link keep alive, do nothing
+      break;
+    case 'W':
+      // Get the token after the W, its the speed value
+      if(GetToken(buf,2,token,sizeof(token))[0] != 0)
+      {
+        int i = atoi(token);
+        if((i>=minWPM)&&(i<=maxWPM)) ld.wpm = i;
+        // Optional weight, ratio and Farnsworth speed
+        if(GetToken(buf,3,token,sizeof(token))[0] != 0) ld.weight = atoi(token);
+        if(GetToken(buf,4,token,sizeof(token))[0] != 0) ld.ratio = atoi(token);
+        if(GetToken(buf,5,token,sizeof(token))[0] != 0) ld.farnsworth = atoi(token);
+        morse.wpm(ld.wpm, ld.weight, ld.ratio, ld.farnsworth);
+      }
+      break;
+    case 'T': // Used for link testing, parameters are spacing in mS, sample size.
+              // Sending T with no parameters will terminate a link test.
+      if(GetToken(buf,2,token,sizeof(token))[0] == 0) { ld.linkTesting = false; break; }
+      ld.mean = atof(token);
+      if(GetToken(buf,3,token,sizeof(token))[0] == 0) break;
+      Ssize = atoi(token);
+      Csample = -2;
+      ld.minError = ld.maxError = ld.sd = 0;
+      ld.missedPackets = 0;
+      ld.linkTesting = true;
+     break;
+    case 't': // Used for the link test, calculates the link performance, i.e. the following parameters
+              // min error, max error, sd, missed packets. This message type is ignored if not test is in
+              // process.
+      if(~ld.linkTesting) break;
+      if(Ssize == 0) break;
+      if(Csample++ >= 0)
+      {
+        e = (nowT - lastT) - ld.mean;
+        while(e > ld.mean) { ld.missedPackets++; e -= ld.mean; }
+        if(e < ld.minError) ld.minError = e;
+        if(e > ld.maxError) ld.maxError = e;
+        ld.sd += e * e;
+      }
+      if(Ssize == Csample)
+      {
+        ld.sd = sqrt(e / Ssize);
+        Ssize = Csample = 0;
+        ld.linkTesting = false;
+      }
+      break;
+    case 'S':
+      // A comman should follow the S, if so queue what remains
+      if(buf[1] == ',') cwtext.append(&buf[2]);
+      if(net) CWCredits(m);
+      break;
+    case 'A':
+      CWAbort();
+      StopMessage();
+      break;
+    case 'M':
+      if(GetToken(buf,2,token,sizeof(token))[0] != 0) StartMessage(atoi(token) - 1);
+      break;
+    case 'Q':
+      if(net) CWCredits(m);
+      break;
+    default:
+      serial->print(buf);
+      serial->print(", ");
+      serial->println(nowT - lastT);
+      break;
+  }
+  lastT = nowT;
+}
+
+// Character frames from the Remote. Each frame lists the elements of the character
+// so far, the ones not yet queued are queued and timed here, so a lost or late
+// frame is bridged by the next one and jitter within a character does not reach
+// the transmitter.
+uint8_t frameChar = 0;
+uint8_t frameQueued = 0;
+
+void CharFrame(uint8_t *frame)
+{
+  uint8_t count = frame[3];
+  uint8_t bits = frame[4];
+
+  if((frame[5] != ld.wpm) || (frame[6] != ld.weight) || (frame[7] != ld.ratio))
+  {
+    if((frame[5] >= minWPM) && (frame[5] <= maxWPM)) ld.wpm = frame[5];
+    ld.weight = frame[6];
+    ld.ratio = frame[7];
+    morse.wpm(ld.wpm, ld.weight, ld.ratio, ld.farnsworth);
+  }
+  if(frame[2] != frameChar)
+  {
+    frameChar = frame[2];
+    frameQueued = 0;
+  }
+  if(count > 8) count = 8;
+  for(; frameQueued < count; frameQueued++)
+  {
+    if(bits & (1 << frameQueued)) morse.Dash();
+    else morse.Dit();
+  }
+}
+
+// Passes a key event sequence number through the receive window and, for events
+// from the network, acknowledges it to the sender of m. Duplicates are acknowledged
+// too in case the first acknowledgement was lost. Returns true if the event is to be
+// played.
+bool SeqAccept(uint8_t seq, RxMessage *m)
+{
+  bool play = rxWindow.accept(seq);
+
+  if(m == NULL) return play;
+  Udp.beginPacket(m->IP, m->Port);
+  Udp.write('K');
+  Udp.write(rxWindow.high);
+  Udp.write(rxWindow.mask & 0xFF);
+  Udp.write(rxWindow.mask >> 8);
+  {
+    PROFILE_ZONE("endPacket");
+    Udp.endPacket();
+  }
+  acksSent++;
+  return play;
+}
+
+// A key down arrived after the key up that followed it, it was lost and sent again.
+// The key up was applied with the key already up, so the mark never went out. It is
+// queued now with the length the Remote keyed, from the two event times.
+void LateKeyDown(uint8_t seq, RxMessage *m)
+{
+  if(!upTimed || !m->Timed || ((uint8_t)(seq + 1) != upSeqNr)) return;
+  uint32_t mark = upTime - m->Time;
+  if((mark == 0) || (mark > LeaseMax)) return;
+  upTimed = false;
+  morse.queue(mark, morse.getTiming().Element);
+  lateMarks++;
+}
+
+// Sends the CW text queue credits and remaining count to the sender of m
+void CWCredits(RxMessage *m)
+{
+  sprintf(ReplyBuffer, "C,%d,%d", cwtext.credits(), cwtext.remaining());
+  Udp.beginPacket(m->IP, m->Port);
+  Udp.write(ReplyBuffer);
+  Udp.endPacket();
+}
+
+// Stops CW text sending and restores the saved speed
+void CWAbort(void)
+{
+  cwtext.abort();
+  morse.abort();
+  cwProsign = cwSpeedChange = cwQueued = false;
+  if(cwStreamSpeed) morse.wpm(ld.wpm, ld.weight, ld.ratio, ld.farnsworth);
+  cwStreamSpeed = false;
+}
+
+// Starts playing a memory keyer message, slot is 0 based
+void StartMessage(int slot)
+{
+  if((slot < 0) || (slot >= MaxMessages)) return;
+  if(messages[slot].size() == 0) return;
+  morse.abort();
+  msgSlot = slot;
+  msgIndex = 0;
+}
+
+void StopMessage(void)
+{
+  if(msgSlot < 0) return;
+  msgSlot = -1;
+  morse.abort();
+}
+
+// Moves compiled message elements to the Morse element queue, durations come from
+// the current timing table
+void MessageFeed(void)
+{
+  Timing &t = morse.getTiming();
+
+  while((morse.space() > 0) && (msgIndex < messages[msgSlot].size()))
+  {
+    uint8_t  code = messages[msgSlot].code(msgIndex++);
+    uint32_t mark = 0, space = t.Element;
+    if((code & MarkMask) == MarkDit) mark = t.Dit;
+    if((code & MarkMask) == MarkDah) mark = t.Dah;
+    switch (code & SpaceMask)
+    {
+      case SpaceChar: space = t.Character; break;
+      case SpaceWord: space = t.Word - t.Character; break;
+      case SpaceProsign: space = t.Character - t.Element; break;
+    }
+    morse.queue(mark, space);
+  }
+  if(msgIndex >= messages[msgSlot].size()) msgSlot = -1;
+}
+
+// Moves characters from the text queue to the Morse element queue while there is
+// room for a full character, handles prosign brackets and speed changes.
+void CWFeed(void)
+{
+  int c;
+
+  // A memory keyer message goes first, the text queue waits
+  if(msgSlot >= 0)
+  {
+    MessageFeed();
+    return;
+  }
+  while(morse.space() >= 8)
+  {
+    if((c = cwtext.get()) == -1) break;
+    if(cwSpeedChange)
+    {
+      if(isdigit(c)) { cwSpeed = cwSpeed * 10 + c - '0'; continue; }
+      cwSpeedChange = false;
+      if((c == '}') && (cwSpeed >= minWPM) && (cwSpeed <= maxWPM))
+      {
+        morse.wpm(cwSpeed);
+        cwStreamSpeed = true;
+      }
+      continue;
+    }
+    switch (c)
+    {
+      case '<':
+        cwProsign = true;
         break;
-      case 'T': // Used for link testing, parameters are spacing in mS, sample size.
-                // Sending T with no parameters will terminate a link test.
-        token = GetToken(buf,2);
-        if(token == "") { ld.linkTesting = false; break; }
-        ld.mean = token.toFloat();
-        token = GetToken(buf,3);
-        if(token == "") break;
-        Ssize = token.toInt();
-        Csample = -2;
-        ld.minError = ld.maxError = ld.sd = 0;
-        ld.missedPackets = 0;
-        ld.linkTesting = true;
-       break;
-      case 't': // Used for the link test, calculates the link performance, i.e. the following parameters
-                // min error, max error, sd, missed packets. This message type is ignored if not test is in
-                // process.
-        if(~ld.linkTesting) break;
-        if(Ssize == 0) break;
-        if(Csample++ >= 0)
-        {
-          e = (nowT - lastT) - ld.mean;
-          while(e > ld.mean) { ld.missedPackets++; e -= ld.mean; }
-          if(e < ld.minError) ld.minError = e;
-          if(e > ld.maxError) ld.maxError = e;
-          ld.sd += e * e;
-        }
-        if(Ssize == Csample)
-        {
-          ld.sd = sqrt(e / Ssize);
-          Ssize = Csample = 0;
-          ld.linkTesting = false;
-        }
+      case '>':
+        if(cwProsign) morse.EndProsign();
+        cwProsign = false;
         break;
-      case 'S':
-        // A comman should follow the S, if so send what remains
-        if(buf[1] == ',') morse.SendMorseString(&buf[2]);
+      case '{':
+        cwSpeedChange = true;
+        cwSpeed = 0;
         break;
       default:
-        serial->print(buf);
-        serial->print(", ");
-        serial->println(nowT - lastT);
+        morse.SendMorseChar(c, !cwProsign);
+        cwQueued = true;
         break;
     }
-    lastT = nowT;
-  }  
+  }
+  // Back to the saved speed once the stream has been sent
+  if((cwtext.remaining() == 0) && !morse.busy())
+  {
+    if(cwStreamSpeed) morse.wpm(ld.wpm, ld.weight, ld.ratio, ld.farnsworth);
+    cwStreamSpeed = cwQueued = false;
+  }
 }
 
-bool timerProcessSerial(void *)
+// Key edge call backs from the Morse output, feed the decoder and the PTT sequencer
+void DecodeKeyDown(void)
 {
-  ProcessSerial();
-  return true;
+  decoder.edge(true, micros());
+  ptt.key(true);
+}
+
+void DecodeKeyUp(void)
+{
+  decoder.edge(false, micros());
+  ptt.key(false);
+}
+
+// Morse ready call back, holds the key up until PTT has been up for the lead time
+bool PTTReady(void)
+{
+  return ptt.ready();
+}
+
+// Loads the PTT sequencer from the settings
+void PTTSettings(void)
+{
+  ptt.lead = ld.pttLead * 1000UL;
+  ptt.tail = ld.pttTail * 1000UL;
+  ptt.hang = ld.pttHang * 1000UL;
+  ptt.enabled = ld.ptt;
+  if(!ptt.enabled) ptt.release();
+}
+
+// Sends decoded characters to the TCP client as
+// DEC,text,confidence,confidence...
+// with one 0 to 100 confidence value per character. A line is at most 6 + 5 *
+// DecodeLine bytes so it fits the staging buffer and goes out in one write, the
+// characters after it wait for the next call.
+#define DecodeLine  ((ResponseSize - 6) / 5)
+void SendDecoded(void)
+{
+  Decoded d;
+  char    text[DecodeLine + 1];
+  uint8_t conf[DecodeLine];
+  int     n = 0;
+
+  decoder.poll(micros());
+  while((n < DecodeLine) && decoder.get(d))
+  {
+    text[n] = d.Char;
+    conf[n++] = d.Confidence;
+  }
+  if((n == 0) || !ld.decode || !client.connected()) return;
+  text[n] = 0;
+  decodeOut.attach(&client);
+  decodeOut.print("DEC,");
+  decodeOut.print(text);
+  for(int i = 0; i < n; i++)
+  {
+    decodeOut.print(",");
+    decodeOut.print(conf[i]);
+  }
+  decodeOut.println();
+  decodeOut.flush();
+}
+
+// Called on each R message for the latest key down. Intervals are only measured
+// while the key is down. An R after the lease ran out means the Remote is still
+// holding the key, it is keyed again.
+void LeaseRenew(void)
+{
+  uint32_t now = micros();
+
+  if(!morse.keyed())
+  {
+    if(!lease.lapsed) return;
+    lease.rekeys++;
+    morse.KeyDown();
+    lease.start(now);
+    return;
+  }
+  morse.lease(lease.renew(now));
+  morse.renew();
+}
+
+// Scheduler tasks
+
+bool taskCW(void)
+{
+  ptt.lookAhead(morse.ahead());
+  morse.process();
+  CWFeed();
+  ptt.process(morse.busy());
+  return false;
+}
+
+bool taskUDP(void)
+{
+  return ProcessUDP();
+}
+
+bool taskWatchdog(void)
+{
+  uint32_t us;
+
+  if(morse.check() && lease.expired(us)) morse.lease(us);
+  return false;
+}
+
+bool taskSerial(void)
+{
+  return ProcessSerial();
+}
+
+// Streams the recorded messages to the record port client, a new connection
+// replaces the old one
+bool taskRecord(void)
+{
+  EthernetClient newClient = recordServer.available();
+  if(newClient && (newClient != recordClient))
+  {
+    recordClient.stop();
+    recordClient = newClient;
+    recorder.clear();
+  }
+  recorder.active = recordClient.connected();
+  if(!recorder.active)
+  {
+    recorder.clear();
+    return false;
+  }
+  // Nothing is read from the record port, drop anything sent to it
+  while(recordClient.available()) recordClient.read();
+  return recorder.flush(&recordClient);
+}
+
+bool taskDecode(void)
+{
+  SendDecoded();
+  return false;
+}
+
+bool taskHost(void)
+{
+  HostPoll();
+  return false;
+}
+
+bool taskTimer(void)
+{
+  PROFILE_ZONE("timer.tick");
+  timer.tick();
+  return false;
 }
 
 void setup()
@@ -293,7 +800,17 @@ void setup()
   //digitalWrite(13,HIGH);
   ip = ld.IP;
   server = EthernetServer(ld.tcpPort);
-  morse.begin(13,true);  
+  recordServer = EthernetServer(ld.recordPort);
+  morse.begin();
+  morse.wpm(ld.wpm, ld.weight, ld.ratio, ld.farnsworth);
+  morse.attachKeyDown(DecodeKeyDown);
+  morse.attachKeyUp(DecodeKeyUp);
+  morse.attachReady(PTTReady);
+  udpAuth.setKey(ld.authKey);
+  ptt.begin();
+  PTTSettings();
+  decoder.begin(morse.getTiming().Dit);
+  CompileMessages();
   // You can use Ethernet.init(pin) to configure the CS pin
   Ethernet.init(10);  // Most Arduino shields
   // start the Ethernet connection and the server:
@@ -310,15 +827,27 @@ void setup()
   Udp.begin(ld.udpPort);
   // start the server
   server.begin();
-  timer.every(10, timerProcessSerial);
+  recordServer.begin();
+  // UDP drain and key output first, the keying watchdog every mS, both on every
+  // pass. Command parsing and the timer driven status work run in the background.
+  scheduler.add("UDP", taskUDP, PriorityKeying);
+  scheduler.add("CW", taskCW, PriorityKeying);
+  scheduler.add("Watchdog", taskWatchdog, PriorityWatchdog, 1000);
+  scheduler.add("Serial", taskSerial, PriorityBackground, 0, 2000);
+  scheduler.add("Timer", taskTimer, PriorityBackground, 0, 1000);
+  scheduler.add("Decode", taskDecode, PriorityBackground, 5000, 1000);
+  scheduler.add("Record", taskRecord, PriorityBackground, 10000, 1000);
+  scheduler.add("Host", taskHost, PriorityBackground, WatchPeriod * 1000, 1000);
+#ifdef ALLOC_TRACKING
+  allocTrack.arm();
+#endif
 }
 
 // Main processing loop.
 void loop(void)
 {
-  timer.tick();
-  ProcessUDP();
-  morse.check();
+  scheduler.run();
+  loopStats.tick(scheduler.longest());
 }
 
 // Host commands
@@ -341,7 +870,13 @@ void RestoreSettings(void)
   
   // Read the flash config contents and test the signature
   ldata = flash_ld.read();
-  if(ldata.Signature == SIGNATURE) ld = ldata;
+  if(ldata.Signature == SIGNATURE)
+  {
+    ld = ldata;
+    CompileMessages();
+    PTTSettings();
+    udpAuth.setKey(ld.authKey);
+  }
   else
   {
     SetErrorCode(ERR_EEPROMWRITE);
@@ -353,13 +888,10 @@ void RestoreSettings(void)
 
 void SetPortDir(char *port, char *mode)
 {
-  String Token;
+  int prt = atoi(port);
 
-  Token = port;
-  int prt = Token.toInt();
-  Token = mode;
-  if(Token == "INPUT") pinMode(prt,INPUT_PULLUP);
-  else if(Token == "OUTPUT") pinMode(prt,OUTPUT);
+  if(strcmp(mode,"INPUT") == 0) pinMode(prt,INPUT_PULLUP);
+  else if(strcmp(mode,"OUTPUT") == 0) pinMode(prt,OUTPUT);
   else
   {
     SetErrorCode(ERR_BADARG);
@@ -371,13 +903,10 @@ void SetPortDir(char *port, char *mode)
 
 void SetPort(char *port, char *state)
 {
-  String Token;
+  int prt = atoi(port);
 
-  Token = port;
-  int prt = Token.toInt();
-  Token = state;
-  if(Token == "HIGH") digitalWrite(prt,HIGH);
-  else if(Token == "LOW") digitalWrite(prt,LOW);
+  if(strcmp(state,"HIGH") == 0) digitalWrite(prt,HIGH);
+  else if(strcmp(state,"LOW") == 0) digitalWrite(prt,LOW);
   else
   {
     SetErrorCode(ERR_BADARG);
@@ -402,24 +931,65 @@ void SetWPM(int wpm)
     SendNAK;
     return;    
   }
-  morse.wpm(wpm);
+  morse.wpm(ld.wpm = wpm);
+  SendACK;
+}
+
+void SetWeight(int weight)
+{
+  if((weight < minWeight) || (weight > maxWeight))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;    
+  }
+  ld.weight = weight;
+  morse.wpm(ld.wpm, ld.weight, ld.ratio, ld.farnsworth);
+  SendACK;
+}
+
+void SetRatio(int ratio)
+{
+  if((ratio < minRatio) || (ratio > maxRatio))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;    
+  }
+  ld.ratio = ratio;
+  morse.wpm(ld.wpm, ld.weight, ld.ratio, ld.farnsworth);
+  SendACK;
+}
+
+// Farnsworth character speed, 0 turns Farnsworth timing off
+void SetFarnsworth(int farnsworth)
+{
+  if((farnsworth != 0) && ((farnsworth < minWPM) || (farnsworth > maxWPM)))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;    
+  }
+  ld.farnsworth = farnsworth;
+  morse.wpm(ld.wpm, ld.weight, ld.ratio, ld.farnsworth);
   SendACK;
 }
 
+// Message is cut at CWTextSize, the longest S message that could be queued
 void String2upd(void)
 {
-  String mess;
+  char   mess[CWTextSize];
   char   c;
+  int    i = 0;
 
-  mess = "";
   while((c=GetCh()) != 0xFF) if(c == ',') break;
   while((c=GetCh()) != 0xFF)
   {
     if(c == '\n') break;
-    mess += c;
+    if(i < CWTextSize - 1) mess[i++] = c;
   }
-  mess.trim();
-  ProcessUDP((char *)mess.c_str());
+  mess[i] = 0;
+  ProcessUDP(Trim(mess));
   SendACK;
 }
 
@@ -467,3 +1037,495 @@ void GetIP(void)
   SendACKonly;
   serial->println(ip);
 }
+
+// Appends the rest of the command line to the CW text queue, replies with the
+// credits left
+void CWSend(void)
+{
+  char   c;
+  char   text[CWTextSize];
+  int    len = 0;
+
+  while((c=GetCh()) != 0xFF) if(c == ',') break;
+  while((c=GetCh()) != 0xFF)
+  {
+    if(c == '\n') break;
+    if(len < CWTextSize) text[len++] = c;
+  }
+  if(cwtext.append(text, len) < 0)
+  {
+    SetErrorCode(ERR_BUFFERFULL);
+    SendNAK;
+    return;
+  }
+  SendACKonly;
+  if(!SerialMute) serial->println(cwtext.credits());
+}
+
+void CWStop(void)
+{
+  CWAbort();
+  SendACK;
+}
+
+void CWRemaining(void)
+{
+  SendACKonly;
+  if(!SerialMute) serial->println(cwtext.remaining());
+}
+
+void CWGetCredits(void)
+{
+  SendACKonly;
+  if(!SerialMute) serial->println(cwtext.credits());
+}
+
+void RecordStats(void)
+{
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(recorder.recorded);
+  serial->print(",");
+  serial->println(recorder.lost);
+}
+
+// Returns lease in uS, mean renewal interval, deviation, renewals, leases expired,
+// keyed again after expiry
+void GetLease(void)
+{
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(morse.lease());
+  serial->print(",");
+  serial->print(lease.mean);
+  serial->print(",");
+  serial->print(lease.dev);
+  serial->print(",");
+  serial->print(lease.renewals);
+  serial->print(",");
+  serial->print(morse.expired);
+  serial->print(",");
+  serial->println(lease.rekeys);
+}
+
+// UDP authentication commands
+
+// Sets the pre-shared key, 32 hex digits given as two halves of 16 to fit the
+// command tokens. It is saved with SAVE.
+void SetAuthKey(char *first, char *second)
+{
+  uint8_t key[AuthKeySize];
+  char    hex[2 * AuthKeySize + 1];
+
+  if((strlen(first) != AuthKeySize) || (strlen(second) != AuthKeySize) || !Auth::parseKey(strcat(strcpy(hex, first), second), key))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  memcpy(ld.authKey, key, AuthKeySize);
+  udpAuth.setKey(key);
+  udpAuth.reset();
+  SendACK;
+}
+
+// Returns passed, bad tag, replays, untagged
+void AuthStats(void)
+{
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(udpAuth.passed);
+  serial->print(",");
+  serial->print(udpAuth.badTag);
+  serial->print(",");
+  serial->print(udpAuth.replays);
+  serial->print(",");
+  serial->println(udpAuth.untagged);
+}
+
+void ResetAuthStats(void)
+{
+  udpAuth.resetStats();
+  SendACK;
+}
+
+// Times the check of a tagged character frame, the longest keying message, with a
+// scratch Auth so the live replay state is not touched. Returns uS per message and
+// the SipHash reference vector result, PASS or FAIL.
+void AuthBenchmark(void)
+{
+  Auth     bench;
+  uint8_t  frame[8 + AuthTrailer];
+  uint32_t start, total = 0;
+  int      len;
+
+  bench.setKey(ld.authKey);
+  memset(frame, 0, sizeof(frame));
+  for(int i = 0; i < 100; i++)
+  {
+    frame[0] = 'E';
+    frame[1] = i;
+    len = bench.sign(frame, 8, i);
+    start = micros();
+    bench.verify(frame, len);
+    total += micros() - start;
+  }
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(total / 100.0);
+  serial->print(",");
+  serial->println(Auth::selfTest() ? "PASS" : "FAIL");
+}
+
+// PTT sequencer commands, times in mS
+
+void SetPTT(char *state)
+{
+  if(strcmp(state, "TRUE") == 0) ld.ptt = true;
+  else if(strcmp(state, "FALSE") == 0) ld.ptt = false;
+  else
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  PTTSettings();
+  SendACK;
+}
+
+void PTTTime(int *setting, int ms, int max)
+{
+  if((ms < 0) || (ms > max))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  *setting = ms;
+  PTTSettings();
+  SendACK;
+}
+
+void SetPTTLead(int ms) { PTTTime(&ld.pttLead, ms, 1000); }
+void SetPTTTail(int ms) { PTTTime(&ld.pttTail, ms, 1000); }
+void SetPTTHang(int ms) { PTTTime(&ld.pttHang, ms, 10000); }
+
+void PTTStats(void)
+{
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(ptt.on() ? "ON" : "OFF");
+  serial->print(",");
+  serial->print(ptt.overs);
+  serial->print(",");
+  serial->print(ptt.early);
+  serial->print(",");
+  serial->print(ptt.delayed);
+  serial->print(",");
+  serial->println(ptt.violations);
+}
+
+void ResetPTTStats(void)
+{
+  ptt.resetStats();
+  SendACK;
+}
+
+// Sent by the Remote on every TCP connect, SESSION,id,seq. A new session starts the
+// receive window at seq and the lease statistics over, the same session keeps them
+// so events retransmitted from before the reconnect are still recognised. The
+// message is not authenticated, the UDP replay window only moves to the session once
+// a message tagged with its id verifies, see Auth.h.
+void Session(int id, int seq)
+{
+  udpAuth.session(id);
+  if(id == sessionId)
+  {
+    sessionResumes++;
+    SendACK;
+    return;
+  }
+  sessionId = id;
+  rxWindow.start(seq);
+  lease.reset();
+  morse.lease(DefaultLease);
+  SendACK;
+}
+
+// Returns session id, resumes
+void GetSession(void)
+{
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(sessionId);
+  serial->print(",");
+  serial->println(sessionResumes);
+}
+
+// Returns accepted, duplicates, stale, gaps, acks sent, late key downs played
+void RxStats(void)
+{
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(rxWindow.accepted);
+  serial->print(",");
+  serial->print(rxWindow.duplicates);
+  serial->print(",");
+  serial->print(rxWindow.stale);
+  serial->print(",");
+  serial->print(rxWindow.gaps);
+  serial->print(",");
+  serial->print(acksSent);
+  serial->print(",");
+  serial->println(lateMarks);
+}
+
+void ResetRxStats(void)
+{
+  rxWindow.resetStats();
+  acksSent = lateMarks = 0;
+  SendACK;
+}
+
+const char *coalesceNames[] = {"OFF", "REPLAY", "LATEST"};
+
+void SetCoalesce(char *policy)
+{
+  for(int i = CoalesceOff; i <= CoalesceLatest; i++) if(strcmp(policy, coalesceNames[i]) == 0)
+  {
+    ld.coalesce = i;
+    SendACK;
+    return;
+  }
+  SetErrorCode(ERR_BADARG);
+  SendNAK;
+}
+
+void GetCoalesce(void)
+{
+  SendACKonly;
+  if(!SerialMute) serial->println(coalesceNames[ld.coalesce]);
+}
+
+void SetReplayMax(int ms)
+{
+  if((ms < 0) || (ms > 5000))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  ld.replayMax = ms;
+  SendACK;
+}
+
+// Returns batches, largest batch, batches reordered, key downs and ups coalesced,
+// pairs replayed, replays applied as they come
+void BatchStats(void)
+{
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(rxBatch.batches);
+  serial->print(",");
+  serial->print(rxBatch.largest);
+  serial->print(",");
+  serial->print(rxBatch.reordered);
+  serial->print(",");
+  serial->print(rxBatch.coalesced);
+  serial->print(",");
+  serial->print(rxBatch.replayed);
+  serial->print(",");
+  serial->println(rxBatch.fallbacks);
+}
+
+void ResetBatchStats(void)
+{
+  rxBatch.resetStats();
+  SendACK;
+}
+
+// Returns loops, overruns, worst loop period uS, the subsystem that ran longest in
+// it, then the loop period histogram, bin n counts 2^n to 2^(n+1)-1 uS
+void GetLoop(void)
+{
+  SendACKonly;
+  if(!SerialMute) loopStats.report(serial);
+}
+
+void ResetLoop(void)
+{
+  loopStats.reset();
+  SendACK;
+}
+
+// Returns name, calls, average and worst case cycles for each profiler zone
+void GetProfile(void)
+{
+#ifdef PROFILING
+  SendACKonly;
+  if(!SerialMute) profiler().report(serial);
+#else
+  SetErrorCode(ERR_NOTSUPPORTED);
+  SendNAK;
+#endif
+}
+
+void ResetProfile(void)
+{
+#ifdef PROFILING
+  profiler().reset();
+  SendACK;
+#else
+  SetErrorCode(ERR_NOTSUPPORTED);
+  SendNAK;
+#endif
+}
+
+// Returns live bytes, peak, allocations, frees and violations, then address, count
+// and bytes for each call site
+void GetAlloc(void)
+{
+#ifdef ALLOC_TRACKING
+  SendACKonly;
+  if(!SerialMute) allocTrack.report(serial);
+#else
+  SetErrorCode(ERR_NOTSUPPORTED);
+  SendNAK;
+#endif
+}
+
+void ResetAlloc(void)
+{
+#ifdef ALLOC_TRACKING
+  allocTrack.reset();
+  SendACK;
+#else
+  SetErrorCode(ERR_NOTSUPPORTED);
+  SendNAK;
+#endif
+}
+
+// Test mode, TRUE clears the violations and reports each new one on the serial port
+void SetAllocTest(char *state)
+{
+#ifdef ALLOC_TRACKING
+  if(strcmp(state,"TRUE") == 0)
+  {
+    allocTrack.reset();
+    allocTrack.testMode = true;
+  }
+  else if(strcmp(state,"FALSE") == 0) allocTrack.testMode = false;
+  else
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  SendACK;
+#else
+  SetErrorCode(ERR_NOTSUPPORTED);
+  SendNAK;
+#endif
+}
+
+// Returns PASS or FAIL, zone, call site and bytes of the first violation
+void GetAllocTest(void)
+{
+#ifdef ALLOC_TRACKING
+  SendACKonly;
+  if(!SerialMute) allocTrack.result(serial);
+#else
+  SetErrorCode(ERR_NOTSUPPORTED);
+  SendNAK;
+#endif
+}
+
+void DecoderWPM(void)
+{
+  SendACKonly;
+  if(!SerialMute) serial->println(decoder.wpm());
+}
+
+void CompileMessages(void)
+{
+  for(int i = 0; i < MaxMessages; i++)
+  {
+    ld.Message[i][MessageSize - 1] = 0;
+    messages[i].compile(ld.Message[i]);
+  }
+}
+
+// Sets a memory keyer message, SMSG,n,text. n is 1 to 4, the text is the rest of
+// the line
+void SetMessage(void)
+{
+  char c;
+  int  slot = 0, len = 0;
+  char text[MessageSize];
+
+  while((c=GetCh()) != 0xFF) if(c == ',') break;
+  while((c=GetCh()) != 0xFF)
+  {
+    if(c == ',') break;
+    if(isdigit(c)) slot = slot * 10 + c - '0';
+  }
+  while((c=GetCh()) != 0xFF)
+  {
+    if(c == '\n') break;
+    if(len < (MessageSize - 1)) text[len++] = c;
+  }
+  text[len] = 0;
+  if((slot < 1) || (slot > MaxMessages))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  if(msgSlot == slot - 1) StopMessage();
+  strcpy(ld.Message[slot - 1], text);
+  messages[slot - 1].compile(ld.Message[slot - 1]);
+  SendACK;
+}
+
+void GetMessage(int slot)
+{
+  if((slot < 1) || (slot > MaxMessages))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  SendACKonly;
+  if(!SerialMute) serial->println(ld.Message[slot - 1]);
+}
+
+void PlayMessage(int slot)
+{
+  if((slot < 1) || (slot > MaxMessages))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  StartMessage(slot - 1);
+  SendACK;
+}
+
+// Lets a long running command keep the higher priority tasks alive
+void Yield(void)
+{
+  scheduler.yield();
+}
+
+void GetTasks(void)
+{
+  SendACKonly;
+  if(SerialMute) return;
+  scheduler.report(serial);
+}
+
+void ResetTasks(void)
+{
+  scheduler.reset();
+  SendACK;
+}
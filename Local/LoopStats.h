@@ -0,0 +1,98 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Main loop health. Every loop period goes into a log2 histogram, bin n counts
+// periods of 2^n to 2^(n+1)-1 uS and the last bin everything longer. A period
+// longer than the budget is an overrun, the longest one is kept together with the
+// subsystem that ran longest in that loop.
+//
+// Call enter() as each subsystem starts and tick() once per loop, or pass tick()
+// the name of the longest subsystem when it is known some other way.
+
+#define LoopBins  20
+
+class LoopStats
+{
+  private:
+    uint32_t      last = 0;
+    bool          started = false;
+    const char    *current = NULL;  // Subsystem running now
+    uint32_t      enterTime;
+    const char    *longest = NULL;  // Subsystem that ran longest in this loop
+    uint32_t      longestTime = 0;
+    void track(uint32_t now)
+    {
+      if((current != NULL) && ((now - enterTime) >= longestTime))
+      {
+        longestTime = now - enterTime;
+        longest = current;
+      }
+      enterTime = now;
+    }
+  public:
+    int           budget;           // Overrun budget, uS
+    unsigned long bins[LoopBins];
+    unsigned long loops = 0;
+    unsigned long overruns = 0;
+    uint32_t      worst = 0;        // Longest period, uS
+    const char    *worstWhere = ""; // Longest subsystem in the longest loop
+    LoopStats(int budgetUs) : budget(budgetUs) { reset(); }
+    void enter(const char *name)
+    {
+      track(micros());
+      current = name;
+    }
+    void tick(const char *where = NULL)
+    {
+      uint32_t now = micros();
+
+      track(now);
+      if(where == NULL) where = longest;
+      current = NULL;
+      longest = NULL;
+      longestTime = 0;
+      if(!started)
+      {
+        started = true;
+        last = now;
+        return;
+      }
+      uint32_t period = now - last;
+      last = now;
+      int bin = (period == 0) ? 0 : 31 - __builtin_clz(period);
+      if(bin >= LoopBins) bin = LoopBins - 1;
+      bins[bin]++;
+      loops++;
+      if(period > (uint32_t)budget) overruns++;
+      if(period > worst)
+      {
+        worst = period;
+        worstWhere = (where == NULL) ? "" : where;
+      }
+    }
+    void reset(void)
+    {
+      for(int i = 0; i < LoopBins; i++) bins[i] = 0;
+      loops = overruns = worst = 0;
+      worstWhere = "";
+      started = false;
+    }
+    // Reports loops, overruns, worst period uS, worst subsystem, then the histogram
+    void report(Stream *s)
+    {
+      s->print(loops);
+      s->print(",");
+      s->print(overruns);
+      s->print(",");
+      s->print(worst);
+      s->print(",");
+      s->print(worstWhere);
+      for(int i = 0; i < LoopBins; i++)
+      {
+        s->print(",");
+        s->print(bins[i]);
+      }
+      s->println();
+    }
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Arduino.h"
+#include "Morse.h"
+
+// Memory keyer message slots. The message text is kept in the settings and compiled
+// into a list of element codes when it is set or restored, so playback only has to
+// look up the element durations in the timing table and never parses text. The codes
+// do not hold durations so a speed change does not need a recompile.
+//
+// Each code byte is a mark type in bits 0-1 and the space that follows in bits 2-3.
+// Text may include <xx> prosigns, sent with no character space.
+
+#define MaxMessages    4
+#define MessageSize    48           // Message text size including the null
+#define MaxCodes       256          // Compiled element codes per message
+
+#define MarkNone       0x00
+#define MarkDit        0x01
+#define MarkDah        0x02
+#define MarkMask       0x03
+
+#define SpaceElement   0x00         // Element space
+#define SpaceChar      0x04         // Character space
+#define SpaceWord      0x08         // Word space less character space
+#define SpaceProsign   0x0C         // Character space less element space
+#define SpaceMask      0x0C
+
+class Message
+{
+  private:
+    uint8_t codes[MaxCodes];
+    int     length = 0;
+    void add(uint8_t code) { if(length < MaxCodes) codes[length++] = code; }
+  public:
+    void compile(const char *text)
+    {
+      bool prosign = false;
+
+      length = 0;
+      for(int i = 0; text[i] != 0; i++)
+      {
+        char c = toupper(text[i]);
+        if(c == '<') { prosign = true; continue; }
+        if(c == '>')
+        {
+          if(prosign) add(MarkNone | SpaceProsign);
+          prosign = false;
+          continue;
+        }
+        if(c == ' ') { add(MarkNone | SpaceWord); continue; }
+        for(int j = 0; patterns[j].Char != 0; j++)
+        {
+          if(c != patterns[j].Char) continue;
+          for(int k = 0; patterns[j].Code[k] != 0; k++)
+          {
+            uint8_t code = (patterns[j].Code[k] == '.') ? MarkDit : MarkDah;
+            if(!prosign && (patterns[j].Code[k+1] == 0)) code |= SpaceChar;
+            add(code);
+          }
+          break;
+        }
+      }
+    }
+    int size(void) { return length; }
+    uint8_t code(int i) { return codes[i]; }
+};
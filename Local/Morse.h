@@ -1,6 +1,8 @@
 #pragma once
 
 #include "Arduino.h"
+#include "FastPin.h"
+#include "Timing.h"
 
 #define minWPM  5
 #define maxWPM  45
@@ -26,90 +28,296 @@ const Pattern  patterns[] =
   {0,""}
 };
 
-class Morse
+// Key down lease used until renewals are seen from the remote, uS
+#define DefaultLease 500000
+
+// Elements are queued and played by process(), nothing here blocks. Each element is
+// a mark followed by a space, a mark of 0 is a space only.
+#define MaxElements  16
+
+typedef struct
+{
+  uint32_t  Mark;                 // Key down time, uS
+  uint32_t  Space;                // Key up time after the mark, uS
+} Element;
+
+enum PlayStates
+{
+  PlayIdle,
+  PlayMark,
+  PlaySpace,
+  PlayLive                        // Held down by the remote key
+};
+
+// The key pin and its polarity are template arguments, the key output is written
+// directly to the port registers with no polarity test on each edge.
+template <uint8_t KeyPin = 14, bool ActiveHigh = true> class Morse
 {
   private:
-    int KeyPin      = 14;
-    bool ActiveHigh = true;
-    int MarkT       = 120;
-    int CharGap     = 3;
+    Timing timing;
     bool Keyed      = false;
-    unsigned long KeyedTime;
-    int MaxKeyedTime = 500;
+    uint32_t LeaseStart = 0;
+    uint32_t Lease  = DefaultLease;
     void (*KeyIsDown)(void) = NULL;
     void (*KeyIsUp)(void) = NULL;
-  public:
-    void begin(int pin, bool activehigh) 
+    bool (*Ready)(void) = NULL;
+    // Direct key down held back by the ready call back or until the queue has played
+    bool DownPending = false;
+    uint32_t DownAt = 0;
+    uint32_t Delay = 0;             // Time the live key down was held back, uS
+    // Element queue and player state
+    Element         elements[MaxElements];
+    int             head = 0;
+    int             tail = 0;
+    int             count = 0;
+    Element         current = {0, 0};
+    PlayStates      state = PlayIdle;
+    uint32_t        stateStart = 0;
+    void key(bool down)
     {
-      KeyPin = pin;
-      ActiveHigh = activehigh;
-      pinMode(KeyPin, OUTPUT);
-      KeyUp();
+      FastPin<KeyPin>::write(down ? ActiveHigh : !ActiveHigh);
+      if(down && (KeyIsDown != NULL)) KeyIsDown();
+      if(!down && (KeyIsUp != NULL)) KeyIsUp();
     }
-    void update(void) 
+    // Sends a held back direct key down once the queue has played and the key can
+    // go down
+    void release(uint32_t now)
     {
-      if(Keyed)
-      {
-        if((millis() - KeyedTime) > MaxKeyedTime) KeyUp();
-      }
+      if(!DownPending || (state != PlayIdle) || (count > 0)) return;
+      if((Ready != NULL) && !Ready()) return;
+      DownPending = false;
+      key(true);
+      state = PlayLive;
+      stateStart = now;
+      Delay = now - DownAt;
     }
-    int wpm(void) { return(1200 / MarkT); }
-    void wpm(int w) { MarkT = 1200 / w; }
+  public:
+    unsigned long expired = 0;      // Key downs ended by the watchdog
+    void begin(void) 
+    {
+      timing.set(10);
+      pinMode(KeyPin, OUTPUT);
+      key(false);
+    }
+    int wpm(void) { return(timing.wpm()); }
+    void wpm(int w) { timing.set(w); }
+    // Sets speed, weight, dah/dit ratio and Farnsworth character speed
+    void wpm(int w, int weight, int ratio, int farnsworth) { timing.set(w, weight, ratio, farnsworth); }
+    Timing &getTiming(void) { return timing; }
     void attachKeyDown(void (*fun)(void)) { KeyIsDown = fun; }
     void attachKeyUp(void (*fun)(void)) { KeyIsUp = fun; }
     void detachKeyDown(void) { KeyIsDown = NULL; }
     void detachKeyUp(void) { KeyIsUp = NULL; }
+    // Called before every key down, the key is held up until it returns true. Used to
+    // sequence PTT ahead of RF.
+    void attachReady(bool (*fun)(void)) { Ready = fun; }
+    void detachReady(void) { Ready = NULL; }
+    // Direct key down from the remote key. The key down holds a lease that the remote
+    // renews while the key is held, the watchdog drops the key when it runs out.
+    // Direct keying is serialized with the element player, the key goes down once
+    // the queued elements have played so neither cuts the other.
     void KeyDown(void)
     {
-      if(ActiveHigh) digitalWrite(KeyPin, HIGH);
-      else digitalWrite(KeyPin, LOW);
+      uint32_t now = micros();
+
+      // A second key down, the key up between them was lost
+      if(Keyed)
+      {
+        LeaseStart = now;
+        return;
+      }
       Keyed = true;
-      KeyedTime = millis();
-      if(KeyIsDown != NULL) KeyIsDown();
+      LeaseStart = DownAt = now;
+      DownPending = true;
+      release(now);
     }
+    // A key up before a held back key down went out queues the mark so it is still
+    // sent, late but full length. A key down that went out late, behind the PTT lead,
+    // plays on until it has been down as long as the operator held it. A key up only
+    // ends a direct key down, never a queued element.
     void KeyUp(void)
     {
-      if(ActiveHigh) digitalWrite(KeyPin, LOW);
-      else digitalWrite(KeyPin, HIGH);
+      if(!Keyed) return;
       Keyed = false;
-      if(KeyIsUp != NULL) KeyIsUp();
+      if(DownPending)
+      {
+        DownPending = false;
+        queue(micros() - DownAt, 0);
+        return;
+      }
+      if(state != PlayLive) return;
+      if(Delay > 0)
+      {
+        current.Mark = micros() - DownAt;
+        current.Space = 0;
+        state = PlayMark;
+        return;
+      }
+      key(false);
+      state = PlayIdle;
     }
-    void check(void)
+    void renew(void) { if(Keyed) LeaseStart = micros(); }
+    void lease(uint32_t us) { Lease = us; }
+    uint32_t lease(void) { return Lease; }
+    bool keyed(void) { return Keyed; }
+    // Watchdog, returns true if the lease ran out and the direct key down was dropped.
+    // Queued elements play on.
+    bool check(void)
     {
-      if(Keyed)
+      if(!Keyed) return false;
+      if((micros() - LeaseStart) <= Lease) return false;
+      Keyed = false;
+      DownPending = false;
+      if(state == PlayLive)
       {
-        if(millis() > (KeyedTime + MaxKeyedTime)) KeyUp();
+        key(false);
+        state = PlayIdle;
       }
+      expired++;
+      return true;
     }
-    void Dit(void)
+    // Queue an element, returns false if the queue is full
+    bool queue(uint32_t mark, uint32_t space)
     {
-      KeyDown();
-      delay(MarkT);
-      KeyUp();
-      delay(MarkT);  
+      if(count >= MaxElements) return false;
+      elements[tail].Mark = mark;
+      elements[tail].Space = space;
+      if(++tail >= MaxElements) tail = 0;
+      count++;
+      return true;
     }
-    void Dash(void)
+    // Number of elements waiting, not counting the one playing
+    int queued(void) { return count; }
+    int space(void) { return MaxElements - count; }
+    // Length of the elements waiting, uS
+    uint32_t queuedTime(void)
     {
-      KeyDown();
-      delay(MarkT * CharGap);
-      KeyUp();
-      delay(MarkT);    
+      uint32_t t = 0;
+
+      for(int n = 0, i = head; n < count; n++)
+      {
+        t += elements[i].Mark + elements[i].Space;
+        if(++i >= MaxElements) i = 0;
+      }
+      return t;
+    }
+    // Plays the elements waiting faster, in proportion, so they take t uS
+    void fit(uint32_t t)
+    {
+      uint32_t total = queuedTime();
+
+      if(t >= total) return;
+      for(int n = 0, i = head; n < count; n++)
+      {
+        elements[i].Mark = elements[i].Mark * (uint64_t)t / total;
+        elements[i].Space = elements[i].Space * (uint64_t)t / total;
+        if(++i >= MaxElements) i = 0;
+      }
+    }
+    bool busy(void) { return (state != PlayIdle) || (count > 0) || DownPending; }
+    // Time before the next queued mark starts, 0 while a mark is playing or held back
+    // and 0xFFFFFFFF if no mark is queued
+    uint32_t ahead(void)
+    {
+      uint32_t until = 0;
+      int      i = head;
+
+      if((state == PlayMark) || (state == PlayLive) || DownPending) return 0;
+      if(state == PlaySpace)
+      {
+        uint32_t t = micros() - stateStart;
+        if(t < current.Space) until = current.Space - t;
+      }
+      for(int n = 0; n < count; n++)
+      {
+        if(elements[i].Mark > 0) return until;
+        until += elements[i].Space;
+        if(++i >= MaxElements) i = 0;
+      }
+      return 0xFFFFFFFF;
+    }
+    // Stops the element playing, drops a direct key down and clears the queue
+    void abort(void)
+    {
+      head = tail = count = 0;
+      Keyed = DownPending = false;
+      if((state == PlayMark) || (state == PlayLive)) key(false);
+      state = PlayIdle;
+    }
+    // Element player, call as often as possible. Element end times are measured from
+    // the planned start so timing errors do not add up.
+    void process(void)
+    {
+      uint32_t now = micros();
+
+      while(true)
+      {
+        switch (state)
+        {
+          case PlayLive:
+            return;
+          case PlayIdle:
+            if(count == 0)
+            {
+              release(now);
+              return;
+            }
+            // Marks wait until the key can go down
+            if((elements[head].Mark > 0) && (Ready != NULL) && !Ready()) return;
+            current = elements[head];
+            if(++head >= MaxElements) head = 0;
+            count--;
+            stateStart = now;
+            if(current.Mark > 0)
+            {
+              key(true);
+              state = PlayMark;
+            }
+            else state = PlaySpace;
+            break;
+          case PlayMark:
+            if((now - stateStart) < current.Mark) return;
+            key(false);
+            stateStart += current.Mark;
+            state = PlaySpace;
+            break;
+          case PlaySpace:
+            if((now - stateStart) < current.Space) return;
+            stateStart += current.Space;
+            state = PlayIdle;
+            if(count == 0) return;
+            // Start the next element exactly at the end of this one
+            now = stateStart;
+            break;
+        }
+      }
     }
-    void SendMorseChar(char c)
+    void Dit(void) { queue(timing.Dit, timing.Element); }
+    void Dash(void) { queue(timing.Dah, timing.Element); }
+    // Queues the elements of a character. The last element is followed by a character
+    // space unless charSpace is false, used inside a prosign. A space extends the
+    // character space to a word space. Returns false if the character is unknown.
+    bool SendMorseChar(char c, bool charSpace = true)
     {
+      if(c == ' ') return queue(0, timing.Word - timing.Character);
+      c = toupper(c);
       for(int i=0; patterns[i].Char != 0; i++)
       {
         if(c == patterns[i].Char)
         {
           for(int j=0; patterns[i].Code[j] != 0; j++)
           {
-            if(patterns[i].Code[j] == '.') Dit();
-            else if(patterns[i].Code[j] == '-') Dash();
+            uint32_t space = timing.Element;
+            if(charSpace && (patterns[i].Code[j+1] == 0)) space = timing.Character;
+            if(patterns[i].Code[j] == '.') queue(timing.Dit, space);
+            else if(patterns[i].Code[j] == '-') queue(timing.Dah, space);
           }
-          delay(MarkT * CharGap);
-          return;
+          return true;
         }
       }
+      return false;
     }
-    void SendMorseString(char *c) { for(int i=0; c[i] != 0; i++) SendMorseChar(c[i]); }
+    // Characters inside a prosign are followed by an element space, this adds the rest
+    // of the character space when the prosign ends
+    void EndProsign(void) { queue(0, timing.Character - timing.Element); }
 };
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Arduino.h"
+#include "FastPin.h"
+
+// PTT sequencer for an amplifier or T/R relay. PTT is raised lead time before the
+// first key down of an over and dropped when the key has been up for the hang time,
+// never sooner than the tail time. The Morse player asks ready() before it keys and
+// holds the element until the lead time has passed, so only the first element of an
+// over can be delayed. When elements are queued ahead, lookAhead() raises PTT lead
+// time before the first mark is due and RF is not delayed at all.
+//
+// A key down before PTT has settled or PTT dropped with the key down or inside the
+// tail time would hot switch the relay, these are counted as violations.
+//
+// All times in uS.
+
+enum PTTStates
+{
+  PTTOff,
+  PTTLead,                          // Raised, waiting out the lead time
+  PTTOn
+};
+
+template <uint8_t Pin = 12, bool ActiveHigh = true> class PTT
+{
+  private:
+    PTTStates     state = PTTOff;
+    bool          down = false;
+    bool          held;             // First element of this over held back
+    uint32_t      raisedAt;
+    uint32_t      keyUpAt;
+    void raise(uint32_t now)
+    {
+      FastPin<Pin>::write(ActiveHigh);
+      state = PTTLead;
+      raisedAt = keyUpAt = now;
+      held = false;
+      overs++;
+    }
+  public:
+    bool          enabled = false;
+    uint32_t      lead = 25000;
+    uint32_t      tail = 15000;
+    uint32_t      hang = 500000;
+    unsigned long overs = 0;
+    unsigned long early = 0;        // Raised by look ahead before the mark was due
+    unsigned long delayed = 0;      // Overs with the first element held back
+    unsigned long violations = 0;
+    void begin(void)
+    {
+      pinMode(Pin, OUTPUT);
+      FastPin<Pin>::write(!ActiveHigh);
+    }
+    bool on(void) { return state != PTTOff; }
+    // Called before a mark starts, raises PTT if needed. Returns true when the key
+    // can go down.
+    bool ready(void)
+    {
+      uint32_t now = micros();
+
+      if(!enabled) return true;
+      if(state == PTTOn) return true;
+      if(state == PTTOff) raise(now);
+      if((now - raisedAt) < lead)
+      {
+        if(!held) delayed++;
+        held = true;
+        return false;
+      }
+      state = PTTOn;
+      return true;
+    }
+    // until is the time before the next queued mark starts
+    void lookAhead(uint32_t until)
+    {
+      if(!enabled || (state != PTTOff) || (until > lead)) return;
+      raise(micros());
+      if(until > 0) early++;
+    }
+    // Key edge from the Morse output
+    void key(bool keyDown)
+    {
+      uint32_t now = micros();
+
+      down = keyDown;
+      if(!keyDown) keyUpAt = now;
+      else if(enabled && ((state == PTTOff) || ((now - raisedAt) < lead))) violations++;
+    }
+    // Drops PTT once the key has been up long enough, busy is true while elements
+    // are waiting to play
+    void process(bool busy)
+    {
+      if((state == PTTOff) || down || busy) return;
+      uint32_t now = micros();
+      if((now - keyUpAt) < ((hang > tail) ? hang : tail)) return;
+      release();
+    }
+    // Drops PTT now
+    void release(void)
+    {
+      if(state == PTTOff) return;
+      if(down || ((micros() - keyUpAt) < tail)) violations++;
+      FastPin<Pin>::write(!ActiveHigh);
+      state = PTTOff;
+    }
+    void resetStats(void) { overs = early = delayed = violations = 0; }
+};
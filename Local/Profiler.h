@@ -0,0 +1,130 @@
+#pragma once
+
+// Hot path profiler. PROFILE_ZONE("name") at the top of a block times the rest of
+// the block in cycles of the fastest counter the target has, ESP.getCycleCount()
+// on the ESP8266, SysTick on the M0 (it has no DWT cycle counter) and the
+// monotonic clock in nS on Linux. Each zone keeps its call count, total and worst
+// case, GPROF lists them.
+//
+// Everything compiles out unless PROFILING is defined.
+
+//#define PROFILING
+
+#ifdef PROFILING
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdint.h>
+#include <time.h>
+#endif
+#include <string.h>
+
+#define MaxZones  12
+
+typedef struct
+{
+  const char  *Name;
+  uint32_t    Calls;
+  uint64_t    Total;                // Cycles
+  uint32_t    Worst;                // Cycles
+} ProfileZone;
+
+static inline uint32_t ProfileCycles(void)
+{
+#if defined(ARDUINO_ARCH_ESP8266)
+  return ESP.getCycleCount();
+#elif defined(ARDUINO_ARCH_SAMD)
+  // SysTick counts down from LOAD once per mS, read it with a millis() that is
+  // known to go with it
+  uint32_t ms, val;
+  do
+  {
+    ms = millis();
+    val = SysTick->VAL;
+  } while(ms != millis());
+  return ms * (SysTick->LOAD + 1) + (SysTick->LOAD - val);
+#elif defined(ARDUINO)
+  return micros();
+#else
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+class Profiler
+{
+  private:
+    ProfileZone zones[MaxZones];
+    int         numZones = 0;
+  public:
+    // Returns the zone index for name, adding it if needed, -1 if the table is full
+    int zone(const char *name)
+    {
+      for(int i = 0; i < numZones; i++) if(strcmp(zones[i].Name, name) == 0) return i;
+      if(numZones >= MaxZones) return -1;
+      zones[numZones].Name = name;
+      zones[numZones].Calls = 0;
+      zones[numZones].Total = 0;
+      zones[numZones].Worst = 0;
+      return numZones++;
+    }
+    void add(int z, uint32_t cycles)
+    {
+      if(z < 0) return;
+      zones[z].Calls++;
+      zones[z].Total += cycles;
+      if(cycles > zones[z].Worst) zones[z].Worst = cycles;
+    }
+    void reset(void)
+    {
+      for(int i = 0; i < numZones; i++) zones[i].Calls = zones[i].Total = zones[i].Worst = 0;
+    }
+    int size(void) { return numZones; }
+    ProfileZone &get(int i) { return zones[i]; }
+#ifdef ARDUINO
+    // Reports name, calls, average and worst case cycles for each zone
+    void report(Stream *s)
+    {
+      for(int i = 0; i < numZones; i++)
+      {
+        s->print(zones[i].Name);
+        s->print(",");
+        s->print(zones[i].Calls);
+        s->print(",");
+        s->print((unsigned long)(zones[i].Calls ? zones[i].Total / zones[i].Calls : 0));
+        s->print(",");
+        s->println(zones[i].Worst);
+      }
+    }
+#endif
+};
+
+// One table shared by every file that includes this
+inline Profiler &profiler(void)
+{
+  static Profiler p;
+  return p;
+}
+
+class ProfileScope
+{
+  private:
+    int       z;
+    uint32_t  start;
+  public:
+    ProfileScope(int zone) : z(zone), start(ProfileCycles()) {}
+    ~ProfileScope() { profiler().add(z, ProfileCycles() - start); }
+};
+
+#define PROFILE_CAT2(a, b)  a##b
+#define PROFILE_CAT(a, b)   PROFILE_CAT2(a, b)
+#define PROFILE_ZONE(name)  static int PROFILE_CAT(zone_, __LINE__) = profiler().zone(name); \
+                            ProfileScope PROFILE_CAT(scope_, __LINE__)(PROFILE_CAT(zone_, __LINE__))
+
+#else
+
+#define PROFILE_ZONE(name)
+
+#endif
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Session recorder. Every message received from the Remote is logged with its
+// arrival time and streamed in a compact binary form to the client connected to the
+// record port, a TCP port of its own so a recorder never takes the command
+// connection from the Remote:
+//
+//    0x1E, message length n, arrival time in uS (4 bytes, little endian), n message bytes
+//
+// The arrival time is taken when the datagram is read, before it is queued behind
+// the rest of its batch. Authentication tags are not recorded. Records are buffered
+// here and written by a background task, records that do not fit are counted as
+// lost.
+
+#define RecordMarker   0x1E
+#define RecordHeader   6
+#define RecordBuffer   1024
+
+class Recorder
+{
+  private:
+    uint8_t       buffer[RecordBuffer];
+    int           head = 0;
+    int           tail = 0;
+    int           count = 0;
+    void put(uint8_t b)
+    {
+      buffer[tail] = b;
+      if(++tail >= RecordBuffer) tail = 0;
+      count++;
+    }
+  public:
+    bool          enabled = true;   // Recording allowed, SRECORD
+    bool          active = false;   // A client is on the record port
+    unsigned long recorded = 0;
+    unsigned long lost = 0;
+    void record(const char *msg, int len, uint32_t time)
+    {
+      if(!enabled || !active || (len <= 0)) return;
+      if(len > 255) len = 255;
+      if((count + RecordHeader + len) > RecordBuffer) { lost++; return; }
+      put(RecordMarker);
+      put(len);
+      put(time);
+      put(time >> 8);
+      put(time >> 16);
+      put(time >> 24);
+      for(int i = 0; i < len; i++) put(msg[i]);
+      recorded++;
+    }
+    // Writes the buffered records to the stream, returns true if any were written
+    bool flush(Stream *s)
+    {
+      if(count == 0) return false;
+      while(count > 0)
+      {
+        int n = (head + count > RecordBuffer) ? RecordBuffer - head : count;
+        s->write(&buffer[head], n);
+        head += n;
+        if(head >= RecordBuffer) head = 0;
+        count -= n;
+      }
+      return true;
+    }
+    void clear(void) { head = tail = count = 0; }
+};
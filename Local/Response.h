@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Output staging buffer for the command interface. While a command runs serial
+// points here, the whole response including the ACK or NAK is collected and written
+// to the host stream in one piece when the command is done or the buffer fills.
+// Over TCP this is one packet per response instead of one per print call.
+
+#define ResponseSize  256
+
+class Response : public Stream
+{
+  private:
+    Stream  *out = NULL;
+    uint8_t buffer[ResponseSize];
+    int     count = 0;
+  public:
+    // Sets the stream the response goes to
+    void attach(Stream *s) { if(s != this) out = s; }
+    Stream *target(void) { return out; }
+    size_t write(uint8_t c)
+    {
+      if(count >= ResponseSize) flush();
+      buffer[count++] = c;
+      return 1;
+    }
+    size_t write(const uint8_t *buf, size_t size)
+    {
+      for(size_t i = 0; i < size; i++) write(buf[i]);
+      return size;
+    }
+    using Print::write;
+    // Writes the staged response
+    void flush(void)
+    {
+      if((count > 0) && (out != NULL)) out->write(buffer, count);
+      count = 0;
+    }
+    int available(void) { return (out == NULL) ? 0 : out->available(); }
+    int read(void) { return (out == NULL) ? -1 : out->read(); }
+    int peek(void) { return (out == NULL) ? -1 : out->peek(); }
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+#include "Arduino.h"
+#include "SeqWindow.h"
+
+// Receive batch. Every datagram waiting is read in one pass, up to RxBatchSize, and
+// the key events among them are put back in sequence number order so a late
+// arrival is played instead of dropped as stale. Other messages keep their place.
+//
+// After a stall the batch can hold a run of key downs and ups. Applied one after
+// the other they come out as a burst of clipped elements. Key downs and ups carry
+// the time the Remote keyed them, so the run can be played with the timing the
+// operator sent. A retransmission carries the time of the original. The coalesce
+// policy decides what happens to the run:
+//    Off     Every event is applied as it comes, as before batching
+//    Replay  Each complete down/up pair is queued to the Morse player with the
+//            mark and space the Remote keyed. A backlog can be longer than one
+//            batch, lease renewals take slots too. When the batch is full the
+//            trailing key down, or down/up pair, is held over to the next batch so
+//            it is paired and spaced with the events that follow. The limit covers
+//            the whole backlog, the elements still queued from earlier batches and
+//            the new pairs are played faster together if they are longer than it.
+//            A final key down waits for the queue, see Morse::KeyDown. Without
+//            event times, from a Remote that does not send them, or when the pairs
+//            do not fit the element queue, the pairs are applied as they come.
+//    Latest  Only the last key down or up of the run is applied, the key goes
+//            straight to the state the operator left it in and the elements
+//            before are lost. A trailing key up is always kept.
+// Under Replay a key down followed by another key down, its key up lost, is
+// superseded and dropped. A complete down/up pair and a key up are never dropped.
+// Dropped events are still passed through the receive window so they are
+// acknowledged.
+
+#define RxBatchSize     8
+#define RxMessageSize   24          // UDP_TX_PACKET_MAX_SIZE
+#define RxTimedSize     6           // D or U, seq, event time uS (4 bytes, little endian)
+
+enum CoalescePolicies
+{
+  CoalesceOff,
+  CoalesceReplay,
+  CoalesceLatest
+};
+
+// What to do with a key down or up
+enum RxActions
+{
+  RxApply,
+  RxDrop,                           // Superseded, acknowledge only
+  RxQueue                           // Down of a replayed pair, queue Mark and Space
+};
+
+typedef struct
+{
+  char          Buf[RxMessageSize];
+  int           Len;
+  bool          Timed;              // Key down or up with the Remote's event time
+  uint32_t      Time;               // Remote event time, uS
+  IPAddress     IP;                 // Sender, acknowledgements and credits go back here
+  uint16_t      Port;
+  uint8_t       Action;
+  uint32_t      Mark;               // uS
+  uint32_t      Space;
+} RxMessage;
+
+class RxBatch
+{
+  private:
+    static bool keyEvent(const RxMessage &m) { return (m.Len >= 2) && (strchr("DU.-E", m.Buf[0]) != NULL); }
+    static bool upDown(const RxMessage &m) { return (m.Len >= 2) && ((m.Buf[0] == 'D') || (m.Buf[0] == 'U')); }
+    // Orders the key events by sequence number, in the places key events had
+    bool sort(void)
+    {
+      int  k[RxBatchSize], n = 0;
+      bool moved = false;
+
+      for(int i = 0; i < count; i++) if(keyEvent(messages[i])) k[n++] = i;
+      for(int i = 1; i < n; i++)
+      {
+        for(int j = i; j > 0; j--)
+        {
+          RxMessage &a = messages[k[j - 1]], &b = messages[k[j]];
+          if((int8_t)(b.Buf[1] - a.Buf[1]) >= 0) break;
+          RxMessage t = a;
+          a = b;
+          b = t;
+          moved = true;
+        }
+      }
+      return moved;
+    }
+    // Drops key downs superseded by another key down
+    void orphans(int *ev, int n)
+    {
+      for(int i = 0; i + 1 < n; i++)
+      {
+        if(messages[ev[i]].Buf[0] != 'D') continue;
+        if(messages[ev[i + 1]].Buf[0] == 'U')
+        {
+          i++;
+          continue;
+        }
+        messages[ev[i]].Action = RxDrop;
+        coalesced++;
+      }
+    }
+    // Holds the trailing key down, or down/up pair, of a full batch over to the next
+    // one, with the messages after it. Returns the number of key events left.
+    int hold(int *ev, int n)
+    {
+      int j = n - 1;
+
+      if((j > 0) && (messages[ev[j]].Buf[0] == 'U')) j--;
+      if((messages[ev[j]].Buf[0] != 'D') || !messages[ev[j]].Timed || (ev[j] == 0)) return n;
+      held = count - ev[j];
+      return j;
+    }
+    // Drops all but the last key down or up
+    void latest(int *ev, int n)
+    {
+      for(int i = 0; i + 1 < n; i++)
+      {
+        messages[ev[i]].Action = RxDrop;
+        coalesced++;
+      }
+    }
+    // Queues each complete down/up pair among the first n events with the Remote's
+    // timing, a known event after them, held over, still gives the last space.
+    // Returns false, with no action changed, if the pairs are to be applied as they
+    // come.
+    bool replay(int *ev, int n, int known, uint32_t limit, int room, uint32_t queued)
+    {
+      int      pair[RxBatchSize / 2], pairs = 0;
+      uint64_t total = 0;
+
+      for(int i = 0; i + 1 < n; i++)
+      {
+        if((messages[ev[i]].Buf[0] != 'D') || (messages[ev[i + 1]].Buf[0] != 'U')) continue;
+        pair[pairs++] = i++;
+      }
+      if(pairs == 0) return true;
+      for(int i = 0; i < n; i++) if(!messages[ev[i]].Timed) return false;
+      if(pairs > room) return false;
+      for(int p = 0; p < pairs; p++)
+      {
+        int i = pair[p];
+        RxMessage &d = messages[ev[i]], &u = messages[ev[i + 1]];
+        int32_t mark = u.Time - d.Time;
+        int32_t space = (i + 2 < known) ? (int32_t)(messages[ev[i + 2]].Time - u.Time) : 0;
+        if((mark <= 0) || (space < 0)) return false;
+        d.Mark = mark;
+        d.Space = space;
+        total += d.Mark + d.Space;
+      }
+      if((total > limit) && (limit == 0)) return false;
+      // The backlog is what is still queued and the new pairs
+      uint64_t backlog = total + queued;
+      for(int p = 0; p < pairs; p++)
+      {
+        RxMessage &d = messages[ev[pair[p]]], &u = messages[ev[pair[p] + 1]];
+        // Played faster, in proportion, to catch up within the limit
+        if(backlog > limit)
+        {
+          d.Mark = d.Mark * (uint64_t)limit / backlog;
+          d.Space = d.Space * (uint64_t)limit / backlog;
+        }
+        d.Action = RxQueue;
+        u.Action = RxDrop;
+      }
+      if(backlog > limit) queuedFit = queued * (uint64_t)limit / backlog;
+      replayed += pairs;
+      return true;
+    }
+    static uint32_t get32(const char *p) { return (uint8_t)p[0] | ((uint8_t)p[1] << 8) | ((uint8_t)p[2] << 16) | ((uint32_t)(uint8_t)p[3] << 24); }
+  public:
+    RxMessage     messages[RxBatchSize];
+    int           count = 0;
+    unsigned long batches = 0;
+    unsigned long largest = 0;
+    unsigned long reordered = 0;    // Batches put back in order
+    unsigned long coalesced = 0;    // Key downs and ups dropped as superseded
+    unsigned long replayed = 0;     // Pairs queued with the Remote's timing
+    unsigned long fallbacks = 0;    // Replays applied as they come
+    uint32_t      queuedFit = 0;    // Time the elements already queued must fit in, uS
+    int           held = 0;         // Messages at the end held over to the next batch
+    // Starts the next batch with the messages held over
+    void clear(void)
+    {
+      for(int i = 0; i < held; i++) messages[i] = messages[count - held + i];
+      count = held;
+      held = 0;
+    }
+    bool full(void) { return count >= RxBatchSize; }
+    RxMessage &next(void) { return messages[count]; }
+    // Adds the message filled in at next(), Buf and Len set
+    void add(void)
+    {
+      RxMessage &m = messages[count++];
+
+      m.Action = RxApply;
+      m.Timed = upDown(m) && (m.Len >= RxTimedSize);
+      m.Time = m.Timed ? get32(&m.Buf[2]) : 0;
+    }
+    // Orders the batch and sets the action of each key down and up, the last held
+    // messages are not applied until the next batch. window is a copy of the receive
+    // window, limit the longest replay in uS, room the free space in the element
+    // queue and queued the time of the elements in it. If the backlog is over the
+    // limit queuedFit is the time the queued elements are to be fitted in, see
+    // Morse::fit, otherwise it is queued.
+    void plan(SeqWindow window, int policy, uint32_t limit, int room, uint32_t queued)
+    {
+      int ev[RxBatchSize], n = 0;
+
+      queuedFit = queued;
+      batches++;
+      if((unsigned long)count > largest) largest = count;
+      for(int i = 0; i < count; i++) messages[i].Action = RxApply;
+      if(sort()) reordered++;
+      // The key downs and ups that will be played
+      for(int i = 0; i < count; i++)
+      {
+        RxMessage &m = messages[i];
+        if(keyEvent(m) && window.accept(m.Buf[1]) && upDown(m)) ev[n++] = i;
+      }
+      if((n < 2) || (policy == CoalesceOff)) return;
+      if(policy == CoalesceLatest)
+      {
+        latest(ev, n);
+        return;
+      }
+      int played = full() ? hold(ev, n) : n;
+      if(!replay(ev, played, n, limit, room, queued)) fallbacks++;
+      orphans(ev, played);
+    }
+    void resetStats(void) { batches = largest = reordered = coalesced = replayed = fallbacks = 0; }
+};
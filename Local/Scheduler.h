@@ -0,0 +1,157 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Small run to completion task scheduler. Tasks are held in priority order, lowest
+// number first. Every call to run() walks the list and calls each task that is
+// ready. The keying and watchdog tasks run on every pass, if one of them reports it
+// did some work the background tasks are skipped so the keying tasks are checked
+// again first. A busy task never holds off key output or the watchdog, so a flood
+// of network traffic cannot keep a stuck key down.
+//
+// Periodic tasks (Period != 0) are ready when their period has elapsed, polled tasks
+// (Period == 0) are called every pass and must return quickly if they have nothing
+// to do.
+//
+// A deadline miss is counted when a periodic task starts more than one period late
+// or when any task runs longer than its time budget.
+
+#define MaxTasks            8
+
+// Task priorities
+#define PriorityKeying      0             // UDP drain and key output
+#define PriorityWatchdog    1             // Keying watchdog
+#define PriorityBackground  2             // Command parsing and status reporting
+
+// Tasks up to this priority run on every pass whatever the tasks before them did
+#define PriorityEveryPass   PriorityWatchdog
+
+typedef struct
+{
+  const char    *Name;
+  bool          (*Run)(void);             // Task function, returns true if it did some work
+  int           Priority;
+  unsigned long Period;                   // Task period in uS, 0 = poll every pass
+  unsigned long Budget;                   // Allowed run time in uS, 0 = no limit
+  unsigned long NextRun;
+  unsigned long Calls;
+  unsigned long WorstTime;                // Worst case run time in uS
+  unsigned long Misses;                   // Deadline misses
+} Task;
+
+class Scheduler
+{
+  private:
+    Task          tasks[MaxTasks];
+    int           numTasks = 0;
+    int           current  = -1;          // Index of the running task, -1 if none
+    unsigned long startTime;              // Start time of the running task
+    const char    *passLongest = NULL;    // Task that ran longest in this pass
+    unsigned long passTime = 0;
+    bool runTask(int i, unsigned long now)
+    {
+      Task *t = &tasks[i];
+      int  last = current;
+      unsigned long lastStart = startTime;
+      bool busy;
+
+      if(t->Period != 0)
+      {
+        if((int32_t)(now - t->NextRun) < 0) return false;
+        if((now - t->NextRun) > t->Period)
+        {
+          t->Misses++;
+          t->NextRun = now;
+        }
+        t->NextRun += t->Period;
+      }
+      current = i;
+      startTime = micros();
+      busy = t->Run();
+      unsigned long elapsed = micros() - startTime;
+      current = last;
+      startTime = lastStart;
+      t->Calls++;
+      if(elapsed > t->WorstTime) t->WorstTime = elapsed;
+      if((t->Budget != 0) && (elapsed > t->Budget)) t->Misses++;
+      if(elapsed >= passTime)
+      {
+        passTime = elapsed;
+        passLongest = t->Name;
+      }
+      return busy;
+    }
+  public:
+    // Add a task, the list is kept sorted by priority. Tasks with the same priority
+    // run in the order they were added. Returns false if the table is full.
+    bool add(const char *name, bool (*fun)(void), int priority, unsigned long period = 0, unsigned long budget = 0)
+    {
+      int i;
+
+      if(numTasks >= MaxTasks) return false;
+      for(i = numTasks; i > 0; i--)
+      {
+        if(tasks[i-1].Priority <= priority) break;
+        tasks[i] = tasks[i-1];
+      }
+      tasks[i].Name = name;
+      tasks[i].Run = fun;
+      tasks[i].Priority = priority;
+      tasks[i].Period = period;
+      tasks[i].Budget = budget;
+      tasks[i].NextRun = micros() + period;
+      tasks[i].Calls = tasks[i].WorstTime = tasks[i].Misses = 0;
+      numTasks++;
+      return true;
+    }
+    // One scheduler pass, call from loop()
+    void run(void)
+    {
+      bool busy = false;
+
+      passLongest = NULL;
+      passTime = 0;
+      for(int i = 0; i < numTasks; i++)
+      {
+        if(busy && (tasks[i].Priority > PriorityEveryPass)) return;
+        if(runTask(i, micros())) busy = true;
+      }
+    }
+    // Runs one pass of the tasks with a higher priority than the running task. A long
+    // running task calls this so keying is not stalled while it waits.
+    void yield(void)
+    {
+      if(current < 0) { run(); return; }
+      int priority = tasks[current].Priority;
+      for(int i = 0; (i < numTasks) && (tasks[i].Priority < priority); i++) runTask(i, micros());
+    }
+    // Name of the task that ran longest in the last pass
+    const char *longest(void) { return passLongest; }
+    // Returns true when the running task has used its time budget
+    bool expired(void)
+    {
+      if(current < 0) return false;
+      if(tasks[current].Budget == 0) return false;
+      return (micros() - startTime) >= tasks[current].Budget;
+    }
+    void reset(void)
+    {
+      for(int i = 0; i < numTasks; i++) tasks[i].Calls = tasks[i].WorstTime = tasks[i].Misses = 0;
+    }
+    // Reports name, priority, calls, worst case uS and deadline misses for each task
+    void report(Stream *s)
+    {
+      for(int i = 0; i < numTasks; i++)
+      {
+        s->print(tasks[i].Name);
+        s->print(",");
+        s->print(tasks[i].Priority);
+        s->print(",");
+        s->print(tasks[i].Calls);
+        s->print(",");
+        s->print(tasks[i].WorstTime);
+        s->print(",");
+        s->println(tasks[i].Misses);
+      }
+    }
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Receive window over the 8 bit sequence numbers of the Remote key events. Tracks
+// the highest sequence number seen and a bitmap of the 16 before it, bit n is set
+// when high-1-n has been received. Events older than the highest are not played,
+// a late key down must not follow the key up that replaced it, but they are marked
+// received so the Remote stops retransmitting them.
+//
+// The acknowledgement sent back to the Remote is the window itself:
+//    K, high, bitmap low byte, bitmap high byte
+
+#define SeqWindowSize  16
+
+class SeqWindow
+{
+  private:
+    bool          valid = false;
+  public:
+    uint8_t       high = 0;
+    uint16_t      mask = 0;
+    unsigned long accepted = 0;
+    unsigned long duplicates = 0;
+    unsigned long stale = 0;        // Arrived after a later event
+    unsigned long gaps = 0;         // Sequence numbers skipped
+    bool          late = false;     // The last event was older than the highest, first seen
+    // Returns true if the event is new and not older than the highest seen
+    bool accept(uint8_t seq)
+    {
+      int8_t diff = seq - high;
+
+      late = false;
+      if(!valid || (diff < -SeqWindowSize))
+      {
+        // First event or the Remote has restarted its sequence
+        valid = true;
+        high = seq;
+        mask = 0;
+        accepted++;
+        return true;
+      }
+      if(diff > 0)
+      {
+        gaps += diff - 1;
+        mask = (diff > SeqWindowSize) ? 0 : ((uint32_t)mask << diff) | (1UL << (diff - 1));
+        high = seq;
+        accepted++;
+        return true;
+      }
+      if(diff == 0)
+      {
+        duplicates++;
+        return false;
+      }
+      uint16_t bit = 1 << (-diff - 1);
+      if(mask & bit) duplicates++;
+      else
+      {
+        mask |= bit;
+        stale++;
+        late = true;
+      }
+      return false;
+    }
+    void reset(void) { valid = false; }
+    // Starts a new stream with next as the next sequence number expected
+    void start(uint8_t next)
+    {
+      valid = true;
+      high = next - 1;
+      mask = 0xFFFF;
+    }
+    void resetStats(void) { accepted = duplicates = stale = gaps = 0; }
+};
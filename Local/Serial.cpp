@@ -10,6 +10,9 @@
 #include "string.h"
 #include "Serial.h"
 #include "Errors.h"
+#include "Response.h"
+#include "Profiler.h"
+#include "AllocTrack.h"
 #include "Local.h"
 #include <Wire.h>
 #include <SPI.h>
@@ -47,6 +50,8 @@ Commands  CmdArray[] =   {
   {"RESET",  CMDfunction, 0, (char *)Software_Reset},                     // System reboot
   {"SAVE",   CMDfunction, 0, (char *)SaveSettings},                       // Save settings
   {"RESTORE", CMDfunction, 0, (char *)RestoreSettings},                   // Restore settings
+  {"GTASKS", CMDfunction, 0, (char *)GetTasks},                           // Report task name, priority, calls, worst case uS, deadline misses
+  {"RTASKS", CMDfunction, 0, (char *)ResetTasks},                         // Reset the task statistics
 
 // General command
   {"PINMODE",  CMDfunctionStr, 2, (char *)SetPortDir},                    // Set pin mode, pin, INPUT or OUTPUT
@@ -60,11 +65,70 @@ Commands  CmdArray[] =   {
   {"GUDPRT",  CMDint, 0, (char *)&ld.udpPort},                            // Returns UDP port number
   {"STCP",  CMDint, 1, (char *)&ld.tcpPort},                              // Set TCP port number
   {"GTCP",  CMDint, 0, (char *)&ld.tcpPort},                              // Returns TCP port number
+  {"SRECPRT",  CMDint, 1, (char *)&ld.recordPort},                        // Set session recorder TCP port number
+  {"GRECPRT",  CMDint, 0, (char *)&ld.recordPort},                        // Returns session recorder TCP port number
   {"SIP", CMDfunctionStr, 1, (char *)SetIP},                              // Set IP address
   {"GIP", CMDfunction, 0, (char *)GetIP},                                 // Return IP address
 
 // Keyer commands
   {"SWPM",  CMDfunction, 1, (char *)SetWPM},                              // Set code speed, wpm
+  {"GWPM",  CMDint, 0, (char *)&ld.wpm},                                  // Returns code speed, wpm
+  {"SWEIGHT",  CMDfunction, 1, (char *)SetWeight},                        // Set mark/space weight in percent, 50 is standard
+  {"GWEIGHT",  CMDint, 0, (char *)&ld.weight},                            // Returns mark/space weight in percent
+  {"SRATIO",  CMDfunction, 1, (char *)SetRatio},                          // Set dah/dit ratio in tenths, 30 is standard
+  {"GRATIO",  CMDint, 0, (char *)&ld.ratio},                              // Returns dah/dit ratio in tenths
+  {"SFARNS",  CMDfunction, 1, (char *)SetFarnsworth},                     // Set Farnsworth character speed in WPM, 0 is off
+  {"GFARNS",  CMDint, 0, (char *)&ld.farnsworth},                         // Returns Farnsworth character speed in WPM
+  {"CWSEND",  CMDfunctionLine, 0, (char *)CWSend},                       // Append the rest of the line to the CW text queue, returns credits
+  {"CWABORT",  CMDfunction, 0, (char *)CWStop},                           // Abort CW text sending and clear the queue
+  {"GCWREM",  CMDfunction, 0, (char *)CWRemaining},                       // Returns the number of characters waiting to be sent
+  {"GCWCRED",  CMDfunction, 0, (char *)CWGetCredits},                     // Returns the free space in the CW text queue
+  {"SMSG",  CMDfunctionLine, 0, (char *)SetMessage},                      // Set memory keyer message, slot 1 to 4, text
+  {"GMSG",  CMDfunction, 1, (char *)GetMessage},                          // Returns memory keyer message, slot 1 to 4
+  {"PLAY",  CMDfunction, 1, (char *)PlayMessage},                         // Play memory keyer message, slot 1 to 4
+  {"SDECODE",  CMDbool, 1, (char *)&ld.decode},                          // Stream decoded transmit text to the TCP client, TRUE or FALSE
+  {"GDECODE",  CMDbool, 0, (char *)&ld.decode},                          // Returns decoded text streaming, TRUE or FALSE
+  {"GDECWPM",  CMDfunction, 0, (char *)DecoderWPM},                       // Returns the speed estimated by the decoder, wpm
+  {"SRECORD",  CMDbool, 1, (char *)&recorder.enabled},                   // Stream received messages to the record port client, TRUE or FALSE
+  {"GRECORD",  CMDbool, 0, (char *)&recorder.enabled},                   // Returns recording state, TRUE or FALSE
+  {"GRECSTAT",  CMDfunction, 0, (char *)RecordStats},                     // Returns messages recorded, lost
+  {"SESSION",   CMDfunction, 2, (char *)Session},                         // Remote session id and next sequence number, sent on connect
+  {"GSESSION",  CMDfunction, 0, (char *)GetSession},                      // Returns session id, resumes
+  {"GRXSTAT",   CMDfunction, 0, (char *)RxStats},                         // Returns key events accepted, duplicates, stale, gaps, acks sent, late key downs
+  {"RRXSTAT",   CMDfunction, 0, (char *)ResetRxStats},                    // Resets the key event receive statistics
+  {"SCOALESCE", CMDfunctionStr, 1, (char *)SetCoalesce},                  // Set superseded key event policy, OFF, REPLAY or LATEST
+  {"GCOALESCE", CMDfunction, 0, (char *)GetCoalesce},                     // Returns superseded key event policy
+  {"SREPLAYMAX", CMDfunction, 1, (char *)SetReplayMax},                   // Set longest replay of superseded key events, 0 to 5000 mS
+  {"GREPLAYMAX", CMDint, 0, (char *)&ld.replayMax},                       // Returns longest replay in mS
+  {"GRXBATCH",  CMDfunction, 0, (char *)BatchStats},                      // Returns batches, largest, reordered, coalesced, replayed, fallbacks
+  {"RRXBATCH",  CMDfunction, 0, (char *)ResetBatchStats},                 // Resets the receive batch statistics
+  {"GLOOP",     CMDfunction, 0, (char *)GetLoop},                         // Returns loops, overruns, worst uS, worst task, loop period histogram
+  {"RLOOP",     CMDfunction, 0, (char *)ResetLoop},                       // Resets the loop statistics
+  {"SLOOPBUD",  CMDint, 1, (char *)&loopStats.budget},                    // Set loop overrun budget in uS
+  {"GLOOPBUD",  CMDint, 0, (char *)&loopStats.budget},                    // Returns loop overrun budget in uS
+  {"GPROF",     CMDfunction, 0, (char *)GetProfile},                      // Returns name, calls, average and worst cycles for each profiler zone
+  {"RPROF",     CMDfunction, 0, (char *)ResetProfile},                    // Resets the profiler zones
+  {"GALLOC",    CMDfunction, 0, (char *)GetAlloc},                        // Returns live bytes, peak, allocations, frees, violations, then each call site
+  {"RALLOC",    CMDfunction, 0, (char *)ResetAlloc},                      // Resets the allocation peak, call sites and violations
+  {"SALLOCTEST", CMDfunctionStr, 1, (char *)SetAllocTest},                // Allocation test mode, TRUE or FALSE
+  {"GALLOCTEST", CMDfunction, 0, (char *)GetAllocTest},                   // Returns PASS or FAIL, zone, call site, bytes of the first hot path allocation
+  {"GLEASE",    CMDfunction, 0, (char *)GetLease},                        // Returns key down lease uS, renewal mean, deviation, renewals, expired, rekeys
+  {"SPTT",      CMDfunctionStr, 1, (char *)SetPTT},                       // Sequence the PTT output ahead of the key, TRUE or FALSE
+  {"GPTT",      CMDbool, 0, (char *)&ld.ptt},                             // Returns PTT sequencing, TRUE or FALSE
+  {"SPTTLEAD",  CMDfunction, 1, (char *)SetPTTLead},                      // Set PTT lead time before the first key down, 0 to 1000 mS
+  {"GPTTLEAD",  CMDint, 0, (char *)&ld.pttLead},                          // Returns PTT lead time in mS
+  {"SPTTTAIL",  CMDfunction, 1, (char *)SetPTTTail},                      // Set minimum PTT tail time after the last key up, 0 to 1000 mS
+  {"GPTTTAIL",  CMDint, 0, (char *)&ld.pttTail},                          // Returns PTT tail time in mS
+  {"SPTTHANG",  CMDfunction, 1, (char *)SetPTTHang},                      // Set key up time before PTT is released, 0 to 10000 mS
+  {"GPTTHANG",  CMDint, 0, (char *)&ld.pttHang},                          // Returns PTT hang time in mS
+  {"GPTTSTAT",  CMDfunction, 0, (char *)PTTStats},                        // Returns PTT ON/OFF, overs, raised by look ahead, first elements delayed, hot switch violations
+  {"RPTTSTAT",  CMDfunction, 0, (char *)ResetPTTStats},                   // Resets the PTT statistics
+  {"SAUTH",     CMDbool, 1, (char *)&ld.auth},                            // Drop UDP messages without a valid tag, TRUE or FALSE
+  {"GAUTH",     CMDbool, 0, (char *)&ld.auth},                            // Returns UDP authentication, TRUE or FALSE
+  {"SAUTHKEY",  CMDfunctionStr, 2, (char *)SetAuthKey},                   // Set the UDP authentication key, 32 hex digits as two groups of 16
+  {"GAUTHSTAT", CMDfunction, 0, (char *)AuthStats},                       // Returns messages passed, bad tag, replays, untagged
+  {"RAUTHSTAT", CMDfunction, 0, (char *)ResetAuthStats},                  // Resets the authentication statistics
+  {"BAUTH",     CMDfunction, 0, (char *)AuthBenchmark},                   // Returns uS to check a tagged message, SipHash self test PASS or FAIL
   {"SUDP",  CMDfunctionLine, 0, (char *)(static_cast<void (*)(void)>(String2upd))}, // Send message to udp processor
 
 // End of table marker
@@ -84,10 +148,12 @@ void GetCommands(void)
   }
 }
 
-// Delay command, delay is in millisecs
+// Delay command, delay is in millisecs. The keying tasks keep running while we wait.
 void DelayCommand(int dtime)
 {
-  delay(dtime);
+  unsigned long start = millis();
+
+  while((millis() - start) < (unsigned long)dtime) Yield();
   SendACK;
 }
 
@@ -123,36 +189,39 @@ void Char2Token(char ch)
   if (Tptr >= MaxToken) Tptr = MaxToken - 1;
 }
 
-// Get token from string object, delimited with comma
-// Token are numbered 1 through n, returns empty string
-// at end of tokens
-String GetToken(String cmd, int TokenNum)
+// Get token from a comma delimited string into token, size bytes at most.
+// Tokens are numbered 1 through n and are trimmed, returns token, an empty
+// string at end of tokens
+char *GetToken(const char *cmd, int TokenNum, char *token, int size)
 {
-  int i, j, k;
-  String Token;
+  int i;
 
-  // If TokenNum is 0 or 1 then return the first token.
-  // Return up to delimiter of the whole string.
-  cmd.trim();
-  if (TokenNum <= 1)
-  {
-    if ((i = cmd.indexOf(',')) == -1) return cmd;
-    Token = cmd.substring(0, i);
-    return Token;
-  }
-  // Find the requested token
-  k = 0;
   for (i = 2; i <= TokenNum; i++)
   {
-    if ((j = cmd.indexOf(',', k)) == -1) return "";
-    k = j + 1;
+    if ((cmd = strchr(cmd, ',')) == NULL)
+    {
+      token[0] = 0;
+      return token;
+    }
+    cmd++;
   }
-  Token = cmd.substring(k);
-  Token.trim();
-  if ((j = Token.indexOf(',')) == -1) return Token;
-  Token = Token.substring(0, j);
-  Token.trim();
-  return Token;
+  while (isspace(*cmd)) cmd++;
+  for (i = 0; (i < size - 1) && (cmd[i] != 0) && (cmd[i] != ','); i++) token[i] = cmd[i];
+  while ((i > 0) && isspace(token[i - 1])) i--;
+  token[i] = 0;
+  return token;
+}
+
+// Removes leading and trailing white space from a string in place, returns
+// a pointer to the first character kept
+char *Trim(char *str)
+{
+  int i;
+
+  while (isspace(*str)) str++;
+  for (i = strlen(str); (i > 0) && isspace(str[i - 1]); i--);
+  str[i] = 0;
+  return str;
 }
 
 // This function reads the serial input ring buffer and returns a pointer to a ascii token.
@@ -278,22 +347,42 @@ void ExecuteCommand(Commands *cmd, int arg1, int arg2, char *args1, char *args2,
   }
 }
 
-// This function processes serial commands.
+// Command responses are staged here and sent when the command is done
+Response response;
+
+static enum  PCstates state;
+static bool lstrmode = false;
+
+// This function processes serial commands. The output goes through the response
+// buffer, it is sent when a command is done or there is nothing left to do.
 // This function does not block and returns -1 if there was nothing to do.
 int ProcessCommand(void)
 {
-  String sToken;
-  char   *Token, ch;
+  int result;
+
+  if(serial == &response) return ProcessToken();
+  PROFILE_ZONE("ProcessCommand");
+  ALLOC_GUARD("ProcessCommand");
+  response.attach(serial);
+  serial = &response;
+  result = ProcessToken();
+  serial = response.target();
+  if((result != 0) || ((state == PCcmd) && !lstrmode)) response.flush();
+  return result;
+}
+
+// Processes the next token from the ring buffer
+int ProcessToken(void)
+{
+  char   *Token, *arg, ch;
   int    i;
   static int   arg1, arg2;
   static float farg1;
-  static enum  PCstates state;
   static int   CmdNum;
   static char  delimiter = 0;
   // The following variables are used for the long string reading mode
   static char *lstrptr = NULL;
   static int  lstrindex;
-  static bool lstrmode = false;
   static int lstrmax;
 
   // Wait for line in ringbuffer
@@ -372,27 +461,23 @@ int ProcessCommand(void)
       break;
     case PCarg1:
       Sarg1[0] = 0;
-      sToken = Token;
-      sToken.trim();
-      arg1 = sToken.toInt();
-      farg1 = sToken.toFloat();
-      strcpy(Sarg1, sToken.c_str());
+      arg = Trim(Token);
+      arg1 = atol(arg);
+      farg1 = atof(arg);
+      strcpy(Sarg1, arg);
       if (CmdArray[CmdNum].NumArgs > 1) state = PCarg2;
       else state = PCend;
       break;
     case PCarg2:
       Sarg2[0] = 0;
-      sToken = Token;
-      sToken.trim();
-      arg2 = sToken.toInt();
-      strcpy(Sarg2, sToken.c_str());
+      arg = Trim(Token);
+      arg2 = atol(arg);
+      strcpy(Sarg2, arg);
       if (CmdArray[CmdNum].NumArgs > 2) state = PCarg3;
       else state = PCend;
       break;
     case PCarg3:
-      sToken = Token;
-      sToken.trim();
-      farg1 = sToken.toFloat();
+      farg1 = atof(Trim(Token));
       state = PCend;
       break;
     case PCend:
@@ -100,9 +100,12 @@ void Debug(int i);
 
 // Function prototypes
 void SerialInit(void);
-String GetToken(String cmd, int TokenNum);
+char *GetToken(const char *cmd, int TokenNum, char *token, int size);
+char *Trim(char *str);
 char *GetToken(bool ReturnComma);
 int  ProcessCommand(void);
+void ExecuteCommand(Commands *cmd, int arg1, int arg2, char *args1, char *args2, float farg1);
+int  ProcessToken(void);
 void RB_Init(Ring_Buffer *);
 int  RB_Size(Ring_Buffer *);
 char RB_Put(Ring_Buffer *, char);
@@ -0,0 +1,196 @@
+#pragma once
+
+#include "Arduino.h"
+
+// UDP keying stream authentication. With a pre-shared 16 byte key each message
+// carries a 4 byte time stamp and a 4 byte tag after the payload:
+//    payload, stamp (little endian), tag (little endian)
+// The tag is the low 32 bits of SipHash-2-4 over the session id (8 bytes, little
+// endian), the payload and the stamp. The payload carries the sequence number.
+//
+// The stamp is the sender's mS clock times 16 plus a count, so it goes up with every
+// message even when several go out in the same mS. The receiver keeps the newest
+// stamp and a bitmap of the ReplayWindow before it, like the key event SeqWindow, and
+// drops a stamp it has seen or one older than the window. A retransmission gets a new
+// stamp so it is never mistaken for a replay.
+//
+// The Remote numbers its sessions from a boot counter and names the session in the
+// unauthenticated SESSION message, session() records it. A new session restarts the
+// stamps, so the replay window moves to it only when a message tagged with its id
+// verifies, and only if it is newer than the session the window holds. A forged
+// SESSION can not clear the window and messages recorded in an older session fail
+// the tag or are refused as old. reset() forgets the window, used only when the key
+// is changed.
+//
+// BAUTH measures the time per message on the target.
+
+#define AuthKeySize     16
+#define AuthTrailer     8           // Stamp and tag
+#define ReplayWindow    32          // Messages
+
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND                                                   \
+  do {                                                             \
+    v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32);  \
+    v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;                       \
+    v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;                       \
+    v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32);  \
+  } while(0)
+
+static inline uint64_t load64(const uint8_t *p)
+{
+  uint64_t v = 0;
+
+  for(int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+  return v;
+}
+
+// SipHash-2-4 of len bytes with a 16 byte key. A prefix is hashed as 8 bytes, little
+// endian, ahead of the data.
+inline uint64_t SipHash24(const uint8_t *key, const uint8_t *data, int len, const uint64_t *prefix = NULL)
+{
+  uint64_t k0 = load64(key);
+  uint64_t k1 = load64(key + 8);
+  uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+  uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+  uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+  uint64_t v3 = 0x7465646279746573ULL ^ k1;
+  uint64_t m;
+  int      i;
+
+  if(prefix != NULL)
+  {
+    v3 ^= *prefix;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= *prefix;
+  }
+  for(i = 0; i + 8 <= len; i += 8)
+  {
+    m = load64(data + i);
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+  }
+  m = (uint64_t)(len + ((prefix != NULL) ? 8 : 0)) << 56;
+  for(int j = 0; i + j < len; j++) m |= (uint64_t)data[i + j] << (8 * j);
+  v3 ^= m;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= m;
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+class Auth
+{
+  private:
+    bool          started = false;
+    uint16_t      current;          // Session the replay window belongs to
+    uint16_t      announced = 0;    // Session named by the last SESSION, tags are made with it
+    uint32_t      newest;           // Newest stamp accepted
+    uint32_t      seen;             // Bit n set when newest-1-n has been accepted
+    uint32_t      last = 0;         // Last stamp sent
+    static void put32(uint8_t *p, uint32_t v) { for(int i = 0; i < 4; i++) p[i] = v >> (8 * i); }
+    static uint32_t get32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+  public:
+    uint8_t       key[AuthKeySize];
+    unsigned long passed = 0;
+    unsigned long badTag = 0;
+    unsigned long replays = 0;
+    unsigned long untagged = 0;     // Too short to carry a tag
+    Auth(void) { memset(key, 0, sizeof(key)); }
+    void setKey(const uint8_t *k) { memcpy(key, k, AuthKeySize); }
+    uint32_t tag(const uint8_t *buf, int len, uint16_t id)
+    {
+      uint64_t prefix = id;
+
+      return (uint32_t)SipHash24(key, buf, len, &prefix);
+    }
+    // Names the session, the sender tags with it and the receiver moves to it once a
+    // message tagged with it verifies
+    void session(uint16_t id) { announced = id; }
+    // Appends the stamp and tag, buf must have AuthTrailer bytes free. Returns the new
+    // length.
+    int sign(uint8_t *buf, int len, uint32_t ms)
+    {
+      uint32_t stamp = ms << 4;
+
+      if((int32_t)(stamp - last) <= 0) stamp = last + 1;
+      last = stamp;
+      put32(buf + len, stamp);
+      put32(buf + len + 4, tag(buf, len + 4, announced));
+      return len + AuthTrailer;
+    }
+    // Checks a message and strips the trailer, returns false if it is to be dropped
+    bool verify(uint8_t *buf, int &len)
+    {
+      if(len <= AuthTrailer) { untagged++; return false; }
+      int n = len - AuthTrailer;
+      uint32_t t = get32(buf + n + 4);
+      bool     moved = false;
+      if(!started || (t != tag(buf, n + 4, current)))
+      {
+        // Only a newer session moves the window
+        if((started && ((int16_t)(announced - current) <= 0)) || (t != tag(buf, n + 4, announced))) { badTag++; return false; }
+        moved = true;
+      }
+      uint32_t stamp = get32(buf + n);
+      int32_t  diff = stamp - newest;
+      if(moved)
+      {
+        started = true;
+        current = announced;
+        newest = stamp;
+        seen = 0;
+      }
+      else if(diff > 0)
+      {
+        seen = (diff > ReplayWindow) ? 0 : ((diff == 32) ? 0 : seen << diff) | (1UL << (diff - 1));
+        newest = stamp;
+      }
+      else
+      {
+        // Range first, the shift is only defined inside the window
+        if((diff == 0) || (diff < -ReplayWindow)) { replays++; return false; }
+        uint32_t bit = 1UL << (-diff - 1);
+        if(seen & bit) { replays++; return false; }
+        seen |= bit;
+      }
+      passed++;
+      len = n;
+      buf[n] = 0;
+      return true;
+    }
+    // Forgets the replay window, the next message that verifies under the announced
+    // session starts it again. Only for a key change.
+    void reset(void) { started = false; }
+    void resetStats(void) { passed = badTag = replays = untagged = 0; }
+    // Converts 32 hex digits to a key, returns false if the string is not valid
+    static bool parseKey(const char *hex, uint8_t *out)
+    {
+      if(strlen(hex) != 2 * AuthKeySize) return false;
+      for(int i = 0; i < 2 * AuthKeySize; i++)
+      {
+        char c = toupper(hex[i]);
+        int  d = ((c >= '0') && (c <= '9')) ? c - '0' : ((c >= 'A') && (c <= 'F')) ? c - 'A' + 10 : -1;
+        if(d < 0) return false;
+        if(i & 1) out[i / 2] |= d;
+        else out[i / 2] = d << 4;
+      }
+      return true;
+    }
+    // Self test against the SipHash reference vector, key 00..0f and message 00..0e
+    static bool selfTest(void)
+    {
+      uint8_t k[AuthKeySize], m[15];
+      for(int i = 0; i < AuthKeySize; i++) k[i] = i;
+      for(int i = 0; i < 15; i++) m[i] = i;
+      return SipHash24(k, m, 15) == 0xa129ca6149be45e5ULL;
+    }
+};
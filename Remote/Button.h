@@ -2,38 +2,63 @@
 #define button_h
 
 #include "Arduino.h"
+#include "FastPin.h"
 
-class Button
+// Debounced input, the pin is a template argument so it is read directly from the
+// port. Each call shifts in one sample, the overloads that take a level are used
+// when the caller has already sampled the port.
+template <uint8_t btn> class Button
 {
   private:
-    uint8_t btn;
     uint16_t state;
+    void sample(bool level) { state = (state<<1) | level | 0xfe00; }
   public:
-    void begin(uint8_t button) 
+    void begin(void) 
     {
-      btn = button;
       state = 0;
       pinMode(btn, INPUT_PULLUP);
     }
-    bool pressed() 
+    bool pressed() { return pressed(FastPin<btn>::read()); }
+    bool released() { return released(FastPin<btn>::read()); }
+    bool down() { return down(FastPin<btn>::read()); }
+    bool up() { return up(FastPin<btn>::read()); }
+    bool pressed(bool level) 
     {
-      state = (state<<1) | digitalRead(btn) | 0xfe00;
+      sample(level);
       return (state == 0xff00);
     }
-    bool released()
+    bool released(bool level)
     {
-      state = (state<<1) | digitalRead(btn) | 0xfe00;
+      sample(level);
       return (state == 0xfeff);       
     }
-    bool down() 
+    bool down(bool level) 
     {
-      state = (state<<1) | digitalRead(btn) | 0xfe00;
+      sample(level);
       return (state == 0xfe00);             
     }
-    bool up() 
+    bool up(bool level) 
     {
-      state = (state<<1) | digitalRead(btn) | 0xfe00;
+      sample(level);
       return (state == 0xffff);                   
     }
+    // Shifts in one sample, returns 1 while the input has been down for 9 samples,
+    // -1 while it has been up for 9, else 0
+    int debounce(bool level)
+    {
+      sample(level);
+      if(state == 0xfe00) return 1;
+      if(state == 0xffff) return -1;
+      return 0;
+    }
+    // Shifts in one sample, returns 1 on a debounced press, -1 on a debounced
+    // release, else 0
+    int edge() 
+    {
+      sample(FastPin<btn>::read());
+      if(state == 0xff00) return 1;
+      if(state == 0xfeff) return -1;
+      return 0;
+    }
 };
 #endif
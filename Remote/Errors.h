@@ -81,4 +81,5 @@ extern int ErrorCode;
 #define ERR_ADCNOTSETUP             126     // ADC interface is not setup
 #define ERR_CLIENTNOTCONNECTED      127     // No connection to Client
 #define ERR_WIFINOTCONNECTED        128     // WiFi is not connected
+#define ERR_BADFRAME                130     // Binary frame length or CRC error
 #endif
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Single producer single consumer event queue. One side only calls push and the
+// other side only calls pop so no locking is needed, the producer can be an ISR.
+// Size must be a power of 2 and no larger than 256, one slot is always kept empty.
+
+typedef struct
+{
+  char      Type;                 // UDP message type, D, U, ., -, E or p
+  uint32_t  Time;                 // Time the event was queued in uS
+  // Character frame, E, only
+  uint8_t   Char;                 // Character number
+  uint8_t   Count;                // Elements so far
+  uint8_t   Bits;                 // Element n is a dah if bit n is set
+} KeyEvent;
+
+template <class T, int Size = 16> class EventQueue
+{
+  private:
+    T                 buffer[Size];
+    volatile uint8_t  head = 0;   // Next slot to write, only changed by push
+    volatile uint8_t  tail = 0;   // Next slot to read, only changed by pop
+    uint8_t           maxDepth = 0;
+    unsigned long     overflows = 0;
+  public:
+    bool push(const T &event)
+    {
+      uint8_t next = (head + 1) & (Size - 1);
+
+      if(next == tail)
+      {
+        overflows++;
+        return false;
+      }
+      buffer[head] = event;
+      // Make sure the event is written before the consumer can see it
+      asm volatile("" ::: "memory");
+      head = next;
+      uint8_t depth = (head - tail) & (Size - 1);
+      if(depth > maxDepth) maxDepth = depth;
+      return true;
+    }
+    bool pop(T &event)
+    {
+      if(tail == head) return false;
+      event = buffer[tail];
+      asm volatile("" ::: "memory");
+      tail = (tail + 1) & (Size - 1);
+      return true;
+    }
+    int count(void) { return (head - tail) & (Size - 1); }
+    int highWater(void) { return maxDepth; }
+    unsigned long overflowed(void) { return overflows; }
+    void resetStats(void) { maxDepth = 0; overflows = 0; }
+};
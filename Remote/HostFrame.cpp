@@ -0,0 +1,391 @@
+/*
+ * HostFrame.cpp
+ *
+ * Binary framed host protocol, see HostFrame.h for the frame format. Characters
+ * that are not part of a frame are passed on to the ASCII command processor.
+ *
+ */
+#include "Arduino.h"
+#include "Serial.h"
+#include "Errors.h"
+#include "HostFrame.h"
+
+extern Commands CmdArray[];
+
+// Binary command ids, an id is the position of the command name here. Entries are
+// only ever appended, an id is never renumbered or reused, so a host keeps working
+// across builds whatever order the command table is in. Commands the device does
+// not have are refused with ERR_BADCMD.
+static const char *const FrameIds[] =
+{
+  // Both
+  "GVER", "GERR", "ECHO",
+  "SWPM", "GWPM", "SWEIGHT", "GWEIGHT", "SRATIO", "GRATIO", "SFARNS", "GFARNS",
+  "SLOOPBUD", "GLOOPBUD", "SAUTH", "GAUTH",
+  // Local
+  "SUDPRT", "GUDPRT", "STCP", "GTCP", "SRECPRT", "GRECPRT", "SIP",
+  "SDECODE", "GDECODE", "SRECORD", "GRECORD", "SCOALESCE", "SREPLAYMAX", "GREPLAYMAX",
+  "SPTT", "GPTT", "SPTTLEAD", "GPTTLEAD", "SPTTTAIL", "GPTTTAIL", "SPTTHANG", "GPTTHANG",
+  // Remote
+  "SHOST", "GHOST", "SPSWD", "GPSWD", "SSSID", "GSSID", "SSRVIP",
+  "SPINGACT", "GPINGACT", "SPINGIDLE", "GPINGIDLE", "SPINGHOLD", "GPINGHOLD", "SWARMUP", "GWARMUP",
+  "SMUTEENA", "GMUTEENA", "SMUTETM", "GMUTETM", "SDDMODE", "GDDMODE", "SCHARMODE", "GCHARMODE",
+  "SSTENA", "GSTENA", "SSTFREQ", "GSTFREQ",
+};
+
+#define NumFrameIds  ((int)(sizeof(FrameIds) / sizeof(FrameIds[0])))
+static_assert(NumFrameIds <= 256, "Binary command ids are one byte");
+
+// Command table index of each id, -1 if the device does not have it
+static int16_t  cmdIndex[NumFrameIds];
+static bool     indexed = false;
+
+// Frame receive state of each stream, a frame from one stream is not broken by
+// characters from another
+#define MaxFrameStreams  3
+
+typedef struct
+{
+  Stream    *src;
+  uint8_t   frame[MaxFrame + 4];
+  int       len;                    // Bytes received, -1 when not in a frame
+  uint32_t  start;
+} FrameRx;
+
+static FrameRx  rx[MaxFrameStreams] = {{NULL}};
+
+// Reply being built
+static uint8_t  reply[MaxFrame + 4];
+static int      replyLen;
+
+// Watched values, each with a CRC of its last value
+static uint8_t  watchIds[MaxWatch];
+static uint16_t watchSig[MaxWatch];
+static int      numWatch = 0;
+static Stream   *watcher = NULL;
+static uint32_t watchTime;
+
+uint16_t CRC16(const uint8_t *data, int len)
+{
+  uint16_t crc = 0xFFFF;
+
+  for(int i = 0; i < len; i++)
+  {
+    crc ^= data[i] << 8;
+    for(int b = 0; b < 8; b++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// Returns the command with binary id, NULL if this device does not have it
+static Commands *FrameCmd(int id)
+{
+  if(!indexed)
+  {
+    for(int i = 0; i < NumFrameIds; i++)
+    {
+      cmdIndex[i] = -1;
+      for(int j = 0; CmdArray[j].Cmd != 0; j++) if(strcmp(CmdArray[j].Cmd, FrameIds[i]) == 0) cmdIndex[i] = j;
+    }
+    indexed = true;
+  }
+  if((id >= NumFrameIds) || (cmdIndex[id] < 0)) return NULL;
+  return &CmdArray[cmdIndex[id]];
+}
+
+// Returns true if id is a command that holds a value
+static bool IsValue(int id)
+{
+  Commands *cmd = FrameCmd(id);
+
+  if(cmd == NULL) return false;
+  switch (cmd->Type)
+  {
+    case CMDint:
+    case CMDbool:
+    case CMDfloat:
+    case CMDstr:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns the value type of a set command, int for a function with an int argument
+// and string for one with a string argument. Returns CMDna if id can not be set.
+static CmdTypes SetType(int id)
+{
+  Commands *cmd = FrameCmd(id);
+
+  if((cmd == NULL) || (cmd->NumArgs != 1)) return CMDna;
+  switch (cmd->Type)
+  {
+    case CMDint:
+    case CMDbool:
+    case CMDfloat:
+    case CMDstr:
+      return cmd->Type;
+    case CMDfunction:
+      return CMDint;
+    case CMDfunctionStr:
+      return CMDstr;
+    default:
+      return CMDna;
+  }
+}
+
+// Returns the size of the value and points data at it
+static int ValueData(int id, const uint8_t **data)
+{
+  Commands *cmd = FrameCmd(id);
+
+  *data = (const uint8_t *)cmd->pointers.charPtr;
+  switch (cmd->Type)
+  {
+    case CMDint:   return 4;
+    case CMDfloat: return 4;
+    case CMDbool:  return 1;
+    case CMDstr:   return (strlen(cmd->pointers.charPtr) > 255) ? 255 : strlen(cmd->pointers.charPtr);
+    default:       return 0;
+  }
+}
+
+static void ReplyStart(char op)
+{
+  reply[0] = STX;
+  reply[2] = op;
+  replyLen = 3;
+}
+
+static bool ReplyPut(const uint8_t *data, int len)
+{
+  if((replyLen + len) > (MaxFrame + 2)) return false;
+  memcpy(&reply[replyLen], data, len);
+  replyLen += len;
+  return true;
+}
+
+static void ReplySend(Stream *s)
+{
+  reply[1] = replyLen - 2;
+  uint16_t crc = CRC16(&reply[1], replyLen - 1);
+  reply[replyLen++] = crc >> 8;
+  reply[replyLen++] = crc & 0xFF;
+  s->write(reply, replyLen);
+}
+
+static void ReplyError(Stream *s, int err)
+{
+  uint8_t e = err;
+
+  SetErrorCode(err);
+  ReplyStart('n');
+  ReplyPut(&e, 1);
+  ReplySend(s);
+}
+
+// Adds id, type and value to the reply
+static bool ReplyValue(int id)
+{
+  const uint8_t *data;
+  int  len = ValueData(id, &data);
+  CmdTypes type = FrameCmd(id)->Type;
+  uint8_t hdr[3] = {(uint8_t)id, (uint8_t)type, (uint8_t)len};
+
+  if(!ReplyPut(hdr, (type == CMDstr) ? 3 : 2)) return false;
+  return ReplyPut(data, len);
+}
+
+static uint16_t ValueSig(int id)
+{
+  const uint8_t *data;
+  int  len = ValueData(id, &data);
+
+  return CRC16(data, len);
+}
+
+// Sets one value by running its set command, muted, so it gets the same range
+// checks as the ASCII command. Returns 0 or the error code the command set.
+static int SetValue(Commands *cmd, CmdTypes type, const uint8_t *data, int size)
+{
+  char  str[MaxFrameStr + 1];
+  int   arg = 0;
+  float farg = 0;
+  int   lastError = ErrorCode;
+  bool  mute = SerialMute;
+
+  switch (type)
+  {
+    case CMDint:
+      memcpy(&arg, data, 4);
+      break;
+    case CMDfloat:
+      memcpy(&farg, data, 4);
+      break;
+    case CMDbool:
+      strcpy(str, data[0] ? "TRUE" : "FALSE");
+      break;
+    default:
+      memcpy(str, data, size);
+      str[size] = 0;
+      break;
+  }
+  SetErrorCode(0);
+  SerialMute = true;
+  ExecuteCommand(cmd, arg, 0, str, NULL, farg);
+  SerialMute = mute;
+  if(ErrorCode != 0) return ErrorCode;
+  SetErrorCode(lastError);
+  return 0;
+}
+
+// Sets the values in an S frame. The whole frame is checked for unknown ids and
+// short values first, then each value is set in order and the first one its set
+// command refuses stops the rest. Returns 0 or an error code.
+static int SetValues(const uint8_t *p, int len, bool apply)
+{
+  int      i = 1, size, err;
+  CmdTypes type;
+
+  while(i < len)
+  {
+    if((type = SetType(p[i])) == CMDna) return ERR_BADCMD;
+    Commands *cmd = FrameCmd(p[i++]);
+    switch (type)
+    {
+      case CMDint:
+      case CMDfloat:
+        size = 4;
+        break;
+      case CMDbool:
+        size = 1;
+        break;
+      default:
+        if(i >= len) return ERR_BADARG;
+        size = p[i++];
+        if(size > MaxFrameStr) return ERR_BADARG;
+        break;
+    }
+    if((i + size) > len) return ERR_BADARG;
+    if(apply && ((err = SetValue(cmd, type, &p[i], size)) != 0)) return err;
+    i += size;
+  }
+  return 0;
+}
+
+static void Execute(const uint8_t *frame, Stream *src)
+{
+  const uint8_t *p = &frame[2];
+  int  len = frame[1];
+  int  i, err;
+
+  switch (p[0])
+  {
+    case 'G':
+      ReplyStart('g');
+      for(i = 1; i < len; i++)
+      {
+        if(!IsValue(p[i])) { ReplyError(src, ERR_BADCMD); return; }
+        if(!ReplyValue(p[i])) { ReplyError(src, ERR_BADARG); return; }
+      }
+      ReplySend(src);
+      break;
+    case 'S':
+      if((err = SetValues(p, len, false)) != 0) { ReplyError(src, err); return; }
+      if((err = SetValues(p, len, true)) != 0) { ReplyError(src, err); return; }
+      ReplyStart('s');
+      ReplySend(src);
+      break;
+    case 'W':
+      if((len - 1) > MaxWatch) { ReplyError(src, ERR_BADARG); return; }
+      for(i = 1; i < len; i++) if(!IsValue(p[i])) { ReplyError(src, ERR_BADCMD); return; }
+      numWatch = 0;
+      for(i = 1; i < len; i++)
+      {
+        watchIds[numWatch] = p[i];
+        watchSig[numWatch++] = ValueSig(p[i]);
+      }
+      watcher = src;
+      watchTime = millis();
+      ReplyStart('w');
+      ReplySend(src);
+      break;
+    default:
+      ReplyError(src, ERR_BADCMD);
+      break;
+  }
+}
+
+// Returns the receive state of a stream, a new stream takes a slot that is not in
+// a frame. NULL if every slot is part way through a frame.
+static FrameRx *StreamRx(Stream *src)
+{
+  FrameRx *free = NULL;
+
+  for(int i = 0; i < MaxFrameStreams; i++)
+  {
+    if(rx[i].src == src) return &rx[i];
+    if((free == NULL) && ((rx[i].src == NULL) || (rx[i].len < 0))) free = &rx[i];
+  }
+  if(free == NULL) return NULL;
+  free->src = src;
+  free->len = -1;
+  return free;
+}
+
+// Call with every character received from the host
+void HostInput(char ch, Stream *src)
+{
+  uint8_t c = ch;
+  FrameRx *r = StreamRx(src);
+
+  if(r == NULL)
+  {
+    PutCh(ch);
+    return;
+  }
+  if((r->len >= 0) && ((millis() - r->start) > FrameTimeout)) r->len = -1;
+  if(r->len < 0)
+  {
+    if(c != STX)
+    {
+      PutCh(ch);
+      return;
+    }
+    r->len = 0;
+    r->start = millis();
+  }
+  r->frame[r->len++] = c;
+  if(r->len < 2) return;
+  int total = r->frame[1] + 4;
+  if(r->len < total) return;
+  r->len = -1;
+  uint16_t crc = (r->frame[total - 2] << 8) | r->frame[total - 1];
+  if((r->frame[1] == 0) || (CRC16(&r->frame[1], r->frame[1] + 1) != crc))
+  {
+    ReplyError(src, ERR_BADFRAME);
+    return;
+  }
+  Execute(r->frame, src);
+}
+
+// Sends the watched values that changed, call often
+void HostPoll(void)
+{
+  bool changed = false;
+
+  if((numWatch == 0) || (watcher == NULL)) return;
+  if((millis() - watchTime) < WatchPeriod) return;
+  watchTime = millis();
+  ReplyStart('u');
+  for(int i = 0; i < numWatch; i++)
+  {
+    uint16_t sig = ValueSig(watchIds[i]);
+    if(sig == watchSig[i]) continue;
+    // Values that do not fit are sent on the next check
+    if(!ReplyValue(watchIds[i])) break;
+    watchSig[i] = sig;
+    changed = true;
+  }
+  if(changed) ReplySend(watcher);
+}
@@ -1,12 +1,62 @@
 // Keyer.h - Morse code iambic keyer library
 //
-//
+// Keyer iambic modes:
+//  A - When both paddles are released the current dit or dah is finished.
+//  B - When both paddles are released the current dit or dah is finished and then
+//      the opposite is sent. 
+//  Ultimatic - When squeezed the last paddle detected defines the repeating element
+/*
+ * 
+Non iambic mode
+
+  If dit paddle pressed
+    - generate dit and loop while pressed
+  if dah paddle pressed
+    - generate dah and loop while pressed
+
+Iambic A mode
+
+  If both paddles are released then cancel the insert
+  If dit paddle pressed or insert dit
+    - generate dit
+      - during dit generation look for dah, set insert dah if detected
+  If dah paddle pressed or insert dah
+    - generate dah
+      - during dit generation look for dah, set insert dit if detected
+
+Iambic B mode
+
+  If dit paddle pressed or insert dit
+    - generate dit
+      - during dit generation look for dah, set insert dah if detected
+  If dah paddle pressed or insert dah
+    - generate dah
+      - during dit generation look for dah, set insert dit if detected
+
+Ultamatic mode
+
+  if both paddles pressed and insert dit set
+    - generate dir
+  if both paddles pressed and insert dah set
+    - generate dah
+  If dit paddle pressed
+    - generate dit and loop while pressed
+    - If dah paddle is pressed exit and set insert dah
+  if dah paddle pressed
+    - generate dah and loop while pressed
+    - if dit paddle is pressed exit and set insert dit * 
+ * 
+ */
 
 #pragma once
 
 #include <Arduino.h>
 
 #include "Button.h"
+#include "FastPin.h"
+#include "Profiler.h"
+#include "AllocTrack.h"
+#include "Timing.h"
 
 // Defaults
 #define defaultDitPin          14
@@ -34,21 +84,126 @@ enum KeyerModes
   ModeUltimatic
 };
 
+// Element player states
+enum ElementStates
+{
+  ElementIdle,
+  ElementMark,
+  ElementSpace
+};
+
+// Paddle and straight key sample interval, uS. The debounce is 9 samples.
+#define SampleInterval         1000
+
+// The pins and key polarity are template arguments so the paddles are sampled with
+// one port read and the key output is written to the port registers directly.
+//
+// process() never blocks. Each element is timed from its planned start so a late
+// call moves one edge and the error does not add up, and a held paddle repeats
+// with an exact element space. Call it as often as possible, slack() tells the
+// caller how long it has before the next key edge is due.
+template <uint8_t straightKey = defaultStraightKeyPin, uint8_t dit = defaultDitPin, uint8_t dah = defaultDahPin,
+          uint8_t key = defaultKeyPin, uint8_t sidetonePin = defaultSidetonePin, bool activeLow = false>
 class Keyer
 {
     public:
-        Keyer();
-        void begin();
-        void begin(int straightKey, int dit, int dah, int key, int sidetone);
+        Keyer()
+        {
+            KeyIsDown = KeyIsUp = SendingDit = SendingDah = NULL;
+            insertDit = insertDah = false;
+            STenable = true;
+            DDmode = false;
+            paused = false;
+            state = ElementIdle;
+        }
+        // Initialize the I/O pins used by the keyer
+        void begin()
+        {
+            ditPin.begin();
+            dahPin.begin();
+            straightKeyPin.begin();
+
+            pinMode(key, OUTPUT);
+            pinMode(sidetonePin, OUTPUT);
+
+            Mode  = defaultMode;
+            timing.set(defaultWPM);
+            sidetoneFreq = defaultSidetoneFreq;
 
-        void process(void);
-        int  getSpeed(void);
-        void setSpeed(int newWPM);
+            state = ElementIdle;
+            lastSample = micros();
+            keyUp();
+        }
+
+        void process(void)
+        {
+            PROFILE_ZONE("Keyer::process");
+            ALLOC_GUARD("Keyer::process");
+            if(paused) return;
+
+            uint32_t now = micros();
+            bool     tick = (now - lastSample) >= SampleInterval;
+
+            if(tick) lastSample = now;
+            if(state == ElementIdle)
+            {
+                if(!tick) return;
+                int straight = straightKeyPin.debounce(FastPin<straightKey>::read());
+                if((straight > 0) && !isDown) keyDown();
+                if((straight < 0) && isDown) keyUp();
+                next(now, false);
+                return;
+            }
+            if(tick) watch();
+            while((state != ElementIdle) && ((micros() - elementStart) >= elementLen))
+            {
+                elementStart += elementLen;
+                if(state == ElementMark)
+                {
+                    keyUp(DDmode);
+                    state = ElementSpace;
+                    elementLen = timing.Element;
+                    continue;
+                }
+                // The next element starts exactly at the end of this space
+                state = ElementIdle;
+                if(sendingDah) insertDah = false;
+                else insertDit = false;
+                next(elementStart, !sendingDah);
+            }
+        }
+        // Time before the next key edge is due, uS, 0xFFFFFFFF when no element is
+        // being sent
+        uint32_t slack(void)
+        {
+            if(state == ElementIdle) return 0xFFFFFFFF;
+            uint32_t t = micros() - elementStart;
+            return (t < elementLen) ? elementLen - t : 0;
+        }
+        // True when no element is being sent and the straight key is up
+        bool idle(void) { return (state == ElementIdle) && !isDown; }
+        int  getSpeed(void) { return timing.wpm(); }
+        void setSpeed(int newWPM) { timing.set(newWPM); }
+        // Sets speed, weight, dah/dit ratio and Farnsworth character speed, the timing
+        // table is only rebuilt if something changed
+        void setTiming(int newWPM, int weight, int ratio, int farnsworth) { timing.set(newWPM, weight, ratio, farnsworth); }
+        Timing &getTiming(void) { return timing; }
+        // A paused keyer ignores the paddles and the straight key
+        void pause(bool on)
+        {
+            paused = on;
+            if(!paused) return;
+            if(isDown) keyUp();
+            state = ElementIdle;
+            insertDit = insertDah = false;
+        }
+        KeyerModes getMode(void) { return(Mode); }
+        void setMode(KeyerModes md) { Mode = md; }
         bool getDDmode(void) { return(DDmode); }
         void setDDmode(bool md) { DDmode=md; }
-        int  getSidetoneFreq();
+        int  getSidetoneFreq() { return sidetoneFreq; }
         void enableSidetone(bool state) { STenable = state; }
-        void setSidetoneFreq(int newFreq);
+        void setSidetoneFreq(int newFreq) { sidetoneFreq = newFreq; }
 
         void attachKeyDownCallBack(void (*fun)(void)) { KeyIsDown = fun; }
         void attachKeyUpCallBack(void (*fun)(void)) { KeyIsUp = fun; }
@@ -61,31 +216,80 @@ class Keyer
         void (*SendingDit)(void);
         void (*SendingDah)(void);
         
-        int WPM;
+        Timing timing;
  
         KeyerModes Mode;
         bool STenable;
         bool insertDit;
         bool insertDah;
-        bool activeLow;
         bool isDown;
         bool DDmode;
-        int  ditTime;
+        bool paused;
         
-        Button ditPin;
-        Button dahPin;
-        Button straightKeyPin;
-        int keyPin;
-        int sidetonePin;
+        Button<dit> ditPin;
+        Button<dah> dahPin;
+        Button<straightKey> straightKeyPin;
 
         int sidetoneFreq;
 
-        uint32_t endTime;
+        // Element being sent
+        ElementStates state;
+        bool          sendingDah;
+        uint32_t      elementStart;         // Planned start of the mark or space, uS
+        uint32_t      elementLen;           // uS
+        uint32_t      lastSample;           // uS
+
+        // Paddle samples while an element is sent, a press is remembered as an insert
+        void watch(void)
+        {
+            bool ditLevel, dahLevel;
+
+            FastPair<dit, dah>::read(ditLevel, dahLevel);
+            if(ditPin.down(ditLevel)) insertDit = true;
+            if(dahPin.down(dahLevel)) insertDah = true;
+        }
+        void start(bool isDah, uint32_t at)
+        {
+            if(isDah && (SendingDah != NULL)) SendingDah();
+            if(!isDah && (SendingDit != NULL)) SendingDit();
+            keyDown(DDmode);
+            sendingDah = isDah;
+            state = ElementMark;
+            elementStart = at;
+            elementLen = isDah ? timing.Dah : timing.Dit;
+        }
+        // Picks the next element, at is its start time. After a dit the dah paddle is
+        // looked at first so a squeeze alternates.
+        void next(uint32_t at, bool dahFirst)
+        {
+            bool ditLevel, dahLevel;
 
-        void iambic(void);
-        void delayAndWatchKey(int duration);
-        void sendDit(void);
-        void sendDah(void);
-        void keyDown(bool noSend = false);
-        void keyUp(bool noSend = false);
+            FastPair<dit, dah>::read(ditLevel, dahLevel);
+            switch (Mode)
+            {
+              case ModeNonIambic:
+                if(dahFirst && (insertDah || dahPin.down(dahLevel))) { start(true, at); break; }
+                if(insertDit || ditPin.down(ditLevel)) { start(false, at); break; }
+                if(!dahFirst && (insertDah || dahPin.down(dahLevel))) start(true, at);
+                break;
+              default:
+                break;
+            }
+        }
+        void keyDown(bool noSend = false)
+        {
+            if (activeLow) FastPin<key>::clear();
+            else FastPin<key>::set();
+            isDown = true;
+            if((KeyIsDown != NULL) && (!DDmode)) KeyIsDown();
+            if(STenable) tone(sidetonePin, sidetoneFreq);
+        }
+        void keyUp(bool noSend = false)
+        {
+            if (activeLow) FastPin<key>::set();
+            else FastPin<key>::clear();
+            isDown = false;
+            if((KeyIsUp != NULL) && (!DDmode)) KeyIsUp();
+            noTone(sidetonePin);
+        }
 };
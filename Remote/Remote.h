@@ -2,6 +2,8 @@
 
 #include <Arduino.h>
 #include <Ethernet.h>
+#include "LoopStats.h"
+#include "Auth.h"
 
 #define SIGNATURE  0xAA55A5A5
 
@@ -36,10 +38,33 @@ typedef struct
   bool          MuteEnable;        // External fred through audio mute
   int           MuteHold;          // Mute hold time in mS after key
   int           DDmode;            // If true then paddle uses high level command, dit and dah
+  int           Weight;            // Mark/space weight in percent, 50 is standard
+  int           Ratio;             // Dah/dit ratio in tenths, 30 is standard
+  int           Farnsworth;        // Farnsworth character speed in WPM, 0 is off
+  // Keep alive parameters
+  int           PingActive;        // Keep alive interval in mS while the operator is active
+  int           PingIdle;          // Longest keep alive interval in mS when idle
+  int           PingHold;          // Idle after this many mS with no paddle or key contact
+  int           Warmup;            // Keep alive packets sent on the first contact after idle
+  bool          CharMode;          // In DDmode send character frames, E, in place of . and -
+  // UDP authentication
+  bool          AuthEnable;        // Tag every UDP message to the Local
+  uint8_t       AuthKey[AuthKeySize];
   int           Signature;         // Must be 0xAA55A5A5 for valid data
 } RemoteData;
 
 extern RemoteData rd;
+extern LoopStats loopStats;
+
+// Connection manager states
+enum LinkStates
+{
+  LinkIdle,                        // Not wanted, WiFi and TCP are left alone
+  LinkWiFi,                        // Waiting for the WiFi to associate
+  LinkTCP,                         // WiFi is up, open the TCP connection to the Local
+  LinkUp,                          // Connected, watching WiFi and TCP health
+  LinkBackoff                      // Waiting to retry
+};
 
 // Prototypes
 void listNetworks(void);
@@ -48,6 +73,10 @@ void SaveSettings(void);
 void RestoreSettings(void);
 void SetSrvIP(char *ip);
 void GetSrvIP(void);
+void SetWPM(int wpm);
+void SetWeight(int weight);
+void SetRatio(int ratio);
+void SetFarnsworth(int farnsworth);
 void Connect(void);
 void Disconnect(void);
 void Status(void);
@@ -55,3 +84,24 @@ void OpenClient(void);
 void CloseClient(void);
 void SendClientMessage(void);
 void GetClientMessage(void);
+void NetStats(void);
+void SendTiming(void);
+void SendPlayMessage(int slot);
+void ResetNetStats(void);
+void AckStats(void);
+void LinkConnect(void);
+void LinkDisconnect(void);
+void LinkStats(void);
+void GetProfile(void);
+void GetLoop(void);
+void ResetLoop(void);
+void ResetProfile(void);
+void GetAlloc(void);
+void ResetAlloc(void);
+void SetAllocTest(char *state);
+void GetAllocTest(void);
+void KeepAliveStats(void);
+void SetAuthKey(char *first, char *second);
+void AuthBenchmark(void);
+void ConnectionTask(void);
+void printEncryptionType(int thisType);
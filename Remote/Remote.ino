@@ -27,8 +27,12 @@
  *    - Blanks computer audio during key operation
  *    - Connection status LED
  *    - Connection button to initiate link
+ *    - Adaptive keep alive with a warm up burst on the first contact after idle
+ *    - Reconnects with backoff after WiFi or TCP loss and resumes the session
+ *    - Optional SipHash tag on every UDP message, SAUTHKEY and SAUTH
  *    - USB powered
  *    - USB host interface commands to configure and save settings
+ *    - Binary framed host protocol with multi get, multi set and watch, see HostFrame.h
  *
  * The Remote controller needs the SSID and password for the wireless access point you are using. You can even 
  * tether to a hotspot from a smartphone. After you are connected to the WiFi access point the local IP address 
@@ -38,20 +42,29 @@
  * search box. 
  * 
  * UDP message format
- *    D = key down
- *    U = key up
+ *    D = key down, binary bytes after the D: seq, time it was keyed in uS (4 bytes,
+ *        little endian). A retransmission carries the original time
+ *    U = key up, as D
  *    . = generate a dit and space, dit function will block
  *    - = generate a dash and space, dash function will block
  *    W,xxx = speed in words per minute
+ *    W,xxx,www,rrr,fff = speed, weight in %, dah/dit ratio in tenths, Farnsworth character speed
  *    T,ddd,xxx = link test. ddd = message space in mS, xxx = sample size
  *    S,string = Send string, this function will block
+ *    M,n = play memory keyer message n on the Local
+ *    E = character frame in DDmode with CharMode set, binary bytes after the E:
+ *        seq, character number, element count, element bits (1 = dah, first element
+ *        in bit 0), wpm, weight, ratio
+ *    R = renew the key down lease on the Local, sent every 10 mS while the key is down
+ *
+ * D, U, . and - carry a sequence number and the Local acknowledges them with
+ * K, highest sequence number, 16 bit bitmap of the sequence numbers before it.
  *    
  *  To do list:
  *    - Add WPM command
  *    - Add enable / disable for side tone
  *    - Add enable / disable for audio mute
  *    - Add mute delay
- *    - Add connect button processing
  *
  * Release history:
  * 
@@ -67,10 +80,16 @@
 #include <string.h>
 #include <arduino-timer.h>
 #include "Button.h"
+#include "FastPin.h"
 #include "Remote.h"
 #include "serial.h"
 #include "Keyer.h"
+#include "EventQueue.h"
 #include "Errors.h"
+#include "HostFrame.h"
+#include "Profiler.h"
+#include "AllocTrack.h"
+#include "LoopStats.h"
 #include <EEPROM.h>
 
 extern "C" {
@@ -102,12 +121,24 @@ RemoteData Rev_1_rd =
   true,500,
   true,400,
   false,
+  50,30,0,
+  // Keep alive parameters
+  250,4000,3000,3,
+  false,
+  // UDP authentication
+  false,{0},
   SIGNATURE
 };
 
-Button ConnectPin;
+Button<PB> ConnectPin;
+
+Keyer<> keyer;
 
-Keyer keyer;
+// UDP message tags, see Auth.h
+Auth udpAuth;
+
+// Loop period histogram, overrun budget in uS
+LoopStats loopStats(5000);
 uint32_t lastKDtime;
 
 MDNSResponder mdns;
@@ -120,7 +151,31 @@ WiFiServer server(2015);
 WiFiClient client;
 WiFiUDP Udp;
 
-bool OpenOnConnection = false;
+// Connection manager. Once a connection is wanted, from the button or CONNECT, it
+// watches the WiFi and the TCP connection and retries with exponential backoff,
+// jittered so Remotes sharing an access point do not retry together. On every
+// TCP connect the session id and next sequence number are sent to the Local so
+// it keeps its receive window across a reconnect. Time to rekey is from losing
+// the link to having the session resumed. The TCP connect blocks the loop for up
+// to LinkConnectTimeout, long enough for a handshake over a cellular or hotspot
+// link, so it is only started once the paddles and straight key have been idle for
+// LinkConnectQuiet. A timeout is retried with backoff like any other failure.
+#define LinkWiFiTimeout   10000     // mS to wait for WiFi to associate
+#define LinkBackoffMin    250       // mS, first retry
+#define LinkBackoffMax    16000     // mS
+#define LinkConnectTimeout 2000     // mS, longest a TCP connect holds the loop
+#define LinkConnectQuiet  1000      // mS without paddle or key contact before a connect
+
+LinkStates    linkState = LinkIdle;
+uint32_t      linkTime;             // Time of the last state change or retry due time, mS
+uint32_t      linkLostAt = 0;       // Time the link was lost, 0 if it was not, mS
+int           linkAttempts = 0;
+uint16_t      sessionId;           // Boot counter, kept in EEPROM after the settings
+unsigned long reconnects = 0;
+uint32_t      rekeyLast = 0;        // mS
+uint32_t      rekeyMax = 0;         // mS
+bool ConnectHeld = false;           // Connect button is held down
+bool ChordUsed = false;             // A memory keyer chord was used while it was held
 
 // buffers for receiving and sending data
 char packetBuffer[UDP_TX_PACKET_MAX_SIZE];  // buffer to hold incoming packet
@@ -148,26 +203,340 @@ bool ConnectLED(void *)
   return true;
 }
 
-void SendDit(void)
+// Adaptive keep alive. Some WiFi links, an iPhone hotspot for one, doze when there
+// is no traffic and the first element after a pause is truncated. The first paddle
+// or key contact after idle sends a burst of keep alive packets to wake the link,
+// while the operator is active the keep alive is sent every PingActive mS and once
+// idle the interval doubles up to PingIdle. The first key event after idle is timed
+// to its acknowledgement, compare with the smoothed RTT from GACKSTAT to tune them.
+uint32_t      pingInterval = 0;     // mS
+uint32_t      lastPing = 0;         // mS
+uint32_t      lastActivity = 0;     // Last paddle or key contact, mS
+bool          firstPending = false; // The next key event is the first after idle
+unsigned long warmups = 0;
+unsigned long firstCount = 0;
+uint32_t      firstLast = 0;        // First element latency, uS
+uint32_t      firstMax = 0;         // uS
+unsigned long firstSum = 0;         // uS
+
+// Key events are queued by the keyer call backs and sent by the network task so
+// the keyer timing never waits on the WiFi stack. The network task only touches
+// WiFiUDP when the next key edge is at least NetSlack uS away.
+#define NetSlack  3000              // uS
+
+EventQueue<KeyEvent, 16> events;
+
+// The Local acknowledges key events with K,high,bitmap of the 16 before high. Every
+// event is kept until it is acknowledged, in a ring as wide as the bitmap, so a lost
+// key down is sent again even after the key up that followed it got through. An
+// acknowledgement that shows a later event arrived and this one did not is a gap,
+// the event is sent again at once if it was last sent at least a round trip ago.
+// Otherwise an event is sent again when its timeout runs out.
+//
+// The retransmit timeout is the smoothed round trip time plus 4 times its mean
+// deviation plus a margin, doubled on each timeout, and RetransmitFirst until a round
+// trip time is measured. The doubling is kept across events until a round trip time
+// is measured (RFC 6298 5.5), otherwise a path slower than the first timeout
+// retransmits every event and never gets a sample. Until an acknowledgement has been
+// seen the Local may not send them, so each event is sent again only once.
+#define RetransmitMargin  2000      // uS
+#define RetransmitMin     2000      // uS
+#define RetransmitMax     100000    // uS
+#define RetransmitFirst   20000     // uS, used before a round trip time is measured
+#define MaxRetransmits    5
+#define MaxBackoff        6         // Doublings, RetransmitFirst << 6 is above RetransmitMax
+#define RetransmitRing    16        // Unacknowledged events kept, the width of the bitmap
+
+typedef struct
 {
-  if(!rd.DDmode) return;
-  if(client)
+  bool      Active;
+  bool      First;                  // First key event after idle
+  KeyEvent  Event;
+  uint8_t   SeqNr;
+  uint32_t  Sent;                   // Time of the first send, uS
+  uint32_t  Last;                   // Time of the last send, uS
+  uint32_t  Due;                    // Time to retransmit, uS
+  int       Tries;
+  bool      Gap;                    // Due because an acknowledgement showed it missing
+} Pending;
+
+// Indexed by sequence number modulo RetransmitRing
+Pending       unacked[RetransmitRing];
+bool          acksSeen = false;
+uint32_t      srtt = 0;             // Smoothed round trip time, uS
+uint32_t      rttvar = 0;           // Mean deviation of the round trip time, uS
+unsigned long rttSamples = 0;
+int           rtoBackoff = 0;       // Timeout doublings since the last round trip sample
+unsigned long acksReceived = 0;
+unsigned long retransmits = 0;
+unsigned long superseded = 0;       // Unacknowledged events pushed out of the ring
+unsigned long abandoned = 0;        // Events given up after MaxRetransmits
+
+// While the key is down the lease on the Local is renewed every LeaseRenew uS with
+// an R message carrying the sequence number of the key down. Must match LeaseRenewal
+// in Local/Lease.h, the Local's shortest lease is four renewals.
+#define LeaseRenew  10000
+
+bool          leaseActive = false;
+uint8_t       leaseSeqNr;
+uint32_t      leaseDue;
+unsigned long eventsSent = 0;
+unsigned long sendLatencySum = 0;  // Queue to endPacket latency, uS
+unsigned long sendLatencyMax = 0;
+
+// Sends a message to the Local, with the stamp and tag added when authentication is
+// on. buf must have AuthTrailer bytes free after len.
+void UdpSend(uint8_t *buf, int len)
+{
+  if(rd.AuthEnable) len = udpAuth.sign(buf, len, millis());
+  Udp.beginPacket(serv, rd.udpPort);
+  Udp.write(buf, len);
   {
-    Udp.beginPacket(serv, rd.udpPort);
-    Udp.write('.');
-    Udp.write(SequenceNr);
-    Udp.endPacket(); 
-    Udp.flush();  
-    delay(1);     
-    Udp.beginPacket(serv, rd.udpPort);
-    Udp.write('.');
-    Udp.write(SequenceNr++);
+    PROFILE_ZONE("endPacket");
     Udp.endPacket(); 
-    Udp.flush();   
   }
+  Udp.flush();  
+}
+
+void SendUDP(char type, uint8_t seq)
+{
+  uint8_t buf[2 + AuthTrailer];
+
+  buf[0] = type;
+  buf[1] = seq;
+  UdpSend(buf, 2);
+}
+
+// Sends a key event. Key downs and ups carry the time they were keyed so the Local
+// can replay a burst with the operator's timing, character frames carry the elements
+// so far and the timing.
+void SendEvent(const KeyEvent &ev, uint8_t seq)
+{
+  if((ev.Type == 'D') || (ev.Type == 'U'))
+  {
+    uint8_t buf[6 + AuthTrailer];
+    buf[0] = ev.Type;
+    buf[1] = seq;
+    for(int i = 0; i < 4; i++) buf[2 + i] = ev.Time >> (8 * i);
+    UdpSend(buf, 6);
+    return;
+  }
+  if(ev.Type != 'E') { SendUDP(ev.Type, seq); return; }
+  Timing  &t = keyer.getTiming();
+  uint8_t buf[8 + AuthTrailer];
+  buf[0] = 'E';
+  buf[1] = seq;
+  buf[2] = ev.Char;
+  buf[3] = ev.Count;
+  buf[4] = ev.Bits;
+  buf[5] = t.wpm();
+  buf[6] = t.weight();
+  buf[7] = t.ratio();
+  UdpSend(buf, 8);
+}
+
+uint32_t RetransmitTimeout(void)
+{
+  uint32_t rto;
+
+  if(rttSamples == 0) rto = RetransmitFirst;
+  else rto = srtt + 4 * rttvar + RetransmitMargin;
+  rto <<= rtoBackoff;
+  if(rto < RetransmitMin) rto = RetransmitMin;
+  if(rto > RetransmitMax) rto = RetransmitMax;
+  return rto;
+}
+
+int ParsePacket(void)
+{
+  PROFILE_ZONE("parsePacket");
+  return Udp.parsePacket();
+}
+
+// Unacknowledged event i was acknowledged. The round trip time is only measured on
+// events that were not retransmitted.
+void Acknowledged(int i)
+{
+  Pending &p = unacked[i];
+
+  p.Active = false;
+  uint32_t rtt = micros() - p.Sent;
+  if(p.First)
+  {
+    // Includes any retransmits, this is what the operator sees
+    firstCount++;
+    firstLast = rtt;
+    firstSum += rtt;
+    if(rtt > firstMax) firstMax = rtt;
+  }
+  if(p.Tries > 0) return;
+  rtoBackoff = 0;
+  if(rttSamples++ == 0)
+  {
+    srtt = rtt;
+    rttvar = rtt / 2;
+  }
+  else
+  {
+    uint32_t err = (rtt > srtt) ? rtt - srtt : srtt - rtt;
+    srtt = srtt - (srtt >> 3) + (rtt >> 3);
+    rttvar = rttvar - (rttvar >> 2) + (err >> 2);
+  }
+}
+
+// Reads the acknowledgements from the Local and matches them against every
+// unacknowledged event, a gap is due for retransmit at once
+void ProcessAcks(void)
+{
+  uint8_t  *buf = (uint8_t *)packetBuffer;
+  uint16_t mask;
+  uint8_t  back;
+
+  while(ParsePacket() > 0)
+  {
+    if((Udp.read(packetBuffer, UDP_TX_PACKET_MAX_SIZE) < 4) || (buf[0] != 'K')) continue;
+    acksSeen = true;
+    acksReceived++;
+    mask = buf[2] | (buf[3] << 8);
+    uint32_t now = micros();
+    uint32_t guard = (rttSamples == 0) ? RetransmitMin : srtt;
+    for(int i = 0; i < RetransmitRing; i++)
+    {
+      Pending &p = unacked[i];
+      if(!p.Active) continue;
+      back = buf[1] - p.SeqNr;
+      if(back > 16) continue;
+      if((back == 0) || ((mask & (1 << (back - 1))) != 0)) Acknowledged(i);
+      else if((now - p.Last) >= guard)
+      {
+        p.Due = now;
+        p.Gap = true;
+      }
+    }
+  }
+}
+
+// Sends all the queued key events and retransmits the unacknowledged ones that are
+// due. Called from loop, waits while a key edge is due.
+void NetworkTask(void)
+{
+  KeyEvent ev;
+
+  if(keyer.slack() < NetSlack) return;
+  ProcessAcks();
+  while(events.pop(ev))
+  {
+    if(!client) continue;
+    if(ev.Type == 'p')
+    {
+      // Keep alive, does not use a sequence number
+      SendUDP('p', SequenceNr);
+      continue;
+    }
+    SendEvent(ev, SequenceNr);
+    if(ev.Type == 'D')
+    {
+      leaseActive = true;
+      leaseSeqNr = SequenceNr;
+      leaseDue = micros() + LeaseRenew;
+    }
+    else if(ev.Type == 'U') leaseActive = false;
+    uint32_t latency = micros() - ev.Time;
+    eventsSent++;
+    sendLatencySum += latency;
+    if(latency > sendLatencyMax) sendLatencyMax = latency;
+    Pending &p = unacked[SequenceNr % RetransmitRing];
+    if(p.Active) superseded++;
+    p.Active = true;
+    p.Event = ev;
+    p.First = firstPending;
+    firstPending = false;
+    p.SeqNr = SequenceNr;
+    p.Sent = p.Last = micros();
+    p.Tries = 0;
+    p.Gap = false;
+    p.Due = p.Sent + RetransmitTimeout();
+    SequenceNr++;
+  }
+  // Oldest first so a lost key down goes out ahead of the key up after it
+  for(int n = 0; n < RetransmitRing; n++)
+  {
+    Pending &p = unacked[(SequenceNr + n) % RetransmitRing];
+    if(!p.Active || ((int32_t)(micros() - p.Due) < 0)) continue;
+    if(client) SendEvent(p.Event, p.SeqNr);
+    p.Last = micros();
+    p.Tries++;
+    if(acksSeen)
+    {
+      retransmits++;
+      // A gap is not a timeout, the round trip time estimate still holds
+      if(!p.Gap && (rtoBackoff < MaxBackoff)) rtoBackoff++;
+    }
+    p.Gap = false;
+    if(!acksSeen || (p.Tries >= MaxRetransmits))
+    {
+      if(acksSeen) abandoned++;
+      p.Active = false;
+    }
+    else p.Due = p.Last + RetransmitTimeout();
+  }
+  if(leaseActive && ((int32_t)(micros() - leaseDue) >= 0))
+  {
+    if(client) SendUDP('R', leaseSeqNr);
+    leaseDue += LeaseRenew;
+    // Do not send a burst to catch up after a long stall
+    if((int32_t)(micros() - leaseDue) >= 0) leaseDue = micros() + LeaseRenew;
+  }
+}
+
+void QueueEvent(char type)
+{
+  KeyEvent ev;
+
+  ev.Type = type;
+  ev.Time = micros();
+  events.push(ev);
+}
+
+// Character frames. Each dit or dah sends the elements of the character so far, so
+// the Local can bridge a lost or late frame from the next one and only the last
+// frame of a character needs a retransmit. A gap of more than one dit after the
+// last element space starts a new character.
+uint8_t   frameChar = 0;
+uint8_t   frameCount = 0;
+uint8_t   frameBits = 0;
+uint32_t  frameEnd = 0;             // Expected end of the last element space, uS
+
+void QueueElement(bool dah)
+{
+  Timing   &t = keyer.getTiming();
+  uint32_t now = micros();
+  KeyEvent ev;
+
+  if((frameCount == 0) || (frameCount >= 8) || ((int32_t)(now - frameEnd) > (int32_t)t.Dit))
+  {
+    frameChar++;
+    frameCount = frameBits = 0;
+  }
+  if(dah) frameBits |= 1 << frameCount;
+  frameCount++;
+  frameEnd = now + (dah ? t.Dah : t.Dit) + t.Element;
+  ev.Type = 'E';
+  ev.Time = now;
+  ev.Char = frameChar;
+  ev.Count = frameCount;
+  ev.Bits = frameBits;
+  events.push(ev);
+}
+
+void SendDit(void)
+{
+  if(!rd.DDmode) return;
+  if(rd.CharMode) QueueElement(false);
+  else QueueEvent('.');
   if(rd.MuteEnable)
   {
-    digitalWrite(RELAY, HIGH);
+    FastPin<RELAY>::set();
     lastKDtime = millis();
   } 
 }
@@ -175,90 +544,90 @@ void SendDit(void)
 void SendDah(void)
 {
   if(!rd.DDmode) return;
-  if(client)
-  {
-    Udp.beginPacket(serv, rd.udpPort);
-    Udp.write('-');
-    Udp.write(SequenceNr);
-    Udp.endPacket(); 
-    Udp.flush();  
-    delay(1);     
-    Udp.beginPacket(serv, rd.udpPort);
-    Udp.write('-');
-    Udp.write(SequenceNr++);
-    Udp.endPacket(); 
-    Udp.flush();   
-  }
+  if(rd.CharMode) QueueElement(true);
+  else QueueEvent('-');
   if(rd.MuteEnable)
   {
-    digitalWrite(RELAY, HIGH);
+    FastPin<RELAY>::set();
     lastKDtime = millis();
   }  
 }
 
 void KeyDown(void)
 {
-  if(client)
-  {
-    Udp.beginPacket(serv, rd.udpPort);
-    Udp.write('D');
-    Udp.write(SequenceNr);
-    Udp.endPacket(); 
-    Udp.flush();  
-    delay(1);     
-    Udp.beginPacket(serv, rd.udpPort);
-    Udp.write('D');
-    Udp.write(SequenceNr++);
-    Udp.endPacket(); 
-    Udp.flush();   
-  }
+  QueueEvent('D');
   if(rd.MuteEnable)
   {
-    digitalWrite(RELAY, HIGH);
+    FastPin<RELAY>::set();
     lastKDtime = millis();
   }
-  digitalWrite(KEYOUT, HIGH);
+  FastPin<KEYOUT>::set();
 }
 
 void KeyUp(void)
 {
-  if(client)
-  {
-    Udp.beginPacket(serv, rd.udpPort);
-    Udp.write('U');
-    Udp.write(SequenceNr);
-    Udp.endPacket(); 
-    Udp.flush(); 
-    delay(1);       
-    Udp.beginPacket(serv, rd.udpPort);
-    Udp.write('U');
-    Udp.write(SequenceNr++);
-    Udp.endPacket(); 
-    Udp.flush(); 
-  }  
-  digitalWrite(KEYOUT, LOW);
+  QueueEvent('U');
+  FastPin<KEYOUT>::clear();
 }
 
-bool ping(void *)
+// Sends the keyer timing to the Local when it changes so the transmitter and the
+// side tone use the same element timing.
+// W,wpm,weight,ratio,farnsworth
+void SendTiming(void)
 {
-  // Send UDP message to keep link active, need this of iPhone WiFi link or else
-  // after pause first element is truncated.
-  if(client)
+  static bool wasConnected = false;
+  static int  wpm, weight, ratio, farnsworth;
+  Timing &t = keyer.getTiming();
+
+  if(!client) { wasConnected = false; return; }
+  if(wasConnected && (wpm == t.wpm()) && (weight == t.weight()) && (ratio == t.ratio()) && (farnsworth == t.farnsworth())) return;
+  wasConnected = true;
+  wpm = t.wpm();
+  weight = t.weight();
+  ratio = t.ratio();
+  farnsworth = t.farnsworth();
+  sprintf(ReplyBuffer, "W,%d,%d,%d,%d", wpm, weight, ratio, farnsworth);
+  UdpSend((uint8_t *)ReplyBuffer, strlen(ReplyBuffer));
+}
+
+// Asks the Local to play memory keyer message slot, M,n
+void SendPlayMessage(int slot)
+{
+  if(!client) return;
+  sprintf(ReplyBuffer, "M,%d", slot);
+  UdpSend((uint8_t *)ReplyBuffer, strlen(ReplyBuffer));
+}
+
+void KeepAliveTask(void)
+{
+  uint32_t now = millis();
+
+  if(!FastPin<DIT>::read() || !FastPin<DAH>::read() || !FastPin<SK>::read())
   {
-    Udp.beginPacket(serv, rd.udpPort);
-    Udp.write('p');
-    Udp.write(SequenceNr);
-    Udp.endPacket(); 
-    Udp.flush(); 
-  }  
-  return true;
+    if((now - lastActivity) > (uint32_t)rd.PingHold)
+    {
+      for(int i = 0; i < rd.Warmup; i++) QueueEvent('p');
+      warmups++;
+      firstPending = true;
+    }
+    lastActivity = now;
+    pingInterval = rd.PingActive;
+  }
+  if((now - lastPing) < pingInterval) return;
+  lastPing = now;
+  QueueEvent('p');
+  if((now - lastActivity) > (uint32_t)rd.PingHold)
+  {
+    pingInterval *= 2;
+    if(pingInterval > (uint32_t)rd.PingIdle) pingInterval = rd.PingIdle;
+  }
 }
 
 void setup()
 {
   delay(100);
   // Storage for system data
-  EEPROM.begin(sizeof(RemoteData));
+  EEPROM.begin(sizeof(RemoteData) + sizeof(sessionId));
   // Load the EEPROM save data into working memory
   EEPROM.get(0,rd);
   if(rd.Signature != SIGNATURE) rd = Rev_1_rd;
@@ -277,18 +646,28 @@ void setup()
   wifi.disconnect();
   // Setup keyer and setup callbacks
   keyer.begin();
+  udpAuth.setKey(rd.AuthKey);
   keyer.attachKeyDownCallBack(KeyDown);
   keyer.attachKeyUpCallBack(KeyUp);
   keyer.attachSendingDitCallBack(SendDit);
   keyer.attachSendingDahCallBack(SendDah);
-  keyer.setSpeed(rd.wpm);
+  keyer.setTiming(rd.wpm, rd.Weight, rd.Ratio, rd.Farnsworth);
   keyer.enableSidetone(rd.STenable);
   keyer.setSidetoneFreq(rd.STfreq);
   // Start connect status LED
   timer.every(500, ConnectLED);
-  // Start key alive link
-  timer.every(1000, ping);
-  ConnectPin.begin(PB);
+  pingInterval = rd.PingIdle;
+  ConnectPin.begin();
+  // Session id for the Local, counts boots so each session is newer than the last
+  // and the Local's replay window can tell them apart, never 0
+  EEPROM.get(sizeof(RemoteData), sessionId);
+  if(++sessionId == 0) sessionId = 1;
+  EEPROM.put(sizeof(RemoteData), sessionId);
+  EEPROM.commit();
+  udpAuth.session(sessionId);
+#ifdef ALLOC_TRACKING
+  allocTrack.arm();
+#endif
 }
 
 // This function process all the serial IO and commands
@@ -297,7 +676,7 @@ void ProcessSerial(bool scan = true)
   // Put serial received characters in the input ring buffer
   if (Serial.available() > 0)
   {
-    PutCh(Serial.read());
+    HostInput(Serial.read(), &Serial);
   }
   if (!scan) return;
   // If there is a command in the input ring buffer, process it!
@@ -307,9 +686,21 @@ void ProcessSerial(bool scan = true)
 // Main processing loop.
 void loop(void)
 {
-  timer.tick();
+  loopStats.enter("timer");
+  {
+    PROFILE_ZONE("timer.tick");
+    timer.tick();
+  }
+  loopStats.enter("serial");
   ProcessSerial();
+  loopStats.enter("keyer");
+  KeepAliveTask();
   keyer.process();
+  loopStats.enter("host");
+  HostPoll();
+  loopStats.enter("network");
+  NetworkTask();
+  loopStats.enter("status");
   rd.Status = wifi.status();
   if(rd.MuteEnable)
   {
@@ -322,34 +713,151 @@ void loop(void)
       serial->write(client.read());
     }
   }
-  keyer.setSpeed(rd.wpm);
+  keyer.setTiming(rd.wpm, rd.Weight, rd.Ratio, rd.Farnsworth);
+  SendTiming();
   keyer.setDDmode(rd.DDmode);
   keyer.enableSidetone(rd.STenable);
   keyer.setSidetoneFreq(rd.STfreq);
-  if(ConnectPin.pressed())
+  // Connect button. While it is held the keyer is paused and the dit paddle, dah
+  // paddle or straight key plays memory keyer message 1, 2 or 3 on the Local. If
+  // none was used the release toggles the connection.
+  switch (ConnectPin.edge())
   {
-    // Here when connect button press is detected.
-    // If we are connected then disconnect, if we are not connected then connect!
-    if(rd.Status == WL_CONNECTED)
-    {
-       if (client.connected()) client.stop();
-       wifi.disconnect();
-    }
-    else
+    case 1:
+      ConnectHeld = true;
+      ChordUsed = false;
+      keyer.pause(true);
+      break;
+    case -1:
+      ConnectHeld = false;
+      keyer.pause(false);
+      if(ChordUsed) break;
+      // Here when connect button press is detected.
+      // If a connection is wanted then disconnect, if not then connect!
+      if(linkState != LinkIdle) LinkDisconnect();
+      else LinkConnect();
+      break;
+    default:
+      break;
+  }
+  if(ConnectHeld && !ChordUsed)
+  {
+    int slot = 0;
+    if(!FastPin<DIT>::read()) slot = 1;
+    else if(!FastPin<DAH>::read()) slot = 2;
+    else if(!FastPin<SK>::read()) slot = 3;
+    if(slot != 0)
     {
-       wifi.begin(rd.ssid, rd.password);
-       wifi.hostname(rd.host);
-       OpenOnConnection = true;  
+      SendPlayMessage(slot);
+      ChordUsed = true;
     }
   }
-  if((OpenOnConnection) && (rd.Status == WL_CONNECTED))
+  loopStats.enter("connect");
+  ConnectionTask();
+  loopStats.tick();
+}
+
+void LinkState(LinkStates state)
+{
+  linkState = state;
+  linkTime = millis();
+}
+
+// Schedules the next retry, the delay doubles with each attempt and is jittered
+// between half and all of it
+void LinkRetry(void)
+{
+  uint32_t backoff = LinkBackoffMin << ((linkAttempts < 6) ? linkAttempts : 6);
+
+  if(backoff > LinkBackoffMax) backoff = LinkBackoffMax;
+  backoff = backoff / 2 + random(backoff / 2 + 1);
+  linkAttempts++;
+  LinkState(LinkBackoff);
+  linkTime += backoff;
+}
+
+void LinkLost(void)
+{
+  if(linkLostAt == 0) linkLostAt = millis();
+  if(client.connected()) client.stop();
+  LinkRetry();
+}
+
+// Tells the Local which session this connection belongs to, SESSION,id,seq
+void SendSession(void)
+{
+  client.print("SESSION,");
+  client.print(sessionId);
+  client.print(",");
+  client.println(SequenceNr);
+}
+
+void ConnectionTask(void)
+{
+  switch (linkState)
   {
-    OpenOnConnection = false;
-    client.connect(serv, rd.tcpPort);
-    Udp.begin(rd.udpPort);
+    case LinkIdle:
+      break;
+    case LinkWiFi:
+      if(wifi.status() == WL_CONNECTED) LinkState(LinkTCP);
+      else if((millis() - linkTime) > LinkWiFiTimeout)
+      {
+        wifi.disconnect();
+        LinkLost();
+      }
+      break;
+    case LinkTCP:
+      if(wifi.status() != WL_CONNECTED) { LinkLost(); break; }
+      if(!keyer.idle() || ((millis() - lastActivity) < LinkConnectQuiet)) break;
+      client.setTimeout(LinkConnectTimeout);
+      if(!client.connect(serv, rd.tcpPort)) { LinkLost(); break; }
+      Udp.begin(rd.udpPort);
+      SendSession();
+      if(linkLostAt != 0)
+      {
+        rekeyLast = millis() - linkLostAt;
+        if(rekeyLast > rekeyMax) rekeyMax = rekeyLast;
+        reconnects++;
+        linkLostAt = 0;
+      }
+      linkAttempts = 0;
+      LinkState(LinkUp);
+      break;
+    case LinkUp:
+      if((wifi.status() != WL_CONNECTED) || !client.connected()) LinkLost();
+      break;
+    case LinkBackoff:
+      if((int32_t)(millis() - linkTime) < 0) break;
+      if(wifi.status() == WL_CONNECTED) LinkState(LinkTCP);
+      else
+      {
+        wifi.begin(rd.ssid, rd.password);
+        wifi.hostname(rd.host);
+        LinkState(LinkWiFi);
+      }
+      break;
   }
 }
 
+// Starts the connection manager, a connection already up is kept
+void LinkConnect(void)
+{
+  linkAttempts = 0;
+  linkLostAt = 0;
+  if(client.connected()) { LinkState(LinkUp); return; }
+  if(wifi.status() == WL_CONNECTED) { LinkState(LinkTCP); return; }
+  wifi.begin(rd.ssid, rd.password);
+  wifi.hostname(rd.host);
+  LinkState(LinkWiFi);
+}
+
+void LinkDisconnect(void)
+{
+  LinkState(LinkIdle);
+  if(client.connected()) client.stop();
+  wifi.disconnect();
+}
+
 // Host commands, called from serial.cpp
 
 void listNetworks()
@@ -434,6 +942,7 @@ void RestoreSettings(void)
     SendNAK;
     return;
   }
+  udpAuth.setKey(rd.AuthKey);
   SendACK;    
 }
 
@@ -454,22 +963,72 @@ void GetSrvIP(void)
   serial->println(serv);
 }
 
+// Keyer timing, checked against the same limits as the Local so the Remote never
+// runs with a timing table the Local would refuse
+void SetWPM(int wpm)
+{
+  if((wpm < minWPM) || (wpm > maxWPM))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  rd.wpm = wpm;
+  keyer.setTiming(rd.wpm, rd.Weight, rd.Ratio, rd.Farnsworth);
+  SendACK;
+}
+
+void SetWeight(int weight)
+{
+  if((weight < minWeight) || (weight > maxWeight))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  rd.Weight = weight;
+  keyer.setTiming(rd.wpm, rd.Weight, rd.Ratio, rd.Farnsworth);
+  SendACK;
+}
+
+void SetRatio(int ratio)
+{
+  if((ratio < minRatio) || (ratio > maxRatio))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  rd.Ratio = ratio;
+  keyer.setTiming(rd.wpm, rd.Weight, rd.Ratio, rd.Farnsworth);
+  SendACK;
+}
+
+// Farnsworth character speed, 0 turns Farnsworth timing off
+void SetFarnsworth(int farnsworth)
+{
+  if((farnsworth != 0) && ((farnsworth < minWPM) || (farnsworth > maxWPM)))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  rd.Farnsworth = farnsworth;
+  keyer.setTiming(rd.wpm, rd.Weight, rd.Ratio, rd.Farnsworth);
+  SendACK;
+}
+
 void Connect(void)
 {
-    wifi.begin(rd.ssid, rd.password);
-    wifi.hostname(rd.host); 
+    LinkConnect();
     SendACK;
 }
 
+// Stops the connection manager whatever state the link is in, a retry or WiFi
+// association in progress is cancelled too
 void Disconnect(void)
 {
-    if (wifi.status() != WL_CONNECTED)
-    {
-      SetErrorCode(ERR_WIFINOTCONNECTED);
-      SendNAK;  
-      return;
-    }
-    wifi.disconnect();  
+    LinkDisconnect();
     SendACK;
 }
 
@@ -537,8 +1096,7 @@ void OpenClient(void)
 {
   if(wifi.status() == WL_CONNECTED)
   {
-    client.connect(serv, rd.tcpPort);
-    Udp.begin(rd.udpPort);
+    LinkConnect();
     SendACK;
     return;
   }
@@ -550,6 +1108,8 @@ void CloseClient(void)
 {
   if (client.connected()) 
   {
+    // The connection manager would reopen it
+    LinkState(LinkIdle);
     client.stop();
     SendACK;
     return;
@@ -571,6 +1131,230 @@ void SendClientMessage(void)
   SendACK;
 }
 
+// Reports the key event queue depth, high water mark, overflows, events sent,
+// average and max queue to send latency in uS
+void NetStats(void)
+{
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(events.count());
+  serial->print(",");
+  serial->print(events.highWater());
+  serial->print(",");
+  serial->print(events.overflowed());
+  serial->print(",");
+  serial->print(eventsSent);
+  serial->print(",");
+  if(eventsSent > 0) serial->print(sendLatencySum / eventsSent);
+  else serial->print(0);
+  serial->print(",");
+  serial->println(sendLatencyMax);
+}
+
+void ResetNetStats(void)
+{
+  events.resetStats();
+  eventsSent = sendLatencySum = sendLatencyMax = 0;
+  acksReceived = retransmits = superseded = abandoned = 0;
+  warmups = firstCount = firstSum = firstLast = firstMax = 0;
+  SendACK;
+}
+
+// Returns acks received, retransmits, superseded, abandoned, smoothed RTT uS,
+// RTT deviation uS
+void AckStats(void)
+{
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(acksReceived);
+  serial->print(",");
+  serial->print(retransmits);
+  serial->print(",");
+  serial->print(superseded);
+  serial->print(",");
+  serial->print(abandoned);
+  serial->print(",");
+  serial->print(srtt);
+  serial->print(",");
+  serial->println(rttvar);
+}
+
+// Sets the UDP authentication key, 32 hex digits given as two halves of 16 to fit
+// the command tokens. It is saved with SAVE.
+void SetAuthKey(char *first, char *second)
+{
+  uint8_t key[AuthKeySize];
+  char    hex[2 * AuthKeySize + 1];
+
+  if((strlen(first) != AuthKeySize) || (strlen(second) != AuthKeySize) || !Auth::parseKey(strcat(strcpy(hex, first), second), key))
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  memcpy(rd.AuthKey, key, AuthKeySize);
+  udpAuth.setKey(key);
+  SendACK;
+}
+
+// Times tagging a character frame, the longest keying message. Returns uS per
+// message and the SipHash reference vector result, PASS or FAIL.
+void AuthBenchmark(void)
+{
+  Auth     bench;
+  uint8_t  frame[8 + AuthTrailer];
+  uint32_t start, total = 0;
+
+  bench.setKey(rd.AuthKey);
+  memset(frame, 0, sizeof(frame));
+  for(int i = 0; i < 100; i++)
+  {
+    frame[0] = 'E';
+    frame[1] = i;
+    start = micros();
+    bench.sign(frame, 8, i);
+    total += micros() - start;
+  }
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(total / 100.0);
+  serial->print(",");
+  serial->println(Auth::selfTest() ? "PASS" : "FAIL");
+}
+
+// Returns keep alive interval mS, warm up bursts, first element count, last, average
+// and worst first element latency uS
+void KeepAliveStats(void)
+{
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(pingInterval);
+  serial->print(",");
+  serial->print(warmups);
+  serial->print(",");
+  serial->print(firstCount);
+  serial->print(",");
+  serial->print(firstLast);
+  serial->print(",");
+  if(firstCount > 0) serial->print(firstSum / firstCount);
+  else serial->print(0);
+  serial->print(",");
+  serial->println(firstMax);
+}
+
+// Returns link state, retry attempts, reconnects, last and worst time to rekey in mS
+void LinkStats(void)
+{
+  SendACKonly;
+  if(SerialMute) return;
+  serial->print(linkState);
+  serial->print(",");
+  serial->print(linkAttempts);
+  serial->print(",");
+  serial->print(reconnects);
+  serial->print(",");
+  serial->print(rekeyLast);
+  serial->print(",");
+  serial->println(rekeyMax);
+}
+
+// Returns loops, overruns, worst loop period uS, the part of the loop that ran longest in
+// it, then the loop period histogram, bin n counts 2^n to 2^(n+1)-1 uS
+void GetLoop(void)
+{
+  SendACKonly;
+  if(!SerialMute) loopStats.report(serial);
+}
+
+void ResetLoop(void)
+{
+  loopStats.reset();
+  SendACK;
+}
+
+// Returns name, calls, average and worst case cycles for each profiler zone
+void GetProfile(void)
+{
+#ifdef PROFILING
+  SendACKonly;
+  if(!SerialMute) profiler().report(serial);
+#else
+  SetErrorCode(ERR_NOTSUPPORTED);
+  SendNAK;
+#endif
+}
+
+void ResetProfile(void)
+{
+#ifdef PROFILING
+  profiler().reset();
+  SendACK;
+#else
+  SetErrorCode(ERR_NOTSUPPORTED);
+  SendNAK;
+#endif
+}
+
+// Reports heap in use from the free heap, peak and violations, the ESP8266 has no
+// allocation hooks
+void GetAlloc(void)
+{
+#ifdef ALLOC_TRACKING
+  SendACKonly;
+  AllocSample();
+  if(!SerialMute) allocTrack.report(serial);
+#else
+  SetErrorCode(ERR_NOTSUPPORTED);
+  SendNAK;
+#endif
+}
+
+void ResetAlloc(void)
+{
+#ifdef ALLOC_TRACKING
+  allocTrack.reset();
+  SendACK;
+#else
+  SetErrorCode(ERR_NOTSUPPORTED);
+  SendNAK;
+#endif
+}
+
+// Test mode, TRUE clears the violations and reports each new one on the serial port
+void SetAllocTest(char *state)
+{
+#ifdef ALLOC_TRACKING
+  if(strcmp(state,"TRUE") == 0)
+  {
+    allocTrack.reset();
+    allocTrack.testMode = true;
+  }
+  else if(strcmp(state,"FALSE") == 0) allocTrack.testMode = false;
+  else
+  {
+    SetErrorCode(ERR_BADARG);
+    SendNAK;
+    return;
+  }
+  SendACK;
+#else
+  SetErrorCode(ERR_NOTSUPPORTED);
+  SendNAK;
+#endif
+}
+
+// Reports PASS or FAIL, zone and bytes of the first violation
+void GetAllocTest(void)
+{
+#ifdef ALLOC_TRACKING
+  SendACKonly;
+  if(!SerialMute) allocTrack.result(serial);
+#else
+  SetErrorCode(ERR_NOTSUPPORTED);
+  SendNAK;
+#endif
+}
+
 void GetClientMessage(void)
 {
   if(client.connected())
@@ -10,6 +10,9 @@
 #include "string.h"
 #include "Serial.h"
 #include "Errors.h"
+#include "Response.h"
+#include "Profiler.h"
+#include "AllocTrack.h"
 #include "Remote.h"
 //#include <Wire.h>
 //#include <SPI.h>
@@ -64,8 +67,35 @@ Commands  CmdArray[] =   {
    {"CLOSE", CMDfunction, 0, (char *)CloseClient},                        // Close client connection
    {"SCLIENT", CMDfunctionLine, 0, (char *)SendClientMessage},            // Send message to client
    {"GCLIENT", CMDfunction, 0, (char *)GetClientMessage},                 // Read message from client
+   {"GNETSTAT", CMDfunction, 0, (char *)NetStats},                        // Report key event queue and send latency stats
+   {"RNETSTAT", CMDfunction, 0, (char *)ResetNetStats},                   // Reset key event queue, send latency and ack stats
+   {"GLINK", CMDfunction, 0, (char *)LinkStats},                          // Report link state, retries, reconnects, last and worst rekey time mS
+   {"GKALIVE", CMDfunction, 0, (char *)KeepAliveStats},                   // Report keep alive interval, warm ups, first element count, last, avg, worst uS
+   {"SPINGACT",  CMDint, 1, (char *)&rd.PingActive},                      // Set keep alive interval in mS while active
+   {"GPINGACT",  CMDint, 0, (char *)&rd.PingActive},                      // Return keep alive interval in mS while active
+   {"SPINGIDLE",  CMDint, 1, (char *)&rd.PingIdle},                       // Set longest keep alive interval in mS when idle
+   {"GPINGIDLE",  CMDint, 0, (char *)&rd.PingIdle},                       // Return longest keep alive interval in mS when idle
+   {"SPINGHOLD",  CMDint, 1, (char *)&rd.PingHold},                       // Set mS with no contact before idle
+   {"GPINGHOLD",  CMDint, 0, (char *)&rd.PingHold},                       // Return mS with no contact before idle
+   {"SWARMUP",  CMDint, 1, (char *)&rd.Warmup},                           // Set keep alive packets sent on first contact after idle
+   {"GWARMUP",  CMDint, 0, (char *)&rd.Warmup},                           // Return keep alive packets sent on first contact after idle
+   {"GLOOP", CMDfunction, 0, (char *)GetLoop},                            // Report loops, overruns, worst uS, worst part of the loop, histogram
+   {"RLOOP", CMDfunction, 0, (char *)ResetLoop},                          // Reset the loop statistics
+   {"SLOOPBUD", CMDint, 1, (char *)&loopStats.budget},                    // Set loop overrun budget in uS
+   {"GLOOPBUD", CMDint, 0, (char *)&loopStats.budget},                    // Report loop overrun budget in uS
+   {"GPROF", CMDfunction, 0, (char *)GetProfile},                         // Report name, calls, average and worst cycles for each profiler zone
+   {"RPROF", CMDfunction, 0, (char *)ResetProfile},                       // Reset the profiler zones
+   {"GALLOC", CMDfunction, 0, (char *)GetAlloc},                          // Report heap in use, peak and hot path allocations, see AllocTrack.h
+   {"RALLOC", CMDfunction, 0, (char *)ResetAlloc},                        // Reset the allocation peak and violations
+   {"SALLOCTEST", CMDfunctionStr, 1, (char *)SetAllocTest},               // Set allocation test mode, TRUE or FALSE
+   {"GALLOCTEST", CMDfunction, 0, (char *)GetAllocTest},                  // Report PASS or FAIL, zone and bytes of the first hot path allocation
+   {"GACKSTAT", CMDfunction, 0, (char *)AckStats},                        // Report acks, retransmits, superseded, abandoned, RTT, RTT deviation
+   {"SAUTH", CMDbool, 1, (char *)&rd.AuthEnable},                         // Set tagging of UDP messages to the Local, TRUE or FALSE
+   {"GAUTH", CMDbool, 0, (char *)&rd.AuthEnable},                         // Return UDP message tagging, TRUE or FALSE
+   {"SAUTHKEY", CMDfunctionStr, 2, (char *)SetAuthKey},                   // Set the UDP authentication key, 32 hex digits as two groups of 16
+   {"BAUTH", CMDfunction, 0, (char *)AuthBenchmark},                      // Report uS to tag a message, SipHash self test PASS or FAIL
 // Keyer commands
-   {"SWPM",  CMDint, 1, (char *)&rd.wpm},                                 // Set speed in wpm
+   {"SWPM",  CMDfunction, 1, (char *)SetWPM},                             // Set speed in wpm
    {"GWPM",  CMDint, 0, (char *)&rd.wpm},                                 // Return speed in wpm
    {"SMUTEENA",  CMDbool, 1, (char *)&rd.MuteEnable},                     // Set Mute enable, TRUE or FALSE
    {"GMUTEENA",  CMDbool, 0, (char *)&rd.MuteEnable},                     // Return Mute enable, TRUE or FALSE
@@ -73,8 +103,16 @@ Commands  CmdArray[] =   {
    {"GMUTETM",  CMDint, 0, (char *)&rd.MuteHold},                         // Return Mute hold time in mSec
    {"SDDMODE",  CMDbool, 1, (char *)&rd.DDmode},                          // Set Dit Dah mode, TRUE or FALSE
    {"GDDMODE",  CMDbool, 0, (char *)&rd.DDmode},                          // Return Dit Dah mode, TRUE or FALSE
+   {"SCHARMODE",  CMDbool, 1, (char *)&rd.CharMode},                      // Set character frames in Dit Dah mode, TRUE or FALSE
+   {"GCHARMODE",  CMDbool, 0, (char *)&rd.CharMode},                      // Return character frames in Dit Dah mode, TRUE or FALSE
    {"SSTENA",  CMDbool, 1, (char *)&rd.STenable},                         // Set side tone enable, TRUE or FALSE
    {"GSTENA",  CMDbool, 0, (char *)&rd.STenable},                         // Return side tone enable, TRUE or FALSE
+   {"SWEIGHT",  CMDfunction, 1, (char *)SetWeight},                       // Set mark/space weight in percent, 50 is standard
+   {"GWEIGHT",  CMDint, 0, (char *)&rd.Weight},                           // Return mark/space weight in percent
+   {"SRATIO",  CMDfunction, 1, (char *)SetRatio},                         // Set dah/dit ratio in tenths, 30 is standard
+   {"GRATIO",  CMDint, 0, (char *)&rd.Ratio},                             // Return dah/dit ratio in tenths
+   {"SFARNS",  CMDfunction, 1, (char *)SetFarnsworth},                    // Set Farnsworth character speed in WPM, 0 is off
+   {"GFARNS",  CMDint, 0, (char *)&rd.Farnsworth},                        // Return Farnsworth character speed in WPM
    {"SSTFREQ",  CMDint, 1, (char *)&rd.STfreq},                           // Set side tone frequency in Hz
    {"GSTFREQ",  CMDint, 0, (char *)&rd.STfreq},                           // Return side tone frequency in Hz
 // End of table marker
@@ -133,36 +171,39 @@ void Char2Token(char ch)
   if (Tptr >= MaxToken) Tptr = MaxToken - 1;
 }
 
-// Get token from string object, delimited with comma
-// Token are numbered 1 through n, returns empty string
-// at end of tokens
-String GetToken(String cmd, int TokenNum)
+// Get token from a comma delimited string into token, size bytes at most.
+// Tokens are numbered 1 through n and are trimmed, returns token, an empty
+// string at end of tokens
+char *GetToken(const char *cmd, int TokenNum, char *token, int size)
 {
-  int i, j, k;
-  String Token;
+  int i;
 
-  // If TokenNum is 0 or 1 then return the first token.
-  // Return up to delimiter of the whole string.
-  cmd.trim();
-  if (TokenNum <= 1)
-  {
-    if ((i = cmd.indexOf(',')) == -1) return cmd;
-    Token = cmd.substring(0, i);
-    return Token;
-  }
-  // Find the requested token
-  k = 0;
   for (i = 2; i <= TokenNum; i++)
   {
-    if ((j = cmd.indexOf(',', k)) == -1) return "";
-    k = j + 1;
+    if ((cmd = strchr(cmd, ',')) == NULL)
+    {
+      token[0] = 0;
+      return token;
+    }
+    cmd++;
   }
-  Token = cmd.substring(k);
-  Token.trim();
-  if ((j = Token.indexOf(',')) == -1) return Token;
-  Token = Token.substring(0, j);
-  Token.trim();
-  return Token;
+  while (isspace(*cmd)) cmd++;
+  for (i = 0; (i < size - 1) && (cmd[i] != 0) && (cmd[i] != ','); i++) token[i] = cmd[i];
+  while ((i > 0) && isspace(token[i - 1])) i--;
+  token[i] = 0;
+  return token;
+}
+
+// Removes leading and trailing white space from a string in place, returns
+// a pointer to the first character kept
+char *Trim(char *str)
+{
+  int i;
+
+  while (isspace(*str)) str++;
+  for (i = strlen(str); (i > 0) && isspace(str[i - 1]); i--);
+  str[i] = 0;
+  return str;
 }
 
 // This function reads the serial input ring buffer and returns a pointer to a ascii token.
@@ -288,22 +329,42 @@ void ExecuteCommand(Commands *cmd, int arg1, int arg2, char *args1, char *args2,
   }
 }
 
-// This function processes serial commands.
+// Command responses are staged here and sent when the command is done
+Response response;
+
+static enum  PCstates state;
+static bool lstrmode = false;
+
+// This function processes serial commands. The output goes through the response
+// buffer, it is sent when a command is done or there is nothing left to do.
 // This function does not block and returns -1 if there was nothing to do.
 int ProcessCommand(void)
 {
-  String sToken;
-  char   *Token, ch;
+  int result;
+
+  if(serial == &response) return ProcessToken();
+  PROFILE_ZONE("ProcessCommand");
+  ALLOC_GUARD("ProcessCommand");
+  response.attach(serial);
+  serial = &response;
+  result = ProcessToken();
+  serial = response.target();
+  if((result != 0) || ((state == PCcmd) && !lstrmode)) response.flush();
+  return result;
+}
+
+// Processes the next token from the ring buffer
+int ProcessToken(void)
+{
+  char   *Token, *arg, ch;
   int    i;
   static int   arg1, arg2;
   static float farg1;
-  static enum  PCstates state;
   static int   CmdNum;
   static char  delimiter = 0;
   // The following variables are used for the long string reading mode
   static char *lstrptr = NULL;
   static int  lstrindex;
-  static bool lstrmode = false;
   static int lstrmax;
 
   // Wait for line in ringbuffer
@@ -382,27 +443,23 @@ int ProcessCommand(void)
       break;
     case PCarg1:
       Sarg1[0] = 0;
-      sToken = Token;
-      sToken.trim();
-      arg1 = sToken.toInt();
-      farg1 = sToken.toFloat();
-      strcpy(Sarg1, sToken.c_str());
+      arg = Trim(Token);
+      arg1 = atol(arg);
+      farg1 = atof(arg);
+      strcpy(Sarg1, arg);
       if (CmdArray[CmdNum].NumArgs > 1) state = PCarg2;
       else state = PCend;
       break;
     case PCarg2:
       Sarg2[0] = 0;
-      sToken = Token;
-      sToken.trim();
-      arg2 = sToken.toInt();
-      strcpy(Sarg2, sToken.c_str());
+      arg = Trim(Token);
+      arg2 = atol(arg);
+      strcpy(Sarg2, arg);
       if (CmdArray[CmdNum].NumArgs > 2) state = PCarg3;
       else state = PCend;
       break;
     case PCarg3:
-      sToken = Token;
-      sToken.trim();
-      farg1 = sToken.toFloat();
+      farg1 = atof(Trim(Token));
       state = PCend;
       break;
     case PCend:
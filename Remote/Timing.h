@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Morse element timing table. The Remote keyer and the Local transmitter both use
+// this table so they agree to the microsecond.
+//
+// The dit unit is calculated in 1/256 uS fixed point and rounded to uS when the
+// table is built, so 45 WPM gives a 26667 uS dit rather than 26 mS.
+//
+//  wpm         Overall speed in words per minute, PARIS timing
+//  weight      Mark to space weighting in percent, 50 is standard. Each mark is
+//              lengthened by (weight-50)/50 of a dit and the following space is
+//              shortened by the same amount.
+//  ratio       Dah to dit ratio in tenths, 30 is standard
+//  farnsworth  Character speed in WPM. When above wpm the characters are sent at
+//              this speed and the character and word spaces are stretched to give
+//              the overall wpm (ARRL Farnsworth timing). 0 disables.
+//
+// The table is only rebuilt when a parameter changes.
+
+#define minWeight   25
+#define maxWeight   75
+#define minRatio    20
+#define maxRatio    50
+
+class Timing
+{
+  private:
+    int WPM        = 20;
+    int Weight     = 50;
+    int Ratio      = 30;
+    int Farnsworth = 0;
+  public:
+    // 20 WPM until set, a speed that is rejected keeps the table as it is
+    uint32_t Dit       = 60000;   // Dit mark, uS
+    uint32_t Dah       = 180000;  // Dah mark, uS
+    uint32_t Element   = 60000;   // Space between elements, uS
+    uint32_t Character = 180000;  // Space between characters, uS
+    uint32_t Word      = 420000;  // Space between words, uS
+
+    int wpm(void) { return WPM; }
+    int weight(void) { return Weight; }
+    int ratio(void) { return Ratio; }
+    int farnsworth(void) { return Farnsworth; }
+    void set(int wpm) { set(wpm, Weight, Ratio, Farnsworth); }
+    void set(int wpm, int weight, int ratio, int farnsworth)
+    {
+      if(wpm <= 0) return;
+      if(weight < minWeight) weight = minWeight;
+      if(weight > maxWeight) weight = maxWeight;
+      if(ratio < minRatio) ratio = minRatio;
+      if(ratio > maxRatio) ratio = maxRatio;
+      if(farnsworth <= wpm) farnsworth = 0;
+      if((wpm == WPM) && (weight == Weight) && (ratio == Ratio) && (farnsworth == Farnsworth)) return;
+      WPM = wpm;
+      Weight = weight;
+      Ratio = ratio;
+      Farnsworth = farnsworth;
+      // Element unit at the character speed, 1/256 uS
+      int      cspeed = (Farnsworth != 0) ? Farnsworth : WPM;
+      uint32_t unit   = (1200000UL << 8) / cspeed;
+      int32_t  adj    = ((int32_t)unit * (Weight - 50)) / 50;
+      // Spacing unit, stretched for Farnsworth timing
+      uint32_t space  = unit;
+      if(Farnsworth != 0) space = ((uint64_t)(60000UL * Farnsworth - 37200UL * WPM) * 256000ULL) / (19UL * Farnsworth * WPM);
+      Dit       = round8(unit + adj);
+      Dah       = round8((unit * Ratio) / 10 + adj);
+      Element   = round8(unit - adj);
+      Character = round8(3 * space - adj);
+      Word      = round8(7 * space - adj);
+    }
+  private:
+    static uint32_t round8(int32_t v) { return (v < 0) ? 0 : (uint32_t)((v + 128) >> 8); }
+};